@@ -0,0 +1,214 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Decode throughput for the buffers in a GPU error state, which the kernel
+ * dumps zlib compressed and ascii85 encoded. A synthetic object is
+ * encoded the same way and decoded over and over, reporting GB/s of input.
+ *
+ * -m ascii85|generic|inflate|all: time the (vectorised) ascii85 decoder,
+ *    the plain C one, inflate alone or both steps, as intel_error_decode
+ * -s size of the object, -z percentage of zero dwords in it
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "igt_ascii85.h"
+
+static double elapsed(const struct timespec *start,
+		const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
+/* Encode as the kernel does, with 'z' for zero dwords */
+static size_t ascii85_encode(const uint32_t *in, size_t count, char *out)
+{
+	size_t len = 0;
+
+	while (count--) {
+		uint32_t v = *in++;
+		int i;
+
+		if (v == 0) {
+			out[len++] = 'z';
+			continue;
+		}
+
+		for (i = 4; i >= 0; i--) {
+			out[len + i] = '!' + v % 85;
+			v /= 85;
+		}
+		len += 5;
+	}
+
+	return len;
+}
+
+enum mode { ASCII85, GENERIC, INFLATE, ALL };
+
+static char *text;
+static unsigned long len;
+static uint32_t *compressed, *dwords, *object;
+static unsigned long compressed_size, count, size = 8 << 20;
+
+static void decode(enum mode mode)
+{
+	z_stream zstream;
+
+	switch (mode) {
+	case ASCII85:
+		if (igt_ascii85_decode(text, len, dwords) != count)
+			abort();
+		break;
+
+	case GENERIC:
+		if (igt_ascii85_decode_generic(text, len, dwords) != count)
+			abort();
+		break;
+
+	case INFLATE:
+	case ALL:
+		if (mode == ALL &&
+		    igt_ascii85_decode(text, len, dwords) != count)
+			abort();
+
+		memset(&zstream, 0, sizeof(zstream));
+		zstream.next_in = (Bytef *)(mode == ALL ? dwords : compressed);
+		zstream.avail_in = compressed_size;
+		zstream.next_out = (Bytef *)object;
+		zstream.avail_out = size;
+		if (inflateInit(&zstream) != Z_OK ||
+		    inflate(&zstream, Z_FINISH) != Z_STREAM_END)
+			abort();
+		inflateEnd(&zstream);
+		break;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	enum mode mode = ALL;
+	struct timespec start, end;
+	int zero = 75;
+	int reps = 1;
+	unsigned long i;
+	int loops;
+	int c;
+
+	while ((c = getopt (argc, argv, "m:s:z:r:")) != -1) {
+		switch (c) {
+		case 'm':
+			if (strcmp(optarg, "ascii85") == 0)
+				mode = ASCII85;
+			else if (strcmp(optarg, "generic") == 0)
+				mode = GENERIC;
+			else if (strcmp(optarg, "inflate") == 0)
+				mode = INFLATE;
+			else if (strcmp(optarg, "all") == 0)
+				mode = ALL;
+			else
+				abort();
+			break;
+
+		case 's':
+			size = strtoul(optarg, NULL, 0) & ~3ul;
+			if (size == 0)
+				size = 4;
+			break;
+
+		case 'z':
+			zero = atoi(optarg);
+			break;
+
+		case 'r':
+			reps = atoi(optarg);
+			if (reps < 1)
+				reps = 1;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	/* Mostly empty, the rest command-like and random dwords */
+	object = malloc(size);
+	srandom(0xdeadbeef);
+	for (i = 0; i < size / 4; i++) {
+		if (random() % 100 < zero)
+			object[i] = 0;
+		else if (random() & 1)
+			object[i] = 0x7a000000 | (random() & 0xff);
+		else
+			object[i] = random();
+	}
+
+	compressed_size = compressBound(size);
+	compressed = malloc(compressed_size + 3);
+	if (compress2((Bytef *)compressed, &compressed_size,
+		      (Bytef *)object, size, Z_DEFAULT_COMPRESSION) != Z_OK)
+		abort();
+	memset((char *)compressed + compressed_size, 0, 3);
+	count = (compressed_size + 3) / 4;
+
+	text = malloc(5 * count + 1);
+	len = ascii85_encode(compressed, count, text);
+	text[len] = '\n';
+
+	dwords = malloc(igt_ascii85_max_dwords(len) * sizeof(uint32_t));
+
+	fprintf(stderr, "%lu byte object, %lu bytes compressed, %lu encoded\n",
+		size, compressed_size, len);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	decode(mode);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	loops = 1 / elapsed(&start, &end);
+	if (loops < 1)
+		loops = 1;
+	while (reps--) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (c = 0; c < loops; c++)
+			decode(mode);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		printf("%7.3f\n",
+		       (mode == INFLATE ? compressed_size : len) *
+		       (double)loops / elapsed(&start, &end) / 1e9);
+	}
+
+	free(dwords);
+	free(text);
+	free(compressed);
+	free(object);
+
+	return 0;
+}
@@ -35,218 +35,1532 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #include <time.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include "drm.h"
 #include "ioctl_wrappers.h"
 #include "drmtest.h"
 #include "intel_io.h"
 #include "igt_stats.h"
+#include "gem_exec_trace.h"
 
-enum {
-	ADD_BO = 0,
-	DEL_BO,
-	EXEC,
+struct trace {
+	const char *filename;
+	int fd;
+	uint64_t size;
+	struct trace_header header;
+	struct trace_chunk *chunk;
+	uint32_t num_chunks;
+	uint32_t exec_size;
+	bool indexed;
 };
 
-struct trace_add_bo {
-	uint32_t handle;
-	uint64_t size;
-} __attribute__((packed));
+typedef void (*trace_record_fn)(void *data, const struct trace_record *r,
+				const void *payload);
+
+static double elapsed(const struct timespec *start, const struct timespec *end)
+{
+	return 1e3*(end->tv_sec - start->tv_sec) + 1e-6*(end->tv_nsec - start->tv_nsec);
+}
+
+static bool trace_load_index(struct trace *t)
+{
+	struct trace_index index;
+	uint64_t offset, size;
+	uint32_t i;
+
+	offset = t->header.index_offset;
+	if (offset < t->header.header_size ||
+	    offset + sizeof(index) > t->size)
+		return false;
+
+	if (pread(t->fd, &index, sizeof(index), offset) != sizeof(index) ||
+	    index.magic != TRACE_INDEX_MAGIC)
+		return false;
+
+	size = (uint64_t)index.num_chunks * sizeof(*t->chunk);
+	if (offset + sizeof(index) + size > t->size)
+		return false;
+
+	t->chunk = malloc(size);
+	if (t->chunk == NULL ||
+	    pread(t->fd, t->chunk, size, offset + sizeof(index)) != size)
+		goto err;
+
+	/* The chunks must tile the record stream exactly */
+	offset = t->header.header_size;
+	for (i = 0; i < index.num_chunks; i++) {
+		if (t->chunk[i].offset != offset)
+			goto err;
+		offset += t->chunk[i].length;
+	}
+	if (offset != t->header.index_offset)
+		goto err;
+
+	t->num_chunks = index.num_chunks;
+	t->indexed = true;
+	return true;
+
+err:
+	free(t->chunk);
+	t->chunk = NULL;
+	return false;
+}
+
+static int trace_open(struct trace *t, const char *filename)
+{
+	struct stat st;
+
+	memset(t, 0, sizeof(*t));
+	t->filename = filename;
+
+	t->fd = open(filename, O_RDONLY);
+	if (t->fd < 0)
+		return -errno;
+
+	if (fstat(t->fd, &st) < 0)
+		goto err;
+	t->size = st.st_size;
+
+	if (pread(t->fd, &t->header, sizeof(t->header), 0) != sizeof(t->header) ||
+	    t->header.magic != TRACE_MAGIC) {
+		fprintf(stderr, "%s: not a gem_exec_tracer trace\n", filename);
+		goto err;
+	}
 
-struct trace_del_bo {
+	if (t->header.version > TRACE_VERSION) {
+		fprintf(stderr, "%s: unsupported trace version %u (max %u)\n",
+			filename, t->header.version, TRACE_VERSION);
+		goto err;
+	}
+
+	if (t->header.header_size < sizeof(t->header) ||
+	    t->header.header_size > t->size) {
+		fprintf(stderr, "%s: corrupt trace header\n", filename);
+		goto err;
+	}
+
+	t->exec_size = trace_exec_size(t->header.version);
+
+	if (!trace_load_index(t)) {
+		if (t->header.index_offset)
+			fprintf(stderr, "%s: ignoring corrupt chunk index\n",
+				filename);
+
+		/* Unfinished trace, treat the whole file as one chunk */
+		t->chunk = calloc(1, sizeof(*t->chunk));
+		if (t->chunk == NULL)
+			goto err;
+
+		t->chunk->offset = t->header.header_size;
+		t->chunk->length = t->size - t->header.header_size;
+		t->num_chunks = 1;
+	}
+
+	return 0;
+
+err:
+	close(t->fd);
+	return -EINVAL;
+}
+
+static void trace_close(struct trace *t)
+{
+	free(t->chunk);
+	close(t->fd);
+}
+
+static bool exec_is_valid(const struct trace *trace,
+			  const void *payload, uint32_t length)
+{
+	const struct trace_exec *t = payload;
+	const uint8_t *ptr = (const uint8_t *)payload + trace->exec_size;
+	const uint8_t *end = (const uint8_t *)payload + length;
+	bool lut;
+	uint32_t i, j;
+
+	if (length < trace->exec_size)
+		return false;
+
+	lut = t->flags & I915_EXEC_HANDLE_LUT;
+	for (i = 0; i < t->object_count; i++) {
+		const struct trace_exec_object *to = (const void *)ptr;
+
+		if (end - ptr < sizeof(*to))
+			return false;
+		ptr = (const void *)(to + 1);
+
+		if ((end - ptr) / sizeof(struct trace_exec_relocation) < to->relocation_count)
+			return false;
+
+		/* With LUT, targets index the objects, which the replay trusts */
+		for (j = 0; lut && j < to->relocation_count; j++) {
+			const struct trace_exec_relocation *tr = (const void *)ptr;
+
+			if (tr[j].target_handle >= t->object_count)
+				return false;
+		}
+		ptr += to->relocation_count * sizeof(struct trace_exec_relocation);
+	}
+
+	return true;
+}
+
+static bool record_is_valid(const struct trace *t, unsigned cmd,
+			    const void *payload, uint32_t length)
+{
+	switch (cmd) {
+	case ADD_BO: return length >= sizeof(struct trace_add_bo);
+	case DEL_BO: return length >= sizeof(struct trace_del_bo);
+	case EXEC: return exec_is_valid(t, payload, length);
+	default: return true; /* unknown records are skipped */
+	}
+}
+
+/*
+ * Walk chunks [first, first + count) of the trace, mapping only one chunk
+ * at a time so that arbitrarily large traces can be streamed with bounded
+ * memory. Returns the number of records visited, or -1 if the trace is
+ * corrupt (records up to the corruption are still reported).
+ */
+static int64_t trace_for_each_record(struct trace *t,
+				     uint32_t first, uint32_t count,
+				     trace_record_fn fn, void *data)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	int64_t num_records = 0;
+	uint32_t n;
+
+	for (n = first; n < first + count && n < t->num_chunks; n++) {
+		const struct trace_chunk *c = &t->chunk[n];
+		uint64_t base = c->offset & -(uint64_t)page_size;
+		size_t size = c->offset + c->length - base;
+		const uint8_t *map, *ptr, *end;
+		uint32_t records = 0;
+
+		if (c->length == 0)
+			continue;
+
+		map = mmap(0, size, PROT_READ, MAP_SHARED, t->fd, base);
+		if (map == MAP_FAILED)
+			return -1;
+
+		madvise((void *)map, size, MADV_SEQUENTIAL);
+
+		ptr = map + (c->offset - base);
+		end = map + size;
+		while (end - ptr >= sizeof(struct trace_record)) {
+			const struct trace_record *r = (const void *)ptr;
+			ptr = (const void *)(r + 1);
+
+			if (end - ptr < r->length && !t->indexed) {
+				/* The tracer was interrupted mid-record */
+				ptr = end;
+				break;
+			}
+
+			if (end - ptr < r->length ||
+			    !record_is_valid(t, r->cmd, ptr, r->length)) {
+				fprintf(stderr,
+					"%s: corrupt record at offset %"PRIu64"\n",
+					t->filename,
+					base + ((const uint8_t *)r - map));
+				munmap((void *)map, size);
+				return -1;
+			}
+
+			fn(data, r, ptr);
+			ptr += r->length;
+			records++;
+		}
+
+		munmap((void *)map, size);
+
+		if (ptr != end && t->indexed) {
+			fprintf(stderr, "%s: chunk %u has trailing garbage\n",
+				t->filename, n);
+			return -1;
+		}
+		if (t->indexed && records != c->num_records) {
+			fprintf(stderr, "%s: chunk %u has %u records, index claims %u\n",
+				t->filename, n, records, c->num_records);
+			return -1;
+		}
+
+		num_records += records;
+	}
+
+	return num_records;
+}
+
+/*
+ * Handles are only unique per fd, so per-object state is kept in one
+ * sparse array per traced fd, indexed by handle and grown on demand.
+ */
+struct handle_table {
+	struct handle_array {
+		void *slot;
+		uint32_t count;
+	} *fd;
+	uint32_t num_fds;
+	size_t size;
+};
+
+static void handle_table_init(struct handle_table *t, size_t size)
+{
+	memset(t, 0, sizeof(*t));
+	t->size = size;
+}
+
+static void *handle_table_lookup(struct handle_table *t,
+				 uint16_t fd, uint32_t handle)
+{
+	struct handle_array *a;
+
+	if (fd >= t->num_fds) {
+		t->fd = realloc(t->fd, sizeof(*t->fd)*(fd + 1));
+		memset(t->fd + t->num_fds, 0,
+		       sizeof(*t->fd)*(fd + 1 - t->num_fds));
+		t->num_fds = fd + 1;
+	}
+
+	a = &t->fd[fd];
+	if (handle >= a->count) {
+		uint32_t count = (handle + 4096) & -4096;
+		a->slot = realloc(a->slot, t->size*count);
+		memset((char *)a->slot + t->size*a->count, 0,
+		       t->size*(count - a->count));
+		a->count = count;
+	}
+
+	return (char *)a->slot + t->size*handle;
+}
+
+/* As handle_table_lookup(), without growing the table: NULL if never seen */
+static void *handle_table_find(struct handle_table *t,
+			       uint16_t fd, uint32_t handle)
+{
+	if (fd >= t->num_fds || handle >= t->fd[fd].count)
+		return NULL;
+
+	return (char *)t->fd[fd].slot + t->size*handle;
+}
+
+/* The fd was closed, its handles may be reused by an unrelated fd */
+static void handle_table_drop_fd(struct handle_table *t, uint16_t fd)
+{
+	if (fd >= t->num_fds)
+		return;
+
+	free(t->fd[fd].slot);
+	t->fd[fd].slot = NULL;
+	t->fd[fd].count = 0;
+}
+
+static void handle_table_fini(struct handle_table *t)
+{
+	uint32_t i;
+
+	for (i = 0; i < t->num_fds; i++)
+		free(t->fd[i].slot);
+	free(t->fd);
+}
+
+struct replay;
+
+/*
+ * The replay loop issues its ioctls through a backend, so that it can
+ * either drive a real device or a mock which only emulates what the
+ * kernel would have to do. The latter is used to measure the CPU cost of
+ * the replay loop itself on machines without a GPU.
+ */
+struct replay_backend {
+	uint32_t (*create)(struct replay *r, int fd, uint64_t size);
+	void (*close)(struct replay *r, int fd, uint32_t handle);
+	void (*execbuf)(struct replay *r, int fd,
+			struct drm_i915_gem_execbuffer2 *eb);
+};
+
+struct replay {
+	int fd;
+	const struct replay_backend *backend;
+	bool skip_relocs;
+	uint32_t exec_size;
+
+	struct drm_i915_gem_execbuffer2 eb;
+	struct bo {
+		uint32_t handle;
+		uint64_t offset;
+		bool bound;
+
+		struct drm_i915_gem_relocation_entry *relocs;
+		uint32_t max_relocs;
+	} **offsets;
+	struct handle_table bo;
+	struct drm_i915_gem_exec_object2 *exec_objects;
+	int max_objects;
+
+	uint64_t num_execs;
+	uint64_t trace_relocs;
+	uint64_t submitted_relocs;
+
+	struct mock {
+		uint64_t *offset;
+		uint32_t num_handles;
+		uint32_t next_handle;
+		uint64_t next_offset;
+		uint64_t stale_relocs;
+	} mock;
+};
+
+static uint32_t gem_backend_create(struct replay *r, int fd, uint64_t size)
+{
+	uint32_t bb = 0xa << 23;
 	uint32_t handle;
-} __attribute__((packed));
 
-struct trace_exec {
-	uint32_t object_count;
-	uint64_t flags;
-} __attribute__((packed));
-struct trace_exec_object {
+	handle = gem_create(fd, size);
+	gem_write(fd, handle, 0, &bb, sizeof(bb));
+
+	return handle;
+}
+
+static void gem_backend_close(struct replay *r, int fd, uint32_t handle)
+{
+	gem_close(fd, handle);
+}
+
+static void gem_backend_execbuf(struct replay *r, int fd,
+				struct drm_i915_gem_execbuffer2 *eb)
+{
+	gem_execbuf(fd, eb);
+}
+
+static const struct replay_backend gem_backend = {
+	.create = gem_backend_create,
+	.close = gem_backend_close,
+	.execbuf = gem_backend_execbuf,
+};
+
+static uint32_t mock_backend_create(struct replay *r, int fd, uint64_t size)
+{
+	struct mock *m = &r->mock;
+	uint32_t handle = ++m->next_handle;
+
+	if (handle >= m->num_handles) {
+		uint32_t new_handles = (handle + 4096) & -4096;
+		m->offset = realloc(m->offset, sizeof(*m->offset)*new_handles);
+		m->num_handles = new_handles;
+	}
+
+	/* Objects never move once bound, as with an idle, roomy GTT */
+	m->offset[handle] = m->next_offset;
+	m->next_offset += ALIGN(size, 4096);
+
+	return handle;
+}
+
+static void mock_backend_close(struct replay *r, int fd, uint32_t handle)
+{
+}
+
+static void mock_backend_execbuf(struct replay *r, int fd,
+				 struct drm_i915_gem_execbuffer2 *eb)
+{
+	struct drm_i915_gem_exec_object2 *obj =
+		(struct drm_i915_gem_exec_object2 *)(uintptr_t)eb->buffers_ptr;
+	struct mock *m = &r->mock;
+	uint64_t stale = 0;
+	uint32_t i, j;
+
+	/* Do the lookups the kernel would to validate each relocation */
+	for (i = 0; i < eb->buffer_count; i++) {
+		const struct drm_i915_gem_relocation_entry *reloc =
+			(const void *)(uintptr_t)obj[i].relocs_ptr;
+
+		for (j = 0; j < obj[i].relocation_count; j++) {
+			uint32_t target = reloc[j].target_handle;
+
+			if (eb->flags & I915_EXEC_HANDLE_LUT)
+				target = obj[target].handle;
+
+			if (reloc[j].presumed_offset != m->offset[target])
+				stale++;
+		}
+	}
+	__atomic_add_fetch(&m->stale_relocs, stale, __ATOMIC_RELAXED);
+
+	for (i = 0; i < eb->buffer_count; i++)
+		obj[i].offset = m->offset[obj[i].handle];
+}
+
+static const struct replay_backend mock_backend = {
+	.create = mock_backend_create,
+	.close = mock_backend_close,
+	.execbuf = mock_backend_execbuf,
+};
+
+static void replay_add_bo(struct replay *r, uint16_t fd,
+			  const struct trace_add_bo *t)
+{
+	struct bo *bo = handle_table_lookup(&r->bo, fd, t->handle);
+
+	bo->handle = r->backend->create(r, r->fd, t->size);
+	bo->offset = 0;
+	bo->bound = false;
+}
+
+static void replay_del_bo(struct replay *r, uint16_t fd,
+			  const struct trace_del_bo *t)
+{
+	struct bo *bo = handle_table_lookup(&r->bo, fd, t->handle);
+
+	r->backend->close(r, r->fd, bo->handle);
+	bo->handle = 0;
+
+	free(bo->relocs);
+	bo->relocs = NULL;
+	bo->max_relocs = 0;
+}
+
+static void replay_close_fd(struct replay *r, uint16_t fd)
+{
+	struct bo *bo;
+	uint32_t i;
+
+	if (fd >= r->bo.num_fds)
+		return;
+
+	bo = r->bo.fd[fd].slot;
+	for (i = 0; i < r->bo.fd[fd].count; i++) {
+		if (bo[i].handle)
+			r->backend->close(r, r->fd, bo[i].handle);
+		free(bo[i].relocs);
+	}
+	handle_table_drop_fd(&r->bo, fd);
+}
+
+/*
+ * With skip_relocs, only relocations to targets whose placement we do not
+ * know yet are passed on: for every other one the presumed offset is
+ * correct and the kernel would only look it up to discover it has nothing
+ * to do. The batches are dummies, so nothing depends on the relocated
+ * values. The remaining presumed offsets are then trusted with NO_RELOC.
+ */
+static void replay_exec(struct replay *r, uint16_t fd,
+			const struct trace_exec *t)
+{
+	struct drm_i915_gem_execbuffer2 *eb = &r->eb;
+	struct drm_i915_gem_exec_object2 *exec_objects;
+	const uint8_t *ptr;
+	bool lut;
+	uint32_t i, j;
+
+	eb->buffer_count = t->object_count;
+	eb->flags = t->flags & ~I915_EXEC_RING_MASK;
+	if (r->skip_relocs)
+		eb->flags |= I915_EXEC_NO_RELOC;
+	lut = eb->flags & I915_EXEC_HANDLE_LUT;
+
+	if (eb->buffer_count > r->max_objects) {
+		free(r->exec_objects);
+		free(r->offsets);
+
+		r->max_objects = ALIGN(eb->buffer_count, 4096);
+
+		r->exec_objects = malloc(r->max_objects*sizeof(*r->exec_objects));
+		r->offsets = malloc(r->max_objects*sizeof(*r->offsets));
+
+		eb->buffers_ptr = (uintptr_t)r->exec_objects;
+	}
+	exec_objects = r->exec_objects;
+
+	/*
+	 * Resolve all objects first, LUT relocations may point forwards.
+	 * The kernel refused an execbuf naming an object which doesn't
+	 * exist, so skip it as well.
+	 */
+	ptr = (const uint8_t *)t + r->exec_size;
+	for (i = 0; i < eb->buffer_count; i++) {
+		const struct trace_exec_object *to = (const void *)ptr;
+
+		r->offsets[i] = handle_table_find(&r->bo, fd, to->handle);
+		if (r->offsets[i] == NULL || r->offsets[i]->handle == 0)
+			return;
+
+		ptr = (const void *)(to + 1);
+		ptr += to->relocation_count * sizeof(struct trace_exec_relocation);
+	}
+
+	ptr = (const uint8_t *)t + r->exec_size;
+	for (i = 0; i < eb->buffer_count; i++) {
+		struct drm_i915_gem_relocation_entry *relocs;
+		const struct trace_exec_object *to = (const void *)ptr;
+		struct bo *bo = r->offsets[i];
+		uint32_t count = 0;
+		ptr = (const void *)(to + 1);
+
+		exec_objects[i].handle = bo->handle;
+		exec_objects[i].offset = bo->offset;
+		exec_objects[i].alignment = to->alignment;
+		exec_objects[i].flags = to->flags;
+		exec_objects[i].rsvd1 = to->rsvd1;
+		exec_objects[i].rsvd2 = to->rsvd2;
+
+		exec_objects[i].relocation_count = 0;
+		if (!to->relocation_count)
+			continue;
+
+		r->trace_relocs += to->relocation_count;
+
+		if (to->relocation_count > bo->max_relocs) {
+			free(bo->relocs);
+
+			bo->max_relocs = ALIGN(to->relocation_count, 128);
+			bo->relocs = malloc(sizeof(*bo->relocs)*bo->max_relocs);
+		}
+		relocs = bo->relocs;
+		exec_objects[i].relocs_ptr = (uintptr_t)relocs;
+
+		for (j = 0; j < to->relocation_count; j++) {
+			const struct trace_exec_relocation *tr = (const void *)ptr;
+			const struct bo *target;
+			ptr = (const void *)(tr + 1);
+
+			/*
+			 * The kernel would refuse any target that isn't
+			 * among the objects resolved above.
+			 */
+			if (lut)
+				target = r->offsets[tr->target_handle];
+			else
+				target = handle_table_find(&r->bo, fd,
+							   tr->target_handle);
+			if (target == NULL)
+				continue;
+
+			if (r->skip_relocs && target->bound)
+				continue;
+
+			relocs[count].target_handle =
+				lut ? tr->target_handle : target->handle;
+			relocs[count].presumed_offset = target->offset;
+			relocs[count].delta = tr->delta;
+			relocs[count].offset = tr->offset;
+			relocs[count].read_domains = tr->read_domains;
+			relocs[count].write_domain = tr->write_domain;
+			count++;
+		}
+
+		exec_objects[i].relocation_count = count;
+		r->submitted_relocs += count;
+	}
+
+	r->backend->execbuf(r, r->fd, eb);
+	r->num_execs++;
+
+	for (i = 0; i < eb->buffer_count; i++) {
+		r->offsets[i]->offset = exec_objects[i].offset;
+		r->offsets[i]->bound = true;
+	}
+}
+
+static void replay_record(void *data, const struct trace_record *tr,
+			  const void *payload)
+{
+	struct replay *r = data;
+
+	switch (tr->cmd) {
+	case ADD_BO:
+		replay_add_bo(r, tr->fd, payload);
+		break;
+	case DEL_BO:
+		replay_del_bo(r, tr->fd, payload);
+		break;
+	case EXEC:
+		replay_exec(r, tr->fd, payload);
+		break;
+	case CLOSE_FD:
+		replay_close_fd(r, tr->fd);
+		break;
+	}
+}
+
+static void replay(const char *filename, bool mock, bool skip_relocs)
+{
+	struct timespec t_start, t_end;
+	struct replay r = {};
+	struct trace t;
+	uint32_t i, j;
+
+	if (trace_open(&t, filename))
+		return;
+
+	handle_table_init(&r.bo, sizeof(struct bo));
+	r.skip_relocs = skip_relocs;
+	r.exec_size = t.exec_size;
+	if (mock) {
+		r.backend = &mock_backend;
+		r.fd = -1;
+	} else {
+		r.backend = &gem_backend;
+		r.fd = drm_open_driver(DRIVER_INTEL);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	trace_for_each_record(&t, 0, t.num_chunks, replay_record, &r);
+	clock_gettime(CLOCK_MONOTONIC, &t_end);
+	if (r.fd != -1)
+		close(r.fd);
+	trace_close(&t);
+
+	for (i = 0; i < r.bo.num_fds; i++) {
+		struct bo *bo = r.bo.fd[i].slot;
+
+		for (j = 0; j < r.bo.fd[i].count; j++)
+			free(bo[j].relocs);
+	}
+	handle_table_fini(&r.bo);
+	free(r.offsets);
+	free(r.exec_objects);
+	free(r.mock.offset);
+
+	printf("%s: %.3f\n", filename, elapsed(&t_start, &t_end));
+	if (mock || skip_relocs)
+		printf("  %"PRIu64" execs, %.3fus/exec, %"PRIu64"/%"PRIu64" relocations submitted",
+		       r.num_execs,
+		       r.num_execs ? 1e3 * elapsed(&t_start, &t_end) / r.num_execs : 0.,
+		       r.submitted_relocs, r.trace_relocs);
+	if (mock)
+		printf(", %"PRIu64" stale", r.mock.stale_relocs);
+	if (mock || skip_relocs)
+		printf("\n");
+}
+
+/*
+ * Threaded replay: every (fd, context) pair of the trace becomes a
+ * timeline replayed by its own thread on its own context. The trace is
+ * first compiled into per-timeline command lists, resolving handles to
+ * objects that live for the whole replay. An execbuffer only waits for
+ * execbuffers of other timelines when it reads or writes an object that
+ * they wrote last (read-after-write and write-after-write); everything
+ * else is free to be submitted concurrently.
+ */
+struct mt_bo {
+	uint16_t fd;
 	uint32_t handle;
-	uint32_t relocation_count;
+	uint64_t size;
+	uint64_t offset;
+	uint32_t writer, writer_seq;
+};
+
+struct mt_object {
+	uint32_t bo;
+	uint32_t num_relocs;
 	uint64_t alignment;
 	uint64_t flags;
-	uint64_t rsvd1;
-	uint64_t rsvd2;
-} __attribute__((packed));
-struct trace_exec_relocation {
-	uint32_t target_handle;
+};
+
+struct mt_reloc {
+	uint32_t target;
 	uint32_t delta;
 	uint64_t offset;
 	uint32_t read_domains;
 	uint32_t write_domain;
-} __attribute__((packed));
+};
 
-static double elapsed(const struct timespec *start, const struct timespec *end)
+struct mt_dep {
+	uint32_t timeline;
+	uint32_t seq;
+};
+
+struct mt_exec {
+	uint64_t flags;
+	uint32_t num_objects, num_deps;
+	uint64_t first_object, first_reloc, first_dep;
+};
+
+struct mt_timeline {
+	uint16_t fd;
+	uint32_t context;
+	uint32_t hw_context;
+
+	struct mt_exec *exec;
+	uint64_t num_execs, max_execs;
+	struct mt_object *object;
+	uint64_t num_objects, max_objects;
+	struct mt_reloc *reloc;
+	uint64_t num_relocs, max_relocs;
+	struct mt_dep *dep;
+	uint64_t num_deps, max_deps;
+
+	struct mt_replay *mt;
+	pthread_t thread;
+	uint32_t progress;
+	uint64_t stalls;
+	uint64_t ring_execs[I915_EXEC_RING_MASK + 1];
+	double elapsed;
+};
+
+struct mt_replay {
+	uint32_t exec_size;
+	struct replay r;
+
+	struct handle_table handles; /* (fd, handle) -> bo index + 1 */
+	struct handle_table contexts; /* (fd, context) -> timeline + 1 */
+
+	struct mt_bo *bo;
+	uint32_t num_bo, max_bo;
+	struct mt_timeline *timeline;
+	uint32_t num_timelines;
+	uint32_t *dep_seq; /* per-timeline scratch while compiling */
+
+	int *fd;
+	uint32_t num_fds;
+	bool has_ring[I915_EXEC_RING_MASK + 1];
+	struct timespec start;
+	bool go;
+};
+
+#define mt_append(tl, field) ({ \
+	if ((tl)->num_##field##s == (tl)->max_##field##s) { \
+		(tl)->max_##field##s = (tl)->max_##field##s ? 2*(tl)->max_##field##s : 64; \
+		(tl)->field = realloc((tl)->field, sizeof(*(tl)->field)*(tl)->max_##field##s); \
+		igt_assert((tl)->field); \
+	} \
+	&(tl)->field[(tl)->num_##field##s++]; \
+})
+
+static uint32_t mt_new_bo(struct mt_replay *mt, uint16_t fd, uint64_t size)
 {
-	return 1e3*(end->tv_sec - start->tv_sec) + 1e-6*(end->tv_nsec - start->tv_nsec);
+	struct mt_bo *bo;
+
+	if (mt->num_bo == mt->max_bo) {
+		mt->max_bo = mt->max_bo ? 2*mt->max_bo : 4096;
+		mt->bo = realloc(mt->bo, sizeof(*mt->bo)*mt->max_bo);
+		igt_assert(mt->bo);
+	}
+
+	bo = &mt->bo[mt->num_bo];
+	memset(bo, 0, sizeof(*bo));
+	bo->fd = fd;
+	bo->size = size;
+
+	return ++mt->num_bo;
 }
 
-static void replay(const char *filename)
+static uint32_t mt_lookup_bo(struct mt_replay *mt, uint16_t fd, uint32_t handle)
 {
-	struct timespec t_start, t_end;
+	uint32_t *id = handle_table_lookup(&mt->handles, fd, handle);
+
+	/* Objects created before tracing started */
+	if (*id == 0)
+		*id = mt_new_bo(mt, fd, 4096);
+
+	return *id - 1;
+}
+
+static uint32_t mt_lookup_timeline(struct mt_replay *mt,
+				   uint16_t fd, uint32_t context)
+{
+	uint32_t *id = handle_table_lookup(&mt->contexts, fd, context);
+
+	if (*id == 0) {
+		struct mt_timeline *tl;
+
+		mt->timeline = realloc(mt->timeline,
+				       sizeof(*mt->timeline)*(mt->num_timelines + 1));
+		mt->dep_seq = realloc(mt->dep_seq,
+				      sizeof(*mt->dep_seq)*(mt->num_timelines + 1));
+		igt_assert(mt->timeline && mt->dep_seq);
+
+		tl = &mt->timeline[mt->num_timelines];
+		memset(tl, 0, sizeof(*tl));
+		tl->fd = fd;
+		tl->context = context;
+		mt->dep_seq[mt->num_timelines] = 0;
+
+		*id = ++mt->num_timelines;
+	}
+
+	return *id - 1;
+}
+
+static void mt_depend(struct mt_replay *mt, uint32_t self, struct mt_bo *bo)
+{
+	if (bo->writer_seq && bo->writer != self &&
+	    bo->writer_seq > mt->dep_seq[bo->writer])
+		mt->dep_seq[bo->writer] = bo->writer_seq;
+}
+
+static void mt_compile_exec(struct mt_replay *mt, uint16_t fd,
+			    const struct trace_exec *t)
+{
+	uint32_t context =
+		mt->exec_size > offsetof(struct trace_exec, context) ? t->context : 0;
+	uint32_t self = mt_lookup_timeline(mt, fd, context);
+	struct mt_timeline *tl = &mt->timeline[self];
+	bool lut = t->flags & I915_EXEC_HANDLE_LUT;
+	const uint8_t *ptr;
+	struct mt_exec *exec;
+	uint32_t *ids, seq, i, j;
+
+	exec = mt_append(tl, exec);
+	seq = tl->num_execs;
+	exec->flags = t->flags;
+	exec->num_objects = t->object_count;
+	exec->first_object = tl->num_objects;
+	exec->first_reloc = tl->num_relocs;
+	exec->first_dep = tl->num_deps;
+	exec->num_deps = 0;
+
+	ids = malloc(sizeof(*ids)*(t->object_count + 1));
+	igt_assert(ids);
+
+	ptr = (const uint8_t *)t + mt->exec_size;
+	for (i = 0; i < t->object_count; i++) {
+		const struct trace_exec_object *to = (const void *)ptr;
+
+		ids[i] = mt_lookup_bo(mt, fd, to->handle);
+		mt_depend(mt, self, &mt->bo[ids[i]]);
+
+		ptr = (const void *)(to + 1);
+		ptr += to->relocation_count * sizeof(struct trace_exec_relocation);
+	}
+
+	ptr = (const uint8_t *)t + mt->exec_size;
+	for (i = 0; i < t->object_count; i++) {
+		const struct trace_exec_object *to = (const void *)ptr;
+		struct mt_object *obj = mt_append(tl, object);
+		ptr = (const void *)(to + 1);
+
+		obj->bo = ids[i];
+		obj->num_relocs = to->relocation_count;
+		obj->alignment = to->alignment;
+		obj->flags = to->flags;
+
+		if (to->flags & EXEC_OBJECT_WRITE) {
+			mt->bo[ids[i]].writer = self;
+			mt->bo[ids[i]].writer_seq = seq;
+		}
+
+		for (j = 0; j < to->relocation_count; j++) {
+			const struct trace_exec_relocation *tr = (const void *)ptr;
+			struct mt_reloc *reloc = mt_append(tl, reloc);
+			uint32_t target;
+			ptr = (const void *)(tr + 1);
+
+			if (lut)
+				target = ids[tr->target_handle];
+			else
+				target = mt_lookup_bo(mt, fd, tr->target_handle);
+
+			reloc->target = lut ? tr->target_handle : target;
+			reloc->delta = tr->delta;
+			reloc->offset = tr->offset;
+			reloc->read_domains = tr->read_domains;
+			reloc->write_domain = tr->write_domain;
+
+			if (tr->write_domain) {
+				mt->bo[target].writer = self;
+				mt->bo[target].writer_seq = seq;
+			}
+		}
+	}
+
+	for (i = 0; i < mt->num_timelines; i++) {
+		if (mt->dep_seq[i]) {
+			struct mt_dep *dep = mt_append(tl, dep);
+
+			dep->timeline = i;
+			dep->seq = mt->dep_seq[i];
+			exec->num_deps++;
+			mt->dep_seq[i] = 0;
+		}
+	}
+
+	free(ids);
+}
+
+static void mt_compile_record(void *data, const struct trace_record *r,
+			      const void *payload)
+{
+	struct mt_replay *mt = data;
+
+	switch (r->cmd) {
+	case ADD_BO: {
+		const struct trace_add_bo *t = payload;
+		uint32_t *id = handle_table_lookup(&mt->handles, r->fd, t->handle);
+
+		*id = mt_new_bo(mt, r->fd, t->size);
+		break;
+	}
+	case DEL_BO: {
+		const struct trace_del_bo *t = payload;
+		uint32_t *id = handle_table_lookup(&mt->handles, r->fd, t->handle);
+
+		/* The object lives on until the end of the replay */
+		*id = 0;
+		break;
+	}
+	case EXEC:
+		mt_compile_exec(mt, r->fd, payload);
+		break;
+	case CLOSE_FD:
+		/* Objects live on, later contexts get timelines of their own */
+		handle_table_drop_fd(&mt->handles, r->fd);
+		handle_table_drop_fd(&mt->contexts, r->fd);
+		break;
+	}
+}
+
+static void *mt_timeline_thread(void *arg)
+{
+	struct mt_timeline *tl = arg;
+	struct mt_replay *mt = tl->mt;
 	struct drm_i915_gem_execbuffer2 eb = {};
-	struct bo {
-		uint32_t handle;
-		uint64_t offset;
+	struct drm_i915_gem_exec_object2 *objects = NULL;
+	struct drm_i915_gem_relocation_entry *relocs = NULL;
+	uint64_t max_objects = 0, max_relocs = 0;
+	int fd = mt->fd[tl->fd];
+	struct timespec end;
+	uint64_t n;
 
-		struct drm_i915_gem_relocation_entry *relocs;
-		uint32_t max_relocs;
-	} *bo = NULL, **offsets = NULL;
-	int num_bo = 0;
-	struct drm_i915_gem_exec_object2 *exec_objects = NULL;
-	int max_objects = 0;
-	struct stat st;
-	uint8_t *ptr, *end;
-	int fd;
+	while (!__atomic_load_n(&mt->go, __ATOMIC_ACQUIRE))
+		sched_yield();
+
+	for (n = 0; n < tl->num_execs; n++) {
+		const struct mt_exec *exec = &tl->exec[n];
+		const struct mt_object *obj = &tl->object[exec->first_object];
+		const struct mt_reloc *reloc = &tl->reloc[exec->first_reloc];
+		const struct mt_dep *dep = &tl->dep[exec->first_dep];
+		uint64_t num_relocs = 0;
+		unsigned ring;
+		uint32_t i, j;
+
+		for (i = 0; i < exec->num_deps; i++) {
+			const struct mt_timeline *other = &mt->timeline[dep[i].timeline];
+
+			if (__atomic_load_n(&other->progress, __ATOMIC_ACQUIRE) >= dep[i].seq)
+				continue;
+
+			tl->stalls++;
+			while (__atomic_load_n(&other->progress, __ATOMIC_ACQUIRE) < dep[i].seq)
+				sched_yield();
+		}
+
+		for (i = 0; i < exec->num_objects; i++)
+			num_relocs += obj[i].num_relocs;
+
+		if (exec->num_objects > max_objects) {
+			free(objects);
+			max_objects = ALIGN(exec->num_objects, 4096);
+			objects = malloc(sizeof(*objects)*max_objects);
+		}
+		if (num_relocs > max_relocs) {
+			free(relocs);
+			max_relocs = ALIGN(num_relocs, 4096);
+			relocs = malloc(sizeof(*relocs)*max_relocs);
+		}
+
+		num_relocs = 0;
+		for (i = 0; i < exec->num_objects; i++) {
+			struct mt_bo *bo = &mt->bo[obj[i].bo];
 
-	fd = open(filename, O_RDONLY);
-	if (fd < 0)
+			memset(&objects[i], 0, sizeof(objects[i]));
+			objects[i].handle = bo->handle;
+			objects[i].offset = __atomic_load_n(&bo->offset, __ATOMIC_RELAXED);
+			objects[i].alignment = obj[i].alignment;
+			objects[i].flags = obj[i].flags;
+			objects[i].relocation_count = obj[i].num_relocs;
+			objects[i].relocs_ptr = (uintptr_t)&relocs[num_relocs];
+
+			for (j = 0; j < obj[i].num_relocs; j++) {
+				struct drm_i915_gem_relocation_entry *r = &relocs[num_relocs++];
+				const struct mt_bo *target;
+
+				if (exec->flags & I915_EXEC_HANDLE_LUT) {
+					target = &mt->bo[obj[reloc->target].bo];
+					r->target_handle = reloc->target;
+				} else {
+					target = &mt->bo[reloc->target];
+					r->target_handle = target->handle;
+				}
+				r->presumed_offset = __atomic_load_n(&target->offset, __ATOMIC_RELAXED);
+				r->delta = reloc->delta;
+				r->offset = reloc->offset;
+				r->read_domains = reloc->read_domains;
+				r->write_domain = reloc->write_domain;
+				reloc++;
+			}
+		}
+
+		ring = exec->flags & I915_EXEC_RING_MASK;
+		if (!mt->has_ring[ring])
+			ring = I915_EXEC_DEFAULT;
+
+		eb.buffers_ptr = (uintptr_t)objects;
+		eb.buffer_count = exec->num_objects;
+		eb.flags = (exec->flags & ~I915_EXEC_RING_MASK) | ring;
+		eb.rsvd1 = 0;
+		i915_execbuffer2_set_context_id(eb, tl->hw_context);
+
+		mt->r.backend->execbuf(&mt->r, fd, &eb);
+		tl->ring_execs[ring]++;
+
+		for (i = 0; i < exec->num_objects; i++)
+			__atomic_store_n(&mt->bo[obj[i].bo].offset, objects[i].offset,
+					 __ATOMIC_RELAXED);
+
+		__atomic_store_n(&tl->progress, n + 1, __ATOMIC_RELEASE);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	tl->elapsed = elapsed(&mt->start, &end);
+
+	free(objects);
+	free(relocs);
+	return NULL;
+}
+
+static void mt_fini(struct mt_replay *mt)
+{
+	uint32_t i;
+
+	for (i = 0; i < mt->num_timelines; i++) {
+		free(mt->timeline[i].exec);
+		free(mt->timeline[i].object);
+		free(mt->timeline[i].reloc);
+		free(mt->timeline[i].dep);
+	}
+	free(mt->timeline);
+	free(mt->dep_seq);
+	free(mt->bo);
+	free(mt->fd);
+	free(mt->r.mock.offset);
+	handle_table_fini(&mt->handles);
+	handle_table_fini(&mt->contexts);
+}
+
+static void replay_threaded(const char *filename, bool mock)
+{
+	static const char *ring_name[] = {
+		"default", "render", "bsd", "blt", "vebox", "?", "?", "?"
+	};
+	struct mt_replay mt = {};
+	struct timespec end;
+	struct trace t;
+	uint32_t i;
+
+	if (trace_open(&t, filename))
+		return;
+
+	mt.exec_size = t.exec_size;
+	handle_table_init(&mt.handles, sizeof(uint32_t));
+	handle_table_init(&mt.contexts, sizeof(uint32_t));
+
+	if (trace_for_each_record(&t, 0, t.num_chunks,
+				  mt_compile_record, &mt) < 0) {
+		trace_close(&t);
+		mt_fini(&mt);
+		return;
+	}
+	trace_close(&t);
+
+	/* One device fd per traced fd, as handles and contexts are per fd */
+	mt.num_fds = mt.handles.num_fds > mt.contexts.num_fds ?
+		mt.handles.num_fds : mt.contexts.num_fds;
+	mt.fd = malloc(sizeof(*mt.fd)*(mt.num_fds + 1));
+	for (i = 0; i < mt.num_fds; i++)
+		mt.fd[i] = -1;
+	if (!mock) {
+		for (i = 0; i < mt.num_bo; i++)
+			if (mt.fd[mt.bo[i].fd] == -1)
+				mt.fd[mt.bo[i].fd] = drm_open_driver(DRIVER_INTEL);
+		for (i = 0; i < mt.num_timelines; i++)
+			if (mt.fd[mt.timeline[i].fd] == -1)
+				mt.fd[mt.timeline[i].fd] = drm_open_driver(DRIVER_INTEL);
+	}
+
+	mt.r.backend = mock ? &mock_backend : &gem_backend;
+	/* Keep each execbuffer on its ring, unless this device lacks it */
+	if (mock) {
+		memset(mt.has_ring, 1, sizeof(mt.has_ring));
+	} else {
+		int fd = drm_open_driver(DRIVER_INTEL);
+
+		mt.has_ring[I915_EXEC_DEFAULT] = true;
+		mt.has_ring[I915_EXEC_RENDER] = true;
+		mt.has_ring[I915_EXEC_BSD] = gem_has_bsd(fd);
+		mt.has_ring[I915_EXEC_BLT] = gem_has_blt(fd);
+		mt.has_ring[I915_EXEC_VEBOX] = gem_has_vebox(fd);
+		close(fd);
+	}
+
+	for (i = 0; i < mt.num_bo; i++)
+		mt.bo[i].handle = mt.r.backend->create(&mt.r, mt.fd[mt.bo[i].fd],
+						       mt.bo[i].size);
+
+	for (i = 0; i < mt.num_timelines; i++) {
+		struct mt_timeline *tl = &mt.timeline[i];
+
+		if (tl->context && !mock)
+			tl->hw_context = gem_context_create(mt.fd[tl->fd]);
+	}
+
+	for (i = 0; i < mt.num_timelines; i++) {
+		mt.timeline[i].mt = &mt;
+		pthread_create(&mt.timeline[i].thread, NULL,
+			       mt_timeline_thread, &mt.timeline[i]);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &mt.start);
+	__atomic_store_n(&mt.go, true, __ATOMIC_RELEASE);
+	for (i = 0; i < mt.num_timelines; i++)
+		pthread_join(mt.timeline[i].thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("%s: %.3f\n", filename, elapsed(&mt.start, &end));
+	for (i = 0; i < mt.num_timelines; i++) {
+		const struct mt_timeline *tl = &mt.timeline[i];
+		unsigned ring;
+
+		printf("  fd %u, context %u: %"PRIu64" execs in %.3fms, %"PRIu64" stalls;",
+		       tl->fd, tl->context, tl->num_execs, tl->elapsed, tl->stalls);
+		for (ring = 0; ring <= I915_EXEC_RING_MASK; ring++)
+			if (tl->ring_execs[ring])
+				printf(" %s %"PRIu64, ring_name[ring], tl->ring_execs[ring]);
+		printf("\n");
+	}
+
+	for (i = 0; i < mt.num_bo; i++)
+		mt.r.backend->close(&mt.r, mt.fd[mt.bo[i].fd], mt.bo[i].handle);
+	for (i = 0; i < mt.num_fds; i++)
+		if (mt.fd[i] != -1)
+			close(mt.fd[i]);
+
+	mt_fini(&mt);
+}
+
+struct validate {
+	uint64_t counts[CLOSE_FD + 1];
+	uint64_t unknown;
+};
+
+static void validate_record(void *data, const struct trace_record *r,
+			    const void *payload)
+{
+	struct validate *v = data;
+
+	if (r->cmd <= CLOSE_FD)
+		v->counts[r->cmd]++;
+	else
+		v->unknown++;
+}
+
+static int validate(const char *filename)
+{
+	struct validate v = {};
+	struct trace t;
+	int64_t records;
+
+	if (trace_open(&t, filename))
+		return 1;
+
+	records = trace_for_each_record(&t, 0, t.num_chunks, validate_record, &v);
+
+	printf("%s: version %u, devid 0x%04x (gen%u), page size %u, %s%u chunks\n",
+	       filename, t.header.version, t.header.devid, t.header.gen,
+	       t.header.page_size, t.indexed ? "" : "unindexed, ",
+	       t.num_chunks);
+	printf("  %"PRIu64" records: %"PRIu64" add, %"PRIu64" del, %"PRIu64" exec, %"PRIu64" close, %"PRIu64" unknown\n",
+	       records < 0 ? 0 : records,
+	       v.counts[ADD_BO], v.counts[DEL_BO], v.counts[EXEC],
+	       v.counts[CLOSE_FD], v.unknown);
+
+	trace_close(&t);
+	return records < 0;
+}
+
+/*
+ * Offline analysis: walk the trace against a software model of the
+ * objects rather than a device, and characterise the submission pattern.
+ * Time is measured in execbuffers, and the reuse distance of an object is
+ * the number of execbuffers since it was last referenced.
+ */
+struct analyze_bo {
+	uint64_t size;
+	uint64_t created;
+	uint64_t last_used;
+	uint64_t uses;
+	bool live;
+};
+
+struct analyze {
+	uint32_t exec_size;
+	struct handle_table bo;
+
+	uint64_t num_execs;
+	uint64_t live_bytes, live_objects;
+	uint64_t max_live_bytes, max_live_objects;
+
+	igt_stats_t objects;
+	igt_stats_t relocs;
+	igt_stats_t exec_bytes;
+	igt_stats_t live;
+	igt_stats_t lifetime;
+	igt_stats_t uses;
+	igt_stats_t reuse;
+};
+
+static void analyze_retire(struct analyze *a, struct analyze_bo *bo)
+{
+	if (!bo->live)
 		return;
 
-	if (fstat(fd, &st) < 0)
+	igt_stats_push(&a->lifetime, a->num_execs - bo->created);
+	igt_stats_push(&a->uses, bo->uses);
+
+	a->live_bytes -= bo->size;
+	a->live_objects--;
+	bo->live = false;
+}
+
+static void analyze_record(void *data, const struct trace_record *r,
+			   const void *payload)
+{
+	struct analyze *a = data;
+
+	switch (r->cmd) {
+	case ADD_BO: {
+		const struct trace_add_bo *t = payload;
+		struct analyze_bo *bo = handle_table_lookup(&a->bo, r->fd, t->handle);
+
+		analyze_retire(a, bo);
+
+		bo->size = t->size;
+		bo->created = a->num_execs;
+		bo->last_used = a->num_execs;
+		bo->uses = 0;
+		bo->live = true;
+
+		a->live_bytes += bo->size;
+		a->live_objects++;
+		if (a->live_bytes > a->max_live_bytes)
+			a->max_live_bytes = a->live_bytes;
+		if (a->live_objects > a->max_live_objects)
+			a->max_live_objects = a->live_objects;
+		break;
+	}
+	case DEL_BO: {
+		const struct trace_del_bo *t = payload;
+
+		analyze_retire(a, handle_table_lookup(&a->bo, r->fd, t->handle));
+		break;
+	}
+	case EXEC: {
+		const struct trace_exec *t = payload;
+		const uint8_t *ptr = (const uint8_t *)payload + a->exec_size;
+		uint64_t bytes = 0, relocs = 0;
+		uint32_t i;
+
+		for (i = 0; i < t->object_count; i++) {
+			const struct trace_exec_object *to = (const void *)ptr;
+			struct analyze_bo *bo =
+				handle_table_lookup(&a->bo, r->fd, to->handle);
+
+			if (bo->uses)
+				igt_stats_push(&a->reuse,
+					       a->num_execs - bo->last_used);
+			bo->last_used = a->num_execs;
+			bo->uses++;
+
+			bytes += bo->size;
+			relocs += to->relocation_count;
+
+			ptr = (const void *)(to + 1);
+			ptr += to->relocation_count * sizeof(struct trace_exec_relocation);
+		}
+
+		igt_stats_push(&a->objects, t->object_count);
+		igt_stats_push(&a->relocs, relocs);
+		igt_stats_push(&a->exec_bytes, bytes);
+		igt_stats_push(&a->live, a->live_bytes);
+		a->num_execs++;
+		break;
+	}
+	case CLOSE_FD:
+		if (r->fd < a->bo.num_fds) {
+			struct analyze_bo *bo = a->bo.fd[r->fd].slot;
+			uint32_t i;
+
+			for (i = 0; i < a->bo.fd[r->fd].count; i++)
+				analyze_retire(a, &bo[i]);
+			handle_table_drop_fd(&a->bo, r->fd);
+		}
+		break;
+	}
+}
+
+static void print_stats(const char *name, igt_stats_t *stats)
+{
+	double q1, q2, q3;
+
+	if (stats->n_values == 0) {
+		printf("  %-24s: no samples\n", name);
 		return;
+	}
 
-	ptr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
-	close(fd);
+	igt_stats_get_quartiles(stats, &q1, &q2, &q3);
+	printf("  %-24s: min %"PRIu64", q1 %.0f, median %.0f, q3 %.0f, max %"PRIu64", mean %.1f\n",
+	       name, igt_stats_get_min(stats), q1, q2, q3,
+	       igt_stats_get_max(stats), igt_stats_get_mean(stats));
+}
 
-	if (ptr == MAP_FAILED)
+/* Print a histogram of @stats with power-of-two bucket boundaries */
+static void print_histogram(const char *name, igt_stats_t *stats)
+{
+	uint64_t buckets[IGT_STATS_HISTOGRAM_BUCKETS];
+	unsigned int i, used;
+
+	if (stats->n_values == 0)
 		return;
 
-	madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+	used = igt_stats_get_histogram(stats, buckets, ARRAY_SIZE(buckets));
 
-	end = ptr + st.st_size;
-	fd = drm_open_driver(DRIVER_INTEL);
+	printf("  %s histogram:\n", name);
+	for (i = 0; i < used; i++) {
+		uint64_t lo = i ? 1ull << (i - 1) : 0;
+		uint64_t hi = i ? (1ull << (i - 1)) * 2 - 1 : 0;
 
-	clock_gettime(CLOCK_MONOTONIC, &t_start);
-	do {
-		switch (*ptr++) {
-		case ADD_BO: {
-				     uint32_t bb = 0xa << 23;
-				     struct trace_add_bo *t = (void *)ptr;
-				     ptr = (void *)(t + 1);
-
-				     if (t->handle >= num_bo) {
-					     int new_bo = (t->handle + 4096) & -4096;
-					     bo = realloc(bo, sizeof(*bo)*new_bo);
-					     memset(bo + num_bo, 0, sizeof(*bo)*(new_bo - num_bo));
-					     num_bo = new_bo;
-				     }
-
-				     bo[t->handle].handle = gem_create(fd, t->size);
-				     gem_write(fd, bo[t->handle].handle, 0, &bb, sizeof(bb));
-				     break;
-			     }
-		case DEL_BO: {
-				     struct trace_del_bo *t = (void *)ptr;
-				     ptr = (void *)(t + 1);
-
-				     gem_close(fd, bo[t->handle].handle);
-				     bo[t->handle].handle = 0;
-
-				     free(bo[t->handle].relocs);
-				     bo[t->handle].relocs = NULL;
-				     bo[t->handle].max_relocs = 0;
-				     break;
-			     }
-		case EXEC: {
-				   struct trace_exec *t = (void *)ptr;
-				   uint32_t i, j;
-				   ptr = (void *)(t + 1);
-
-				   eb.buffer_count = t->object_count;
-				   eb.flags = t->flags & ~I915_EXEC_RING_MASK;
-
-				   if (eb.buffer_count > max_objects) {
-					   free(exec_objects);
-					   free(offsets);
-
-					   max_objects = ALIGN(eb.buffer_count, 4096);
-
-					   exec_objects = malloc(max_objects*sizeof(*exec_objects));
-					   offsets = malloc(max_objects*sizeof(*offsets));
-
-					   eb.buffers_ptr = (uintptr_t)exec_objects;
-				   }
-
-				   for (i = 0; i < eb.buffer_count; i++) {
-					   struct drm_i915_gem_relocation_entry *relocs;
-					   struct trace_exec_object *to = (void *)ptr;
-					   ptr = (void *)(to + 1);
-
-					   offsets[i] = &bo[to->handle];
-
-					   exec_objects[i].handle = bo[to->handle].handle;
-					   exec_objects[i].offset = bo[to->handle].offset;
-					   exec_objects[i].alignment = to->alignment;
-					   exec_objects[i].flags = to->flags;
-					   exec_objects[i].rsvd1 = to->rsvd1;
-					   exec_objects[i].rsvd2 = to->rsvd2;
-
-					   exec_objects[i].relocation_count = to->relocation_count;
-					   if (!to->relocation_count)
-						   continue;
-
-					   if (to->relocation_count > bo[to->handle].max_relocs) {
-						   free(bo[to->handle].relocs);
-
-						   bo[to->handle].max_relocs = ALIGN(to->relocation_count, 128);
-						   bo[to->handle].relocs = malloc(sizeof(*bo[to->handle].relocs)*bo[to->handle].max_relocs);
-					   }
-					   relocs = bo[to->handle].relocs;
-					   exec_objects[i].relocs_ptr = (uintptr_t)relocs;
-
-					   for (j = 0; j < to->relocation_count; j++) {
-						   struct trace_exec_relocation *tr = (void *)ptr;
-						   ptr = (void *)(tr + 1);
-
-						   if (eb.flags & I915_EXEC_HANDLE_LUT) {
-							   uint32_t handle;
-
-							   relocs[j].target_handle = tr->target_handle;
-
-							   handle = exec_objects[tr->target_handle].handle;
-							   relocs[j].presumed_offset = bo[handle].offset;
-						   } else {
-							   relocs[j].target_handle = bo[tr->target_handle].handle;
-							   relocs[j].presumed_offset = bo[tr->target_handle].offset;
-						   }
-						   relocs[j].delta = tr->delta;
-						   relocs[j].offset = tr->offset;
-						   relocs[j].read_domains = tr->read_domains;
-						   relocs[j].write_domain = tr->write_domain;
-					   }
-				   }
-
-				   gem_execbuf(fd, &eb);
-
-				   for (i = 0; i < eb.buffer_count; i++)
-					   offsets[i]->offset = exec_objects[i].offset;
-
-				   break;
-			   }
-		}
-	} while (ptr < end);
-	clock_gettime(CLOCK_MONOTONIC, &t_end);
-	close(fd);
-	munmap(end-st.st_size, st.st_size);
+		if (!buckets[i])
+			continue;
 
-	for (fd = 0; fd < num_bo; fd++)
-		free(bo[fd].relocs);
-	free(bo);
-	free(offsets);
+		printf("    [%"PRIu64", %"PRIu64"]: %"PRIu64" (%.1f%%)\n",
+		       lo, hi, buckets[i], 100. * buckets[i] / stats->n_values);
+	}
+}
 
-	printf("%s: %.3f\n", filename, elapsed(&t_start, &t_end));
+static int analyze(const char *filename)
+{
+	struct analyze a = {};
+	struct trace t;
+	int64_t records;
+	uint32_t i, j;
+
+	if (trace_open(&t, filename))
+		return 1;
+
+	handle_table_init(&a.bo, sizeof(struct analyze_bo));
+	a.exec_size = t.exec_size;
+	igt_stats_init(&a.objects);
+	igt_stats_init(&a.relocs);
+	igt_stats_init(&a.exec_bytes);
+	igt_stats_init(&a.live);
+	igt_stats_init(&a.lifetime);
+	igt_stats_init(&a.uses);
+	igt_stats_init(&a.reuse);
+
+	records = trace_for_each_record(&t, 0, t.num_chunks, analyze_record, &a);
+
+	/* Objects still alive at the end of the trace */
+	for (i = 0; i < a.bo.num_fds; i++) {
+		struct analyze_bo *bo = a.bo.fd[i].slot;
+
+		for (j = 0; j < a.bo.fd[i].count; j++)
+			analyze_retire(&a, &bo[j]);
+	}
+
+	printf("%s: devid 0x%04x (gen%u), %"PRIu64" execbuffers%s\n",
+	       filename, t.header.devid, t.header.gen, a.num_execs,
+	       records < 0 ? " (truncated by corruption)" : "");
+	printf("  peak live objects       : %"PRIu64" (%"PRIu64" KiB)\n",
+	       a.max_live_objects, a.max_live_bytes >> 10);
+	print_stats("objects per exec", &a.objects);
+	print_stats("relocations per exec", &a.relocs);
+	print_stats("exec working set (B)", &a.exec_bytes);
+	print_stats("live bytes per exec", &a.live);
+	print_stats("object lifetime (execs)", &a.lifetime);
+	print_stats("uses per object", &a.uses);
+	print_stats("reuse distance (execs)", &a.reuse);
+	print_histogram("objects per exec", &a.objects);
+	print_histogram("relocations per exec", &a.relocs);
+	print_histogram("object lifetime", &a.lifetime);
+	print_histogram("reuse distance", &a.reuse);
+
+	igt_stats_fini(&a.objects);
+	igt_stats_fini(&a.relocs);
+	igt_stats_fini(&a.exec_bytes);
+	igt_stats_fini(&a.live);
+	igt_stats_fini(&a.lifetime);
+	igt_stats_fini(&a.uses);
+	igt_stats_fini(&a.reuse);
+	handle_table_fini(&a.bo);
+
+	trace_close(&t);
+	return records < 0;
 }
 
 int main(int argc, char **argv)
 {
-	int i;
+	enum { REPLAY, VALIDATE, ANALYZE } mode = REPLAY;
+	bool mock = false, skip_relocs = false, threaded = false;
+	int ret = 0;
+	int i, c;
+
+	while ((c = getopt(argc, argv, "Vamtr:")) != -1) {
+		switch (c) {
+		case 't':
+			/* One thread per traced context */
+			threaded = true;
+			break;
+		case 'm':
+			/* Replay against a mock device, to time the replay loop */
+			mock = true;
+			break;
+		case 'r':
+			if (strcmp(optarg, "full") == 0) {
+				skip_relocs = false;
+			} else if (strcmp(optarg, "skip") == 0) {
+				skip_relocs = true;
+			} else {
+				fprintf(stderr, "unknown relocation mode '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'V':
+			/* Check the trace structure, no device required */
+			mode = VALIDATE;
+			break;
+		case 'a':
+			/* Characterise the workload, no device required */
+			mode = ANALYZE;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-V | -a | [-m] [-t | -r full|skip]] trace...\n", argv[0]);
+			return 1;
+		}
+	}
 
-	for (i = 1; i < argc; i++)
-		replay(argv[i]);
+	for (i = optind; i < argc; i++) {
+		switch (mode) {
+		case REPLAY:
+			if (threaded)
+				replay_threaded(argv[i], mock);
+			else
+				replay(argv[i], mock, skip_relocs);
+			break;
+		case VALIDATE:
+			ret |= validate(argv[i]);
+			break;
+		case ANALYZE:
+			ret |= analyze(argv[i]);
+			break;
+		}
+	}
 
-	return 0;
+	return ret;
 }
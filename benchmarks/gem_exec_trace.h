@@ -0,0 +1,147 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef GEM_EXEC_TRACE_H
+#define GEM_EXEC_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * On-disk format shared by gem_exec_tracer (writer) and gem_exec_trace
+ * (replayer).
+ *
+ * A trace starts with a struct trace_header. It is followed by a stream of
+ * records, each one a struct trace_record giving the command and the length
+ * of the payload that follows it, so that readers can validate and skip
+ * records (including ones they do not know about) without understanding
+ * their contents. Readers must only rely on the first sizeof(payload) bytes
+ * of a record and ignore any trailing data, which allows fields to be
+ * appended to a payload without bumping the version.
+ *
+ * Since version 2, a trace covers every i915 fd of the traced process:
+ * each record names the fd it was issued on, and each EXEC the context it
+ * was submitted to. Version 1 traces have an implicit fd and context of 0.
+ * A CLOSE_FD record, without payload, says the fd was closed: the handles
+ * and contexts issued on it are gone, and the fd number may come back as a
+ * new i915 fd with namespaces of its own. Older traces have none.
+ *
+ * The record stream is cut into chunks of roughly TRACE_CHUNK_SIZE bytes,
+ * always on a record boundary. When the trace is closed cleanly, a
+ * struct trace_index listing every chunk is appended after the last record
+ * and header.index_offset is updated to point at it. A trace without an
+ * index (e.g. the traced application crashed) is still valid and can be
+ * read sequentially up to the last complete record.
+ */
+
+#define TRACE_MAGIC 0x54584547 /* "GEXT" */
+#define TRACE_VERSION 2
+
+#define TRACE_CHUNK_SIZE (4 << 20)
+
+struct trace_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t devid;
+	uint32_t gen;
+	uint32_t page_size;
+	uint64_t index_offset;
+} __attribute__((packed));
+
+enum {
+	ADD_BO = 0,
+	DEL_BO,
+	EXEC,
+	CLOSE_FD,
+};
+
+struct trace_record {
+	uint8_t cmd;
+	uint8_t pad;
+	uint16_t fd;
+	uint32_t length;
+} __attribute__((packed));
+
+struct trace_add_bo {
+	uint32_t handle;
+	uint64_t size;
+} __attribute__((packed));
+
+struct trace_del_bo {
+	uint32_t handle;
+} __attribute__((packed));
+
+/*
+ * An EXEC record carries a struct trace_exec, followed by object_count
+ * struct trace_exec_object, each directly followed by its relocation_count
+ * struct trace_exec_relocation. Use trace_exec_size() to find the first
+ * object, as the struct grew in version 2.
+ */
+struct trace_exec {
+	uint32_t object_count;
+	uint64_t flags;
+	uint32_t context;
+} __attribute__((packed));
+
+static inline uint32_t trace_exec_size(uint32_t version)
+{
+	if (version < 2)
+		return offsetof(struct trace_exec, context);
+
+	return sizeof(struct trace_exec);
+}
+
+struct trace_exec_object {
+	uint32_t handle;
+	uint32_t relocation_count;
+	uint64_t alignment;
+	uint64_t flags;
+	uint64_t rsvd1;
+	uint64_t rsvd2;
+} __attribute__((packed));
+
+struct trace_exec_relocation {
+	uint32_t target_handle;
+	uint32_t delta;
+	uint64_t offset;
+	uint32_t read_domains;
+	uint32_t write_domain;
+} __attribute__((packed));
+
+#define TRACE_INDEX_MAGIC 0x58444e49 /* "INDX" */
+
+struct trace_chunk {
+	uint64_t offset;
+	uint64_t length;
+	uint32_t num_records;
+	uint32_t num_execs;
+} __attribute__((packed));
+
+struct trace_index {
+	uint32_t magic;
+	uint32_t num_chunks;
+	struct trace_chunk chunk[0];
+} __attribute__((packed));
+
+#endif /* GEM_EXEC_TRACE_H */
@@ -37,57 +37,66 @@
 #include <errno.h>
 #include <sys/mman.h>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
 #include <i915_drm.h>
 
 #include "intel_aub.h"
 #include "intel_chipset.h"
+#include "gem_exec_trace.h"
 
 static int (*libc_close)(int fd);
 static int (*libc_ioctl)(int fd, unsigned long request, void *argp);
 
-static int drm_fd = -1;
-static FILE *file;
+/* Every fd the application issued DRM ioctls on, and whether it is i915 */
+#define MAX_FDS 65536
+enum { FD_UNKNOWN = 0, FD_I915, FD_OTHER };
+static uint8_t fds[MAX_FDS];
 
-#define DRM_MAJOR 226
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static char filename[80];
+static int file = -1;
+
+static struct trace_header header;
+static uint64_t file_offset;
+static struct trace_chunk chunk;
+static struct trace_chunk *chunks;
+static uint32_t num_chunks, max_chunks;
 
-enum {
-	ADD_BO = 0,
-	DEL_BO,
-	EXEC,
+/*
+ * Records are not written to the file from the application threads.
+ * Instead they are appended to an in-memory ring, and a background thread
+ * copies the committed part of the ring to the trace file. Positions in
+ * the ring are free-running byte counts, so that reserve - tail is the
+ * amount of data not yet written out.
+ *
+ * Producers claim space by advancing reserve with a CAS, fill it in, and
+ * then publish it by advancing commit in reservation order. The flusher is
+ * the only one to advance tail. Only when the ring is full does the
+ * application have to wait for the flusher.
+ *
+ * The flusher never exits the process, as the destructor would then run on
+ * it and wait for itself: the first error is recorded, the records after
+ * it are dropped, and trace_close() reports it.
+ */
+#define RING_SIZE (64 << 20)
+
+static struct {
+	uint8_t *data;
+	uint64_t reserve;
+	uint64_t commit;
+	uint64_t tail;
+	pthread_t flusher;
+	bool done;
+	bool failed;
+	const char *error;
+	int error_errno;
+	pthread_mutex_t lock;
+} ring = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
 };
 
-struct trace_add_bo {
-	uint8_t cmd;
-	uint32_t handle;
-	uint64_t size;
-} __attribute__((packed));
-struct trace_del_bo {
-	uint8_t cmd;
-	uint32_t handle;
-}__attribute__((packed));
-
-struct trace_exec {
-	uint8_t cmd;
-	uint32_t object_count;
-	uint64_t flags;
-}__attribute__((packed));
-
-struct trace_exec_object {
-	uint32_t handle;
-	uint32_t relocation_count;
-	uint64_t alignment;
-	uint64_t flags;
-	uint64_t rsvd1;
-	uint64_t rsvd2;
-}__attribute__((packed));
-
-struct trace_exec_relocation {
-	uint32_t target_handle;
-	uint32_t delta;
-	uint64_t offset;
-	uint32_t read_domains;
-	uint32_t write_domain;
-}__attribute__((packed));
+#define DRM_MAJOR 226
 
 static void __attribute__ ((format(__printf__, 2, 3)))
 fail_if(int cond, const char *format, ...)
@@ -104,17 +113,334 @@ fail_if(int cond, const char *format, ...)
 	exit(1);
 }
 
+/* Keeps the first error only */
+static void
+trace_error(const char *error, int err)
+{
+	pthread_mutex_lock(&ring.lock);
+	if (ring.error == NULL) {
+		ring.error = error;
+		ring.error_errno = err;
+	}
+	pthread_mutex_unlock(&ring.lock);
+}
+
+/* Only called by the flusher, or while it isn't running */
+static void
+file_out(const void *data, size_t size)
+{
+	const uint8_t *ptr = data;
+
+	while (size && !ring.failed) {
+		ssize_t ret = write(file, ptr, size);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			trace_error("failed to write trace", ret ? errno : ENOSPC);
+			ring.failed = true;
+			break;
+		}
+
+		ptr += ret;
+		size -= ret;
+		file_offset += ret;
+	}
+}
+
+static void
+ring_read(uint64_t pos, void *data, size_t size)
+{
+	uint32_t idx = pos & (RING_SIZE - 1);
+	size_t len = RING_SIZE - idx < size ? RING_SIZE - idx : size;
+
+	memcpy(data, ring.data + idx, len);
+	memcpy((uint8_t *)data + len, ring.data, size - len);
+}
+
+static void
+ring_write(uint64_t *pos, const void *data, size_t size)
+{
+	uint32_t idx = *pos & (RING_SIZE - 1);
+	size_t len = RING_SIZE - idx < size ? RING_SIZE - idx : size;
+
+	memcpy(ring.data + idx, data, len);
+	memcpy(ring.data, (const uint8_t *)data + len, size - len);
+	*pos += size;
+}
+
+static void
+trace_end_chunk(void)
+{
+	if (chunk.num_records == 0)
+		return;
+
+	if (num_chunks == max_chunks && !ring.failed) {
+		uint32_t max = max_chunks ? 2 * max_chunks : 256;
+		struct trace_chunk *c = realloc(chunks, max * sizeof(*chunks));
+
+		if (c == NULL) {
+			trace_error("failed to grow trace index", ENOMEM);
+			ring.failed = true;
+		} else {
+			chunks = c;
+			max_chunks = max;
+		}
+	}
+
+	if (!ring.failed) {
+		chunk.length = file_offset - chunk.offset;
+		chunks[num_chunks++] = chunk;
+	}
+
+	memset(&chunk, 0, sizeof(chunk));
+	chunk.offset = file_offset;
+}
+
+static void
+ring_writeout(uint64_t end)
+{
+	while (ring.tail < end) {
+		uint32_t idx = ring.tail & (RING_SIZE - 1);
+		size_t len = RING_SIZE - idx;
+
+		if (len > end - ring.tail)
+			len = end - ring.tail;
+		file_out(ring.data + idx, len);
+		__atomic_store_n(&ring.tail, ring.tail + len, __ATOMIC_RELEASE);
+	}
+}
+
+static void
+ring_flush(uint64_t commit)
+{
+	uint64_t pos = ring.tail;
+
+	/* Walk the record headers to cut the stream into chunks */
+	while (pos < commit) {
+		struct trace_record r;
+
+		if (header.header_size + pos - chunk.offset >= TRACE_CHUNK_SIZE) {
+			ring_writeout(pos);
+			trace_end_chunk();
+		}
+
+		ring_read(pos, &r, sizeof(r));
+		chunk.num_records++;
+		if (r.cmd == EXEC)
+			chunk.num_execs++;
+		pos += sizeof(r) + r.length;
+	}
+
+	ring_writeout(commit);
+}
+
+static void *
+ring_flusher(void *arg)
+{
+	for (;;) {
+		uint64_t commit = __atomic_load_n(&ring.commit, __ATOMIC_ACQUIRE);
+
+		if (commit != ring.tail) {
+			ring_flush(commit);
+			continue;
+		}
+
+		if (__atomic_load_n(&ring.done, __ATOMIC_ACQUIRE))
+			break;
+
+		usleep(1000);
+	}
+
+	return NULL;
+}
+
+static uint64_t
+ring_reserve(uint32_t size)
+{
+	uint64_t pos = __atomic_load_n(&ring.reserve, __ATOMIC_RELAXED);
+
+	fail_if(size > RING_SIZE, "trace record too large (%u bytes)\n", size);
+
+	do {
+		while (pos + size - __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE) > RING_SIZE) {
+			sched_yield();
+			pos = __atomic_load_n(&ring.reserve, __ATOMIC_RELAXED);
+		}
+	} while (!__atomic_compare_exchange_n(&ring.reserve, &pos, pos + size,
+					      true, __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+
+	return pos;
+}
+
+static void
+ring_commit(uint64_t pos, uint64_t end)
+{
+	/* Publish in reservation order, behind any earlier writer */
+	while (__atomic_load_n(&ring.commit, __ATOMIC_ACQUIRE) != pos)
+		sched_yield();
+
+	__atomic_store_n(&ring.commit, end, __ATOMIC_RELEASE);
+}
+
+static uint64_t
+trace_record(int fd, uint8_t cmd, uint32_t length, uint64_t *end)
+{
+	struct trace_record r = { .cmd = cmd, .fd = fd, .length = length };
+	uint64_t pos;
+
+	pos = ring_reserve(sizeof(r) + length);
+	*end = pos;
+	ring_write(end, &r, sizeof(r));
+
+	return pos;
+}
+
+static void
+trace_write_header(void)
+{
+	if (pwrite(file, &header, sizeof(header), 0) != sizeof(header))
+		trace_error("failed to write trace header", errno);
+}
+
+static void
+trace_open(void)
+{
+	sprintf(filename, "/tmp/trace.%d", getpid());
+	file = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	fail_if(file < 0, "failed to open trace file %s\n", filename);
+
+	memset(&header, 0, sizeof(header));
+	header.magic = TRACE_MAGIC;
+	header.version = TRACE_VERSION;
+	header.header_size = sizeof(header);
+	header.page_size = sysconf(_SC_PAGESIZE);
+
+	file_offset = 0;
+	file_out(&header, sizeof(header));
+
+	num_chunks = 0;
+	memset(&chunk, 0, sizeof(chunk));
+	chunk.offset = file_offset;
+
+	if (ring.data == NULL) {
+		ring.data = malloc(RING_SIZE);
+		fail_if(ring.data == NULL, "failed to allocate trace ring\n");
+	}
+	ring.reserve = ring.commit = ring.tail = 0;
+	ring.done = false;
+	fail_if(pthread_create(&ring.flusher, NULL, ring_flusher, NULL),
+		"failed to start trace flusher\n");
+}
+
+static void
+trace_close(void)
+{
+	struct trace_index index = { TRACE_INDEX_MAGIC };
+
+	if (file < 0)
+		return;
+
+	__atomic_store_n(&ring.done, true, __ATOMIC_RELEASE);
+	pthread_join(ring.flusher, NULL);
+	ring_flush(__atomic_load_n(&ring.commit, __ATOMIC_ACQUIRE));
+
+	trace_end_chunk();
+
+	if (!ring.failed) {
+		header.index_offset = file_offset;
+		index.num_chunks = num_chunks;
+		file_out(&index, sizeof(index));
+		file_out(chunks, num_chunks * sizeof(*chunks));
+	}
+	/* Don't point the header at an index which isn't all there */
+	if (!ring.failed)
+		trace_write_header();
+
+	libc_close(file);
+	file = -1;
+
+	pthread_mutex_lock(&ring.lock);
+	if (ring.error)
+		fprintf(stderr, "%s%s%s, '%s' is incomplete\n",
+			ring.error, ring.error_errno ? ": " : "",
+			ring.error_errno ? strerror(ring.error_errno) : "",
+			filename);
+	pthread_mutex_unlock(&ring.lock);
+}
+
+static int
+gem_get_param(int fd, uint32_t param)
+{
+	int value = 0;
+	drm_i915_getparam_t gp = {
+		.param = param,
+		.value = &value
+	};
+
+	if (libc_ioctl(fd, DRM_IOCTL_I915_GETPARAM, &gp))
+		return 0;
+
+	return value;
+}
+
+/*
+ * As intel_gen(), with just the macros of intel_chipset.h: linking all of
+ * libintel_tools would bring its constructors and signal handling into
+ * the traced process.
+ */
+static int
+devid_gen(uint32_t devid)
+{
+	if (IS_GEN2(devid))
+		return 2;
+	if (IS_GEN3(devid))
+		return 3;
+	if (IS_GEN4(devid))
+		return 4;
+	if (IS_GEN5(devid))
+		return 5;
+	if (IS_GEN6(devid))
+		return 6;
+	if (IS_GEN7(devid))
+		return 7;
+	if (IS_GEN8(devid))
+		return 8;
+	if (IS_GEN9(devid))
+		return 9;
+
+	return -1;
+}
+
 static void
 trace_exec(int fd, const struct drm_i915_gem_execbuffer2 *execbuffer2)
 {
 	const struct drm_i915_gem_exec_object2 *exec_objects =
 		(struct drm_i915_gem_exec_object2 *)(uintptr_t)execbuffer2->buffers_ptr;
+	uint64_t pos, end;
+	uint32_t length;
+
+	/* We can't do this at open time as we're not yet authenticated. */
+	if (header.devid == 0) {
+		header.devid = gem_get_param(fd, I915_PARAM_CHIPSET_ID);
+		if (header.devid) {
+			header.gen = devid_gen(header.devid);
+			trace_write_header();
+		}
+	}
+
+	length = sizeof(struct trace_exec);
+	for (uint32_t i = 0; i < execbuffer2->buffer_count; i++)
+		length += sizeof(struct trace_exec_object) +
+			exec_objects[i].relocation_count * sizeof(struct trace_exec_relocation);
+	pos = trace_record(fd, EXEC, length, &end);
 
 	{
 		struct trace_exec t = {
-			EXEC, execbuffer2->buffer_count, execbuffer2->flags
+			execbuffer2->buffer_count, execbuffer2->flags,
+			i915_execbuffer2_get_context_id(*execbuffer2)
 		};
-		fwrite(&t, sizeof(t), 1, file);
+		ring_write(&end, &t, sizeof(t));
 	}
 
 	for (uint32_t i = 0; i < execbuffer2->buffer_count; i++) {
@@ -130,7 +456,7 @@ trace_exec(int fd, const struct drm_i915_gem_execbuffer2 *execbuffer2)
 				obj->rsvd1,
 				obj->rsvd2
 			};
-			fwrite(&t, sizeof(t), 1, file);
+			ring_write(&end, &t, sizeof(t));
 		}
 		for (uint32_t j = 0; j < obj->relocation_count; j++) {
 			struct trace_exec_relocation t = {
@@ -140,32 +466,53 @@ trace_exec(int fd, const struct drm_i915_gem_execbuffer2 *execbuffer2)
 				relocs[j].read_domains,
 				relocs[j].write_domain,
 			};
-			fwrite(&t, sizeof(t), 1, file);
+			ring_write(&end, &t, sizeof(t));
 		}
 	}
 
-	fflush(file);
+	ring_commit(pos, end);
+}
+
+static void
+trace_add(int fd, uint32_t handle, uint64_t size)
+{
+	struct trace_add_bo t = { handle, size };
+	uint64_t pos, end;
+
+	pos = trace_record(fd, ADD_BO, sizeof(t), &end);
+	ring_write(&end, &t, sizeof(t));
+	ring_commit(pos, end);
 }
 
 static void
-trace_add(uint32_t handle, uint64_t size)
+trace_del(int fd, uint32_t handle)
 {
-	struct trace_add_bo t = { ADD_BO, handle, size };
-	fwrite(&t, sizeof(t), 1, file);
+	struct trace_del_bo t = { handle };
+	uint64_t pos, end;
+
+	pos = trace_record(fd, DEL_BO, sizeof(t), &end);
+	ring_write(&end, &t, sizeof(t));
+	ring_commit(pos, end);
 }
 
 static void
-trace_del(uint32_t handle)
+trace_close_fd(int fd)
 {
-	struct trace_del_bo t = { DEL_BO, handle };
-	fwrite(&t, sizeof(t), 1, file);
+	uint64_t pos, end;
+
+	pos = trace_record(fd, CLOSE_FD, 0, &end);
+	ring_commit(pos, end);
 }
 
 int
 close(int fd)
 {
-	if (fd == drm_fd)
-		drm_fd = -1;
+	/* Before the fd number can be handed out again */
+	if (fd >= 0 && fd < MAX_FDS) {
+		if (fds[fd] == FD_I915 && file >= 0)
+			trace_close_fd(fd);
+		fds[fd] = FD_UNKNOWN;
+	}
 
 	return libc_close(fd);
 }
@@ -217,19 +564,17 @@ ioctl(int fd, unsigned long request, ...)
 	if (_IOC_TYPE(request) != DRM_IOCTL_BASE)
 		return 0;
 
-	if (drm_fd != fd) {
-		char filename[80];
-
-		if (!is_i915(fd))
-			return 0;
+	if (fd < 0 || fd >= MAX_FDS)
+		return 0;
 
-		if (file)
-			fclose(file);
+	if (fds[fd] == FD_UNKNOWN)
+		fds[fd] = is_i915(fd) ? FD_I915 : FD_OTHER;
+	if (fds[fd] != FD_I915)
+		return 0;
 
-		sprintf(filename, "/tmp/trace.%d", fd);
-		file = fopen(filename, "w+");
-		drm_fd = fd;
-	}
+	pthread_once(&trace_once, trace_open);
+	if (file < 0)
+		return 0;
 
 	switch (request) {
 	case DRM_IOCTL_I915_GEM_EXECBUFFER2:
@@ -238,25 +583,25 @@ ioctl(int fd, unsigned long request, ...)
 
 	case DRM_IOCTL_I915_GEM_CREATE: {
 		struct drm_i915_gem_create *create = argp;
-		trace_add(create->handle, create->size);
+		trace_add(fd, create->handle, create->size);
 		break;
 	}
 
 	case DRM_IOCTL_I915_GEM_USERPTR: {
 		struct drm_i915_gem_userptr *userptr = argp;
-		trace_add(userptr->handle, userptr->user_size);
+		trace_add(fd, userptr->handle, userptr->user_size);
 		break;
 	}
 
 	case DRM_IOCTL_GEM_CLOSE: {
 		struct drm_gem_close *close = argp;
-		trace_del(close->handle);
+		trace_del(fd, close->handle);
 		break;
 	}
 
 	case DRM_IOCTL_GEM_OPEN: {
 		struct drm_gem_open *open = argp;
-		trace_add(open->handle, open->size);
+		trace_add(fd, open->handle, open->size);
 		break;
 	}
 
@@ -264,13 +609,13 @@ ioctl(int fd, unsigned long request, ...)
 		struct drm_prime_handle *prime = argp;
 		off_t size = lseek(prime->fd, 0, SEEK_END);
 		fail_if(size == -1, "failed to get prime bo size\n");
-		trace_add(prime->handle, size);
+		trace_add(fd, prime->handle, size);
 		break;
 	}
 
 	case DRM_IOCTL_MODE_GETFB: {
 		struct drm_mode_fb_cmd *cmd = argp;
-		trace_add(cmd->handle, size_for_fb(cmd));
+		trace_add(fd, cmd->handle, size_for_fb(cmd));
 		break;
 	}
 	}
@@ -278,6 +623,20 @@ ioctl(int fd, unsigned long request, ...)
 	return 0;
 }
 
+/*
+ * A forked child has the ring and the trace file of its parent, but no
+ * flusher, and it may only call async-signal-safe functions until it
+ * execs, so it can't start tracing afresh: leave it untraced.
+ */
+static void
+trace_atfork_child(void)
+{
+	if (file >= 0) {
+		libc_close(file);
+		file = -1;
+	}
+}
+
 static void __attribute__ ((constructor))
 init(void)
 {
@@ -285,4 +644,14 @@ init(void)
 	libc_ioctl = dlsym(RTLD_NEXT, "ioctl");
 	fail_if(libc_close == NULL || libc_ioctl == NULL,
 		"failed to get libc ioctl or close\n");
+	fail_if(pthread_atfork(NULL, NULL, trace_atfork_child),
+		"failed to register fork handler\n");
+}
+
+static void __attribute__ ((destructor))
+fini(void)
+{
+	trace_close();
+	free(chunks);
+	free(ring.data);
 }
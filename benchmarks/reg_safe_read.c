@@ -0,0 +1,173 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Cost of the register map check done by intel_register_read() in safe
+ * mode, against an MMIO dump file so that it measures the check rather
+ * than the hardware. Every readable register of the map that is in the
+ * file is read over and over, reporting ns per read.
+ *
+ * -f dump file, e.g. from intel_reg snapshot, -d devid (gen4+)
+ * -m inreg|unsafe|safe|lookup: time INREG(), intel_register_read() without
+ *    and with the register map, or just intel_get_register_range()
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "intel_io.h"
+#include "intel_chipset.h"
+
+static double elapsed(const struct timespec *start,
+		      const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
+enum mode { INREG_MODE, UNSAFE, SAFE, LOOKUP };
+
+static struct intel_register_map map;
+static uint32_t *offsets;
+static unsigned long count;
+
+static uint32_t read_all(enum mode mode)
+{
+	uint32_t sum = 0;
+	unsigned long i;
+
+	switch (mode) {
+	case INREG_MODE:
+		for (i = 0; i < count; i++)
+			sum += INREG(offsets[i]);
+		break;
+	case UNSAFE:
+	case SAFE:
+		for (i = 0; i < count; i++)
+			sum += intel_register_read(offsets[i]);
+		break;
+	case LOOKUP:
+		for (i = 0; i < count; i++)
+			sum += intel_get_register_range(map, offsets[i],
+							INTEL_RANGE_READ) != NULL;
+		break;
+	}
+
+	return sum;
+}
+
+int main(int argc, char **argv)
+{
+	struct pci_device pci_dev;
+	struct timespec start, end;
+	enum mode mode = SAFE;
+	char *file = NULL;
+	uint32_t devid = 0, offset;
+	struct stat st;
+	int reps = 1;
+	int loops, c;
+
+	while ((c = getopt (argc, argv, "f:d:m:r:")) != -1) {
+		switch (c) {
+		case 'f':
+			file = optarg;
+			break;
+
+		case 'd':
+			devid = strtoul(optarg, NULL, 16);
+			break;
+
+		case 'm':
+			if (strcmp(optarg, "inreg") == 0)
+				mode = INREG_MODE;
+			else if (strcmp(optarg, "unsafe") == 0)
+				mode = UNSAFE;
+			else if (strcmp(optarg, "safe") == 0)
+				mode = SAFE;
+			else if (strcmp(optarg, "lookup") == 0)
+				mode = LOOKUP;
+			else
+				abort();
+			break;
+
+		case 'r':
+			reps = atoi(optarg);
+			if (reps < 1)
+				reps = 1;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	if (file == NULL || intel_gen(devid) < 4) {
+		fprintf(stderr, "usage: %s -f DUMP -d DEVID (gen4+) "
+			"[-m inreg|unsafe|safe|lookup] [-r REPS]\n", argv[0]);
+		return 1;
+	}
+
+	if (stat(file, &st)) {
+		perror(file);
+		return 1;
+	}
+	intel_mmio_use_dump_file(file);
+
+	/* Only what is there in the dump and allowed, so nothing warns */
+	map = intel_get_register_map(devid);
+	offsets = malloc(map.top / 4 * sizeof(*offsets));
+	for (offset = 0; offset < map.top && offset + 4 <= st.st_size; offset += 4)
+		if (intel_get_register_range(map, offset, INTEL_RANGE_READ))
+			offsets[count++] = offset;
+
+	memset(&pci_dev, 0, sizeof(pci_dev));
+	pci_dev.device_id = devid;
+	intel_register_access_init(&pci_dev, mode == SAFE);
+
+	fprintf(stderr, "%lu registers\n", count);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	read_all(mode);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	loops = 1 / elapsed(&start, &end);
+	if (loops < 1)
+		loops = 1;
+	while (reps--) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (c = 0; c < loops; c++)
+			read_all(mode);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		printf("%.2f\n", 1e9 * elapsed(&start, &end) / loops / count);
+	}
+
+	intel_register_access_fini();
+	free(offsets);
+
+	return 0;
+}
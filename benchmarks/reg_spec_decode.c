@@ -0,0 +1,223 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Register lookup and decode throughput of intel_reg: every register of a
+ * spec file is looked up by name and by address, as intel_reg does for each
+ * REGISTER argument, and its value from an MMIO snapshot decoded. Reports
+ * registers per second.
+ *
+ * -s spec file, -m MMIO snapshot (random values without one),
+ * -d devid to decode for (0 for all platforms),
+ * -l use a linear search of the spec instead of the hash tables
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "intel_reg_spec.h"
+
+static double elapsed(const struct timespec *start,
+		      const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
+static struct reg *regs;
+static ssize_t count;
+static struct reg_index *reg_index;
+static const uint8_t *snapshot;
+static size_t snapshot_size;
+static uint32_t devid;
+static bool linear;
+
+static const struct reg *find_addr(enum port_addr port, uint32_t addr)
+{
+	ssize_t i;
+
+	if (!linear)
+		return intel_reg_spec_find_addr(reg_index, port, addr);
+
+	for (i = 0; i < count; i++)
+		if (regs[i].port_desc.port == port &&
+		    regs[i].addr + regs[i].mmio_offset == addr)
+			return &regs[i];
+
+	return NULL;
+}
+
+static const struct reg *find_name(enum port_addr port, const char *name)
+{
+	ssize_t i;
+
+	if (!linear)
+		return intel_reg_spec_find_name(reg_index, port, name);
+
+	for (i = 0; i < count; i++)
+		if (regs[i].port_desc.port == port && regs[i].name &&
+		    strcasecmp(regs[i].name, name) == 0)
+			return &regs[i];
+
+	return NULL;
+}
+
+static uint32_t read_value(const struct reg *reg, unsigned seed)
+{
+	uint32_t offset = reg->addr + reg->mmio_offset;
+
+	if (!snapshot)
+		return seed * 0x9e3779b9;
+
+	if (reg->port_desc.port != PORT_MMIO ||
+	    offset + sizeof(uint32_t) > snapshot_size)
+		return 0;
+
+	return *(const uint32_t *)(snapshot + offset);
+}
+
+static unsigned long decode_all(void)
+{
+	unsigned long found = 0;
+	char buf[1024];
+	ssize_t i;
+
+	for (i = 0; i < count; i++) {
+		const struct reg *reg = &regs[i];
+		const struct reg *r;
+
+		r = find_name(reg->port_desc.port, reg->name);
+		r = find_addr(r->port_desc.port, r->addr + r->mmio_offset);
+		found += r == reg;
+
+		intel_reg_spec_decode(buf, sizeof(buf), r,
+				      read_value(r, i), devid);
+	}
+
+	return found;
+}
+
+int main(int argc, char **argv)
+{
+	struct timespec start, end;
+	const char *spec = NULL, *mmio = NULL;
+	int reps = 1;
+	int loops, c;
+
+	while ((c = getopt (argc, argv, "s:m:d:lr:")) != -1) {
+		switch (c) {
+		case 's':
+			spec = optarg;
+			break;
+
+		case 'm':
+			mmio = optarg;
+			break;
+
+		case 'd':
+			devid = strtoul(optarg, NULL, 16);
+			break;
+
+		case 'l':
+			linear = true;
+			break;
+
+		case 'r':
+			reps = atoi(optarg);
+			if (reps < 1)
+				reps = 1;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	if (spec == NULL) {
+		fprintf(stderr, "usage: %s -s SPEC [-m MMIO] [-d DEVID] [-l] [-r REPS]\n",
+			argv[0]);
+		return 1;
+	}
+
+	count = intel_reg_spec_file(&regs, spec);
+	if (count <= 0)
+		return 1;
+
+	reg_index = intel_reg_spec_index(regs, count);
+	if (reg_index == NULL)
+		return 1;
+
+	if (mmio) {
+		struct stat st;
+		int fd;
+
+		fd = open(mmio, O_RDONLY);
+		if (fd < 0 || fstat(fd, &st)) {
+			perror(mmio);
+			return 1;
+		}
+
+		snapshot_size = st.st_size;
+		snapshot = mmap(NULL, snapshot_size, PROT_READ, MAP_PRIVATE,
+				fd, 0);
+		if (snapshot == MAP_FAILED) {
+			perror(mmio);
+			return 1;
+		}
+		close(fd);
+	}
+
+	/* Duplicate names and addresses resolve to the first definition. */
+	fprintf(stderr, "%zd registers, %lu resolve to themselves\n",
+		count, decode_all());
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	decode_all();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	loops = 1 / elapsed(&start, &end);
+	if (loops < 1)
+		loops = 1;
+	while (reps--) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (c = 0; c < loops; c++)
+			decode_all();
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		printf("%.0f\n", count * (double)loops / elapsed(&start, &end));
+	}
+
+	intel_reg_spec_index_free(reg_index);
+	intel_reg_spec_free(regs, count);
+
+	return 0;
+}
@@ -0,0 +1,253 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdbool.h>
+
+#include "igt_ascii85.h"
+
+#if defined(__x86_64__) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define HAVE_ASCII85_SIMD 1
+#include <immintrin.h>
+#endif
+
+/**
+ * SECTION:igt_ascii85
+ * @short_description: Fast ascii85 decoding
+ * @title: ascii85
+ * @include: igt.h
+ *
+ * The kernel dumps buffer objects in the GPU error state as zlib compressed
+ * data encoded with ascii85, in which every group of five characters from
+ * '!' to 'u' encodes a dword in base 85 and 'z' stands for a zero dword.
+ * Error states can carry hundreds of megabytes of it, so the decoder
+ * works on several groups at a time with SSE4.1 or AVX2 when the CPU
+ * supports them, falling back to decoding one group at a time.
+ */
+
+static inline uint32_t decode_group(const char *in)
+{
+	uint32_t v = 0;
+
+	v += in[0] - 33; v *= 85;
+	v += in[1] - 33; v *= 85;
+	v += in[2] - 33; v *= 85;
+	v += in[3] - 33; v *= 85;
+	v += in[4] - 33;
+
+	return v;
+}
+
+/*
+ * Decode one 'z' or group of five, as the vector loops cannot. Returns the
+ * number of characters consumed, or 0 at the end of the input.
+ */
+static inline int decode_step(const char *in, const char *end, uint32_t *out)
+{
+	if (in == end || *in < '!' || *in > 'z')
+		return 0;
+
+	if (*in == 'z') {
+		*out = 0;
+		return 1;
+	}
+
+	if (end - in < 5)
+		return 0;
+
+	*out = decode_group(in);
+	return 5;
+}
+
+/**
+ * igt_ascii85_decode_generic:
+ * @in: ascii85 encoded input
+ * @len: length of @in
+ * @out: output, with room for igt_ascii85_max_dwords(@len) dwords
+ *
+ * Plain C version of igt_ascii85_decode(), for reference.
+ *
+ * Returns: the number of dwords written to @out
+ */
+size_t igt_ascii85_decode_generic(const char *in, size_t len, uint32_t *out)
+{
+	const char *end = in + len;
+	size_t count = 0;
+	int n;
+
+	while ((n = decode_step(in, end, &out[count]))) {
+		in += n;
+		count++;
+	}
+
+	return count;
+}
+
+#ifdef HAVE_ASCII85_SIMD
+/*
+ * For each of the five digits, where to find it for each of four groups
+ * of five characters: groups 0 to 2 are taken from the 16 characters at
+ * in[0], group 3 from the 16 characters at in[4]. Each digit lands in the
+ * low byte of its group's dword.
+ */
+#define __ -1
+static const int8_t digit_lo[5][16] = {
+	{  0, __, __, __,  5, __, __, __, 10, __, __, __, 15, __, __, __ },
+	{  1, __, __, __,  6, __, __, __, 11, __, __, __, __, __, __, __ },
+	{  2, __, __, __,  7, __, __, __, 12, __, __, __, __, __, __, __ },
+	{  3, __, __, __,  8, __, __, __, 13, __, __, __, __, __, __, __ },
+	{  4, __, __, __,  9, __, __, __, 14, __, __, __, __, __, __, __ },
+};
+static const int8_t digit_hi[5][16] = {
+	{ __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __ },
+	{ __, __, __, __, __, __, __, __, __, __, __, __, 12, __, __, __ },
+	{ __, __, __, __, __, __, __, __, __, __, __, __, 13, __, __, __ },
+	{ __, __, __, __, __, __, __, __, __, __, __, __, 14, __, __, __ },
+	{ __, __, __, __, __, __, __, __, __, __, __, __, 15, __, __, __ },
+};
+#undef __
+
+/* Whether all 16 characters are digits, i.e. from '!' to 'y' */
+__attribute__((target("sse4.1")))
+static inline bool all_digits_sse41(__m128i c)
+{
+	const __m128i limit = _mm_set1_epi8('y' - '!');
+
+	c = _mm_sub_epi8(c, _mm_set1_epi8('!'));
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(c, limit),
+						limit)) == 0xffff;
+}
+
+__attribute__((target("sse4.1")))
+static size_t decode_sse41(const char *in, size_t len, uint32_t *out)
+{
+	const char *end = in + len;
+	size_t count = 0;
+	int n;
+
+	while (end - in >= 20) {
+		__m128i lo = _mm_loadu_si128((const __m128i *)in);
+		__m128i hi = _mm_loadu_si128((const __m128i *)(in + 4));
+		__m128i v;
+
+		if (!all_digits_sse41(lo) || !all_digits_sse41(hi)) {
+			n = decode_step(in, end, &out[count]);
+			if (n == 0)
+				return count;
+
+			in += n;
+			count++;
+			continue;
+		}
+
+		lo = _mm_sub_epi8(lo, _mm_set1_epi8('!'));
+		hi = _mm_sub_epi8(hi, _mm_set1_epi8('!'));
+
+		v = _mm_setzero_si128();
+		for (int i = 0; i < 5; i++) {
+			__m128i d;
+
+			d = _mm_or_si128(_mm_shuffle_epi8(lo, _mm_loadu_si128((const __m128i *)digit_lo[i])),
+					 _mm_shuffle_epi8(hi, _mm_loadu_si128((const __m128i *)digit_hi[i])));
+			v = _mm_add_epi32(_mm_mullo_epi32(v, _mm_set1_epi32(85)), d);
+		}
+
+		_mm_storeu_si128((__m128i *)&out[count], v);
+		count += 4;
+		in += 20;
+	}
+
+	return count + igt_ascii85_decode_generic(in, end - in, &out[count]);
+}
+
+/* As decode_sse41(), with eight groups at a time, four per 128 bit lane */
+__attribute__((target("avx2")))
+static size_t decode_avx2(const char *in, size_t len, uint32_t *out)
+{
+	const __m256i limit = _mm256_set1_epi8('y' - '!');
+	const char *end = in + len;
+	size_t count = 0;
+	int n;
+
+	while (end - in >= 40) {
+		__m256i lo = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)in)),
+						     _mm_loadu_si128((const __m128i *)(in + 20)), 1);
+		__m256i hi = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(in + 4))),
+						     _mm_loadu_si128((const __m128i *)(in + 24)), 1);
+		__m256i v, ok;
+
+		lo = _mm256_sub_epi8(lo, _mm256_set1_epi8('!'));
+		hi = _mm256_sub_epi8(hi, _mm256_set1_epi8('!'));
+		ok = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(lo, limit), limit),
+				      _mm256_cmpeq_epi8(_mm256_max_epu8(hi, limit), limit));
+		if (_mm256_movemask_epi8(ok) != -1) {
+			n = decode_step(in, end, &out[count]);
+			if (n == 0)
+				return count;
+
+			in += n;
+			count++;
+			continue;
+		}
+
+		v = _mm256_setzero_si256();
+		for (int i = 0; i < 5; i++) {
+			__m256i d;
+
+			d = _mm256_or_si256(_mm256_shuffle_epi8(lo, _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)digit_lo[i]))),
+					    _mm256_shuffle_epi8(hi, _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)digit_hi[i]))));
+			v = _mm256_add_epi32(_mm256_mullo_epi32(v, _mm256_set1_epi32(85)), d);
+		}
+
+		_mm256_storeu_si256((__m256i *)&out[count], v);
+		count += 8;
+		in += 40;
+	}
+
+	return count + decode_sse41(in, end - in, &out[count]);
+}
+#endif
+
+/**
+ * igt_ascii85_decode:
+ * @in: ascii85 encoded input
+ * @len: length of @in
+ * @out: output, with room for igt_ascii85_max_dwords(@len) dwords
+ *
+ * Decodes @in up to its first character that is not part of an ascii85
+ * stream, or up to @len characters. A trailing partial group is ignored.
+ *
+ * Returns: the number of dwords written to @out
+ */
+size_t igt_ascii85_decode(const char *in, size_t len, uint32_t *out)
+{
+#ifdef HAVE_ASCII85_SIMD
+	if (__builtin_cpu_supports("avx2"))
+		return decode_avx2(in, len, out);
+	if (__builtin_cpu_supports("sse4.1"))
+		return decode_sse41(in, len, out);
+#endif
+
+	return igt_ascii85_decode_generic(in, len, out);
+}
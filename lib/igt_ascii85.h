@@ -0,0 +1,47 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef __IGT_ASCII85_H__
+#define __IGT_ASCII85_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * igt_ascii85_max_dwords:
+ * @len: length of the ascii85 input, in characters
+ *
+ * Returns: the number of dwords to allocate for the output of
+ * igt_ascii85_decode() on @len characters of input, as each 'z'
+ * expands to a whole dword.
+ */
+static inline size_t igt_ascii85_max_dwords(size_t len)
+{
+	return len;
+}
+
+size_t igt_ascii85_decode(const char *in, size_t len, uint32_t *out);
+size_t igt_ascii85_decode_generic(const char *in, size_t len, uint32_t *out);
+
+#endif /* __IGT_ASCII85_H__ */
@@ -0,0 +1,321 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "igt_core.h"
+#include "igt_sampler.h"
+#include "intel_io.h"
+
+/**
+ * SECTION:igt_sampler
+ * @short_description: Periodic register sampling
+ * @title: Sampler
+ * @include: igt.h
+ *
+ * A sampler reads a set of registers at a fixed period from a thread of its
+ * own, optionally pinned to a cpu, and timestamps each sample. The samples
+ * are queued in a single producer, single consumer ring without any locking,
+ * from which one consumer thread collects them with igt_sampler_drain() at
+ * its leisure, as long as it keeps up with the ring size.
+ *
+ * Registers are read with INREG() by default, so the sampler works the same
+ * on a device mapped with intel_register_access_init() and on a register
+ * dump loaded with intel_mmio_use_dump_file().
+ *
+ * |[
+ *	static const uint32_t regs[] = { 0x2030, 0x2034 };
+ *	igt_sampler_config_t config = {
+ *		.regs = regs,
+ *		.num_regs = 2,
+ *		.period_ns = 100000,
+ *		.cpu = -1,
+ *	};
+ *	igt_sample_t samples[256];
+ *	igt_sampler_t *sampler;
+ *	unsigned int n;
+ *
+ *	sampler = igt_sampler_start(&config);
+ *	for (;;) {
+ *		usleep(10000);
+ *		n = igt_sampler_drain(sampler, samples, 256);
+ *		...
+ *	}
+ *	igt_sampler_stop(sampler);
+ * ]|
+ */
+
+#define DEFAULT_RING_SIZE 4096
+
+struct igt_sampler {
+	uint32_t regs[IGT_SAMPLER_MAX_REGS];
+	unsigned int num_regs;
+	uint64_t period_ns;
+	igt_sampler_read_t read;
+	void *data;
+	int cpu;
+
+	igt_sample_t *ring;
+	uint64_t mask;
+	pthread_t thread;
+
+	/* Written by the sampling thread only, the counts are just reported */
+	uint64_t head __attribute__((aligned(64)));
+	uint64_t dropped;
+	uint64_t missed;
+
+	/* Written by the consumer only */
+	uint64_t tail __attribute__((aligned(64)));
+	bool stop;
+
+	/* Set once by the sampling thread: 1 if running, -errno if it failed */
+	int status;
+};
+
+static uint32_t mmio_read(void *data, uint32_t reg)
+{
+	return INREG(reg);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *sampler_thread(void *arg)
+{
+	igt_sampler_t *sampler = arg;
+	uint64_t head = 0, deadline, now;
+	struct timespec ts;
+	unsigned int i;
+
+	/*
+	 * The thread pins itself, as bionic has no
+	 * pthread_attr_setaffinity_np().
+	 */
+	if (sampler->cpu >= 0) {
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(sampler->cpu, &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus)) {
+			__atomic_store_n(&sampler->status, -errno,
+					 __ATOMIC_RELEASE);
+			return NULL;
+		}
+	}
+	__atomic_store_n(&sampler->status, 1, __ATOMIC_RELEASE);
+
+	deadline = now_ns();
+	while (!__atomic_load_n(&sampler->stop, __ATOMIC_RELAXED)) {
+		if (head - __atomic_load_n(&sampler->tail, __ATOMIC_ACQUIRE) >
+		    sampler->mask) {
+			/* Keep what hasn't been drained yet, lose the new one */
+			__atomic_add_fetch(&sampler->dropped, 1,
+					   __ATOMIC_RELAXED);
+		} else {
+			igt_sample_t *sample = &sampler->ring[head & sampler->mask];
+
+			sample->timestamp = now_ns();
+			for (i = 0; i < sampler->num_regs; i++)
+				sample->values[i] = sampler->read(sampler->data,
+								  sampler->regs[i]);
+
+			__atomic_store_n(&sampler->head, ++head,
+					 __ATOMIC_RELEASE);
+		}
+
+		/*
+		 * Stay on the grid of periods from the start, skipping those
+		 * we overran rather than catching up with a burst of samples.
+		 */
+		deadline += sampler->period_ns;
+		now = now_ns();
+		if (now > deadline) {
+			uint64_t missed = (now - deadline) / sampler->period_ns + 1;
+
+			__atomic_add_fetch(&sampler->missed, missed,
+					   __ATOMIC_RELAXED);
+			deadline += missed * sampler->period_ns;
+		}
+
+		ts.tv_sec = deadline / 1000000000;
+		ts.tv_nsec = deadline % 1000000000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+				       &ts, NULL) == EINTR)
+			;
+	}
+
+	return NULL;
+}
+
+/**
+ * igt_sampler_start:
+ * @config: what to sample and how often
+ *
+ * Creates a sampler for the registers of @config and starts its thread,
+ * which takes the first sample straight away. @config is not used after this
+ * returns.
+ *
+ * Returns: the new sampler, or NULL with errno set if the thread couldn't be
+ * created or pinned, for instance because @config.cpu isn't online.
+ */
+igt_sampler_t *igt_sampler_start(const igt_sampler_config_t *config)
+{
+	igt_sampler_t *sampler;
+	uint64_t size;
+	void *ptr;
+	int err;
+
+	igt_assert(config->num_regs <= IGT_SAMPLER_MAX_REGS);
+	igt_assert(config->period_ns);
+
+	if (config->cpu >= CPU_SETSIZE) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (posix_memalign(&ptr, 64, sizeof(*sampler)))
+		return NULL;
+	sampler = ptr;
+	memset(sampler, 0, sizeof(*sampler));
+
+	memcpy(sampler->regs, config->regs,
+	       config->num_regs * sizeof(*config->regs));
+	sampler->num_regs = config->num_regs;
+	sampler->period_ns = config->period_ns;
+	sampler->read = config->read ?: mmio_read;
+	sampler->data = config->data;
+	sampler->cpu = config->cpu;
+
+	size = config->ring_size ?: DEFAULT_RING_SIZE;
+	for (sampler->mask = 1; sampler->mask < size; sampler->mask <<= 1)
+		;
+	sampler->ring = calloc(sampler->mask, sizeof(*sampler->ring));
+	sampler->mask--;
+	if (sampler->ring == NULL) {
+		free(sampler);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	err = pthread_create(&sampler->thread, NULL, sampler_thread, sampler);
+	if (err == 0) {
+		/* Only as long as it takes the thread to pin itself */
+		while ((err = __atomic_load_n(&sampler->status,
+					      __ATOMIC_ACQUIRE)) == 0)
+			sched_yield();
+
+		if (err < 0) {
+			pthread_join(sampler->thread, NULL);
+			err = -err;
+		} else {
+			err = 0;
+		}
+	}
+	if (err) {
+		free(sampler->ring);
+		free(sampler);
+		errno = err;
+		return NULL;
+	}
+
+	return sampler;
+}
+
+/**
+ * igt_sampler_drain:
+ * @sampler: a sampler from igt_sampler_start()
+ * @samples: where to copy the samples to
+ * @max: the number of entries in @samples
+ *
+ * Takes the oldest samples out of the ring, in the order they were taken.
+ * Only one thread may drain a sampler. Once the ring is full the sampler
+ * drops new samples until it is drained again, see igt_sampler_get_dropped().
+ *
+ * Returns: the number of samples copied to @samples
+ */
+unsigned int igt_sampler_drain(igt_sampler_t *sampler,
+			       igt_sample_t *samples, unsigned int max)
+{
+	uint64_t tail = sampler->tail;
+	uint64_t head = __atomic_load_n(&sampler->head, __ATOMIC_ACQUIRE);
+	unsigned int n = 0;
+
+	while (tail != head && n < max)
+		samples[n++] = sampler->ring[tail++ & sampler->mask];
+
+	__atomic_store_n(&sampler->tail, tail, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+/**
+ * igt_sampler_get_dropped:
+ * @sampler: a sampler from igt_sampler_start()
+ *
+ * Returns: the number of samples not taken so far because the ring was full
+ */
+uint64_t igt_sampler_get_dropped(igt_sampler_t *sampler)
+{
+	return __atomic_load_n(&sampler->dropped, __ATOMIC_RELAXED);
+}
+
+/**
+ * igt_sampler_get_missed:
+ * @sampler: a sampler from igt_sampler_start()
+ *
+ * Returns: the number of periods skipped so far because sampling overran
+ * them, e.g. as the thread was scheduled out or the reads took too long
+ */
+uint64_t igt_sampler_get_missed(igt_sampler_t *sampler)
+{
+	return __atomic_load_n(&sampler->missed, __ATOMIC_RELAXED);
+}
+
+/**
+ * igt_sampler_stop:
+ * @sampler: a sampler from igt_sampler_start()
+ *
+ * Stops the sampling thread, which may take up to a period, and frees
+ * @sampler along with any samples not drained yet.
+ */
+void igt_sampler_stop(igt_sampler_t *sampler)
+{
+	__atomic_store_n(&sampler->stop, true, __ATOMIC_RELAXED);
+	pthread_join(sampler->thread, NULL);
+
+	free(sampler->ring);
+	free(sampler);
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef __IGT_SAMPLER_H__
+#define __IGT_SAMPLER_H__
+
+#include <stdint.h>
+
+/**
+ * IGT_SAMPLER_MAX_REGS:
+ *
+ * The maximum number of registers read for each sample.
+ */
+#define IGT_SAMPLER_MAX_REGS 16
+
+/**
+ * igt_sample_t:
+ * @timestamp: CLOCK_MONOTONIC time in nanoseconds the sample was taken at
+ * @values: the register values, in the order of #igt_sampler_config_t.regs
+ */
+typedef struct {
+	uint64_t timestamp;
+	uint32_t values[IGT_SAMPLER_MAX_REGS];
+} igt_sample_t;
+
+/**
+ * igt_sampler_read_t:
+ * @data: #igt_sampler_config_t.data
+ * @reg: the register offset
+ *
+ * Reads one register for the sampler, from the sampling thread.
+ *
+ * Returns: the value of @reg
+ */
+typedef uint32_t (*igt_sampler_read_t)(void *data, uint32_t reg);
+
+/**
+ * igt_sampler_config_t:
+ * @regs: the register offsets to read for each sample
+ * @num_regs: the number of entries in @regs, at most #IGT_SAMPLER_MAX_REGS
+ * @period_ns: the time between samples
+ * @ring_size: the number of samples buffered until drained, rounded up to a
+ *	power of two, or 0 for 4096
+ * @cpu: the cpu to pin the sampling thread to, or -1 to leave it unpinned
+ * @read: how to read a register, or NULL to use INREG()
+ * @data: passed to @read
+ */
+typedef struct {
+	const uint32_t *regs;
+	unsigned int num_regs;
+	uint64_t period_ns;
+	unsigned int ring_size;
+	int cpu;
+	igt_sampler_read_t read;
+	void *data;
+} igt_sampler_config_t;
+
+typedef struct igt_sampler igt_sampler_t;
+
+igt_sampler_t *igt_sampler_start(const igt_sampler_config_t *config);
+unsigned int igt_sampler_drain(igt_sampler_t *sampler,
+			       igt_sample_t *samples, unsigned int max);
+uint64_t igt_sampler_get_dropped(igt_sampler_t *sampler);
+uint64_t igt_sampler_get_missed(igt_sampler_t *sampler);
+void igt_sampler_stop(igt_sampler_t *sampler);
+
+#endif /* __IGT_SAMPLER_H__ */
@@ -34,6 +34,15 @@
 #define sorted_value(stats, i) (stats->is_float ? stats->sorted_f[i] : stats->sorted_u64[i])
 #define unsorted_value(stats, i) (stats->is_float ? stats->values_f[i] : stats->values_u64[i])
 
+/*
+ * A sketch counts values in buckets of IGT_STATS_SKETCH_BITS significant
+ * bits, log-linear like an HDR histogram: below SKETCH_EXACT each value has
+ * a bucket of its own, above it each power of two is split into
+ * 2^IGT_STATS_SKETCH_BITS buckets.
+ */
+#define SKETCH_EXACT	(2u << IGT_STATS_SKETCH_BITS)
+#define SKETCH_BUCKETS	((65 - IGT_STATS_SKETCH_BITS) << IGT_STATS_SKETCH_BITS)
+
 /**
  * SECTION:igt_stats
  * @short_description: Tools for statistical analysis
@@ -64,6 +73,11 @@
  *
  *	igt_stats_fini(&stats);
  * ]|
+ *
+ * For a running view of a stream of samples, #igt_window_t keeps statistics
+ * over the last N samples or the last T nanoseconds, and #igt_decay_t over
+ * exponentially decaying weights. Neither allocates memory as samples are
+ * pushed, and pushing takes constant (amortized) time.
  */
 
 static unsigned int get_new_capacity(int need)
@@ -91,10 +105,14 @@ static void igt_stats_ensure_capacity(igt_stats_t *stats,
 				    sizeof(*stats->values_u64) * new_capacity);
 	igt_assert(stats->values_u64);
 
-	stats->capacity = new_capacity;
+	/* What is sorted already stays sorted */
+	if (stats->sorted_u64) {
+		stats->sorted_u64 = realloc(stats->sorted_u64,
+					    sizeof(*stats->sorted_u64) * new_capacity);
+		igt_assert(stats->sorted_u64);
+	}
 
-	free(stats->sorted_u64);
-	stats->sorted_u64 = NULL;
+	stats->capacity = new_capacity;
 }
 
 /**
@@ -137,6 +155,35 @@ void igt_stats_init_with_size(igt_stats_t *stats, unsigned int capacity)
 	stats->range[1] = -HUGE_VAL;
 }
 
+/**
+ * igt_stats_init_sketch:
+ * @stats: An #igt_stats_t instance
+ *
+ * Like igt_stats_init() but rather than keeping every value, @stats only
+ * counts them in buckets, taking the same memory (about 58KiB) however many
+ * values are pushed, and queries don't need to sort anything.
+ *
+ * The minimum, maximum, mean and variance stay exact. The median, quartiles,
+ * IQR, IQM and trimean are approximate: each order statistic they are made
+ * of is off by less than 1/2^(#IGT_STATS_SKETCH_BITS + 1), 0.4%, of its value,
+ * and is exact below 2^(#IGT_STATS_SKETCH_BITS + 1), 256.
+ *
+ * Only integer values can be pushed to a sketch.
+ *
+ * igt_stats_fini() must be called once finished with @stats.
+ */
+void igt_stats_init_sketch(igt_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	stats->buckets = calloc(SKETCH_BUCKETS, sizeof(*stats->buckets));
+	igt_assert(stats->buckets);
+	stats->is_sketch = true;
+
+	stats->min = U64_MAX;
+	stats->max = 0;
+}
+
 /**
  * igt_stats_fini:
  * @stats: An #igt_stats_t instance
@@ -147,6 +194,7 @@ void igt_stats_fini(igt_stats_t *stats)
 {
 	free(stats->values_u64);
 	free(stats->sorted_u64);
+	free(stats->buckets);
 }
 
 
@@ -198,6 +246,93 @@ void igt_stats_set_population(igt_stats_t *stats, bool full_population)
 	stats->mean_variance_valid = false;
 }
 
+static unsigned int sketch_bucket(uint64_t value)
+{
+	unsigned int shift;
+
+	if (value < SKETCH_EXACT)
+		return value;
+
+	shift = 63 - __builtin_clzll(value) - IGT_STATS_SKETCH_BITS;
+	return (shift << IGT_STATS_SKETCH_BITS) + (value >> shift);
+}
+
+/* The middle of the values counted in @bucket, within what was pushed */
+static double sketch_bucket_value(igt_stats_t *stats, unsigned int bucket)
+{
+	unsigned int shift;
+	double value;
+
+	if (bucket < SKETCH_EXACT)
+		return bucket;
+
+	shift = (bucket >> IGT_STATS_SKETCH_BITS) - 1;
+	value = (uint64_t)(bucket - (shift << IGT_STATS_SKETCH_BITS)) << shift;
+	value += ((1ull << shift) - 1) / 2.;
+
+	if (value < stats->min)
+		return stats->min;
+	if (value > stats->max)
+		return stats->max;
+	return value;
+}
+
+static void igt_stats_sketch_push(igt_stats_t *stats, uint64_t value)
+{
+	double delta = value - stats->mean;
+
+	stats->buckets[sketch_bucket(value)]++;
+	stats->n_values++;
+
+	/* Welford's online mean and variance, as the values are gone */
+	stats->mean += delta / stats->n_values;
+	stats->m2 += delta * (value - stats->mean);
+	stats->mean_variance_valid = false;
+
+	if (value < stats->min)
+		stats->min = value;
+	if (value > stats->max)
+		stats->max = value;
+}
+
+/* The value at @rank, counting from 0, as the sorted array would have it */
+static double igt_stats_sketch_value(igt_stats_t *stats, unsigned int rank)
+{
+	uint64_t seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < SKETCH_BUCKETS - 1; i++) {
+		seen += stats->buckets[i];
+		if (seen > rank)
+			break;
+	}
+
+	return sketch_bucket_value(stats, i);
+}
+
+/* The mean of the values from rank @first to @last, inclusive */
+static double igt_stats_sketch_mean(igt_stats_t *stats,
+				    unsigned int first, unsigned int last)
+{
+	uint64_t seen = 0;
+	double sum = 0.;
+	unsigned int i;
+
+	for (i = 0; i < SKETCH_BUCKETS && seen <= last; i++) {
+		uint64_t lo = seen > first ? seen : first;
+		uint64_t hi = seen + stats->buckets[i];
+
+		if (hi > (uint64_t)last + 1)
+			hi = (uint64_t)last + 1;
+		if (hi > lo)
+			sum += (hi - lo) * sketch_bucket_value(stats, i);
+
+		seen += stats->buckets[i];
+	}
+
+	return sum / (last - first + 1);
+}
+
 /**
  * igt_stats_push:
  * @stats: An #igt_stats_t instance
@@ -212,12 +347,16 @@ void igt_stats_push(igt_stats_t *stats, uint64_t value)
 		return;
 	}
 
+	if (stats->is_sketch) {
+		igt_stats_sketch_push(stats, value);
+		return;
+	}
+
 	igt_stats_ensure_capacity(stats, 1);
 
 	stats->values_u64[stats->n_values++] = value;
 
 	stats->mean_variance_valid = false;
-	stats->sorted_array_valid = false;
 
 	if (value < stats->min)
 		stats->min = value;
@@ -235,6 +374,8 @@ void igt_stats_push(igt_stats_t *stats, uint64_t value)
  */
 void igt_stats_push_float(igt_stats_t *stats, double value)
 {
+	igt_assert(!stats->is_sketch);
+
 	igt_stats_ensure_capacity(stats, 1);
 
 	if (!stats->is_float) {
@@ -243,13 +384,16 @@ void igt_stats_push_float(igt_stats_t *stats, double value)
 		for (n = 0; n < stats->n_values; n++)
 			stats->values_f[n] = stats->values_u64[n];
 
+		/* the conversion keeps the order */
+		for (n = 0; n < stats->n_sorted; n++)
+			stats->sorted_f[n] = stats->sorted_u64[n];
+
 		stats->is_float = true;
 	}
 
 	stats->values_f[stats->n_values++] = value;
 
 	stats->mean_variance_valid = false;
-	stats->sorted_array_valid = false;
 
 	if (value < stats->range[0])
 		stats->range[0] = value;
@@ -268,12 +412,30 @@ void igt_stats_push_float(igt_stats_t *stats, double value)
 void igt_stats_push_array(igt_stats_t *stats,
 			  const uint64_t *values, unsigned int n_values)
 {
+	uint64_t min, max;
 	unsigned int i;
 
+	if (stats->is_float || stats->is_sketch) {
+		for (i = 0; i < n_values; i++)
+			igt_stats_push(stats, values[i]);
+		return;
+	}
+
 	igt_stats_ensure_capacity(stats, n_values);
 
-	for (i = 0; i < n_values; i++)
-		igt_stats_push(stats, values[i]);
+	memcpy(stats->values_u64 + stats->n_values, values,
+	       n_values * sizeof(*values));
+	stats->n_values += n_values;
+	stats->mean_variance_valid = false;
+
+	min = stats->min;
+	max = stats->max;
+	for (i = 0; i < n_values; i++) {
+		min = values[i] < min ? values[i] : min;
+		max = values[i] > max ? values[i] : max;
+	}
+	stats->min = min;
+	stats->max = max;
 }
 
 /**
@@ -338,30 +500,88 @@ static int cmp_f(const void *pa, const void *pb)
 	return 0;
 }
 
+/*
+ * Merges the sorted @new values into the @n sorted ones of @sorted, from the
+ * end so that only the sorted values larger than the smallest new one move.
+ */
+static void merge_u64(uint64_t *sorted, unsigned int n,
+		      const uint64_t *new, unsigned int n_new)
+{
+	uint64_t *dst = sorted + n + n_new;
+
+	while (n_new) {
+		if (n && sorted[n - 1] > new[n_new - 1])
+			*--dst = sorted[--n];
+		else
+			*--dst = new[--n_new];
+	}
+}
+
+static void merge_f(double *sorted, unsigned int n,
+		    const double *new, unsigned int n_new)
+{
+	double *dst = sorted + n + n_new;
+
+	while (n_new) {
+		if (n && sorted[n - 1] > new[n_new - 1])
+			*--dst = sorted[--n];
+		else
+			*--dst = new[--n_new];
+	}
+}
+
+/*
+ * The sorted array is kept up to date lazily: the values pushed since the
+ * last query are sorted on their own and merged in, rather than sorting
+ * everything again.
+ */
 static void igt_stats_ensure_sorted_values(igt_stats_t *stats)
 {
-	if (stats->sorted_array_valid)
+	unsigned int n_new = stats->n_values - stats->n_sorted;
+	uint64_t *new;
+
+	if (n_new == 0 || stats->is_sketch)
 		return;
 
 	if (!stats->sorted_u64) {
-		/*
-		 * igt_stats_ensure_capacity() will free ->sorted when the
-		 * capacity increases, which also correspond to an invalidation
-		 * of the sorted array. We'll then reallocate it here on
-		 * demand.
-		 */
 		stats->sorted_u64 = calloc(stats->capacity,
 					   sizeof(*stats->values_u64));
 		igt_assert(stats->sorted_u64);
 	}
 
-	memcpy(stats->sorted_u64, stats->values_u64,
-	       sizeof(*stats->values_u64) * stats->n_values);
+	if (stats->n_sorted == 0) {
+		memcpy(stats->sorted_u64, stats->values_u64,
+		       sizeof(*stats->values_u64) * stats->n_values);
+		qsort(stats->sorted_u64, stats->n_values,
+		      sizeof(*stats->values_u64),
+		      stats->is_float ? cmp_f : cmp_u64);
+		stats->n_sorted = stats->n_values;
+		return;
+	}
 
-	qsort(stats->sorted_u64, stats->n_values, sizeof(*stats->values_u64),
-	      stats->is_float ? cmp_f : cmp_u64);
+	new = malloc(sizeof(*new) * n_new);
+	igt_assert(new);
+	memcpy(new, stats->values_u64 + stats->n_sorted, sizeof(*new) * n_new);
 
-	stats->sorted_array_valid = true;
+	if (stats->is_float) {
+		qsort(new, n_new, sizeof(*new), cmp_f);
+		merge_f(stats->sorted_f, stats->n_sorted,
+			(const double *)new, n_new);
+	} else {
+		qsort(new, n_new, sizeof(*new), cmp_u64);
+		merge_u64(stats->sorted_u64, stats->n_sorted, new, n_new);
+	}
+
+	free(new);
+	stats->n_sorted = stats->n_values;
+}
+
+static double igt_stats_get_sorted_value(igt_stats_t *stats, unsigned int i)
+{
+	if (stats->is_sketch)
+		return igt_stats_sketch_value(stats, i);
+
+	return sorted_value(stats, i);
 }
 
 /*
@@ -383,7 +603,7 @@ igt_stats_get_median_internal(igt_stats_t *stats,
 	if (n_values % 2 == 1) {
 		/* median is the value in the middle (actual datum) */
 		mid = start + n_values / 2;
-		median = sorted_value(stats, mid);
+		median = igt_stats_get_sorted_value(stats, mid);
 
 		/* the two halves contain the median value */
 		if (lower_end)
@@ -399,7 +619,8 @@ igt_stats_get_median_internal(igt_stats_t *stats,
 		 * values.
 		 */
 		mid = start + n_values / 2 - 1;
-		median = (sorted_value(stats, mid) + sorted_value(stats, mid+1))/2.;
+		median = (igt_stats_get_sorted_value(stats, mid) +
+			  igt_stats_get_sorted_value(stats, mid+1))/2.;
 
 		if (lower_end)
 			*lower_end = mid + 1;
@@ -486,20 +707,76 @@ double igt_stats_get_median(igt_stats_t *stats)
  * 3rd edn., p. 232. Boston: Addison-Wesley
  *
  * Source: https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance
+ *
+ * applied to blocks of values rather than single ones: the mean and M2 of a
+ * block are computed in two passes, without a division per value, and are
+ * merged into the totals with the parallel variant of Chan et al. The sums
+ * are still plain scalar loops, the compiler may not reorder them without
+ * -ffast-math.
  */
+#define MEAN_VARIANCE_BLOCK 256
+
+static void block_mean_m2_u64(const uint64_t *values, unsigned int n,
+			      double *mean, double *m2)
+{
+	double sum = 0., sum2 = 0.;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		sum += values[i];
+	*mean = sum / n;
+
+	for (i = 0; i < n; i++)
+		sum2 += (values[i] - *mean) * (values[i] - *mean);
+	*m2 = sum2;
+}
+
+static void block_mean_m2_f(const double *values, unsigned int n,
+			    double *mean, double *m2)
+{
+	double sum = 0., sum2 = 0.;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		sum += values[i];
+	*mean = sum / n;
+
+	for (i = 0; i < n; i++)
+		sum2 += (values[i] - *mean) * (values[i] - *mean);
+	*m2 = sum2;
+}
+
 static void igt_stats_knuth_mean_variance(igt_stats_t *stats)
 {
 	double mean = 0., m2 = 0.;
-	unsigned int i;
+	unsigned int i, n;
 
 	if (stats->mean_variance_valid)
 		return;
 
-	for (i = 0; i < stats->n_values; i++) {
-		double delta = unsorted_value(stats, i) - mean;
-
-		mean += delta / (i + 1);
-		m2 += delta * (unsorted_value(stats, i) - mean);
+	if (stats->is_sketch) {
+		/* already done as the values were pushed */
+		mean = stats->mean;
+		m2 = stats->m2;
+	} else {
+		for (i = 0; i < stats->n_values; i += n) {
+			double block_mean, block_m2, delta;
+
+			n = stats->n_values - i;
+			if (n > MEAN_VARIANCE_BLOCK)
+				n = MEAN_VARIANCE_BLOCK;
+
+			if (stats->is_float)
+				block_mean_m2_f(stats->values_f + i, n,
+						&block_mean, &block_m2);
+			else
+				block_mean_m2_u64(stats->values_u64 + i, n,
+						  &block_mean, &block_m2);
+
+			delta = block_mean - mean;
+			mean += delta * n / (i + n);
+			m2 += block_m2 + delta * delta * i * n / (i + n);
+		}
 	}
 
 	stats->mean = mean;
@@ -573,9 +850,14 @@ double igt_stats_get_iqm(igt_stats_t *stats)
 	q1 = (stats->n_values + 3) / 4;
 	q3 = 3 * stats->n_values / 4;
 
-	mean = 0;
-	for (i = 0; i <= q3 - q1; i++)
-		mean += (sorted_value(stats, q1 + i) - mean) / (i + 1);
+	if (stats->is_sketch) {
+		mean = igt_stats_sketch_mean(stats, q1, q3);
+		i = q3 - q1 + 1;
+	} else {
+		mean = 0;
+		for (i = 0; i <= q3 - q1; i++)
+			mean += (sorted_value(stats, q1 + i) - mean) / (i + 1);
+	}
 
 	if (stats->n_values % 4) {
 		double rem = .5 * (stats->n_values % 4) / 4;
@@ -583,8 +865,8 @@ double igt_stats_get_iqm(igt_stats_t *stats)
 		q1 = (stats->n_values) / 4;
 		q3 = (3 * stats->n_values + 3) / 4;
 
-		mean += rem * (sorted_value(stats, q1) - mean) / i++;
-		mean += rem * (sorted_value(stats, q3) - mean) / i++;
+		mean += rem * (igt_stats_get_sorted_value(stats, q1) - mean) / i++;
+		mean += rem * (igt_stats_get_sorted_value(stats, q3) - mean) / i++;
 	}
 
 	return mean;
@@ -606,3 +888,391 @@ double igt_stats_get_trimean(igt_stats_t *stats)
 	igt_stats_get_quartiles(stats, &q1, &q2, &q3);
 	return (q1 + 2*q2 + q3) / 4;
 }
+
+/* Bucket 0 is [0, 1), bucket i is [2^(i - 1), 2^i) */
+static unsigned int histogram_bucket(double value)
+{
+	int exp;
+
+	if (value < 1.)
+		return 0;
+
+	frexp(value, &exp);
+	return exp;
+}
+
+static unsigned int histogram_add(uint64_t *counts, unsigned int n_buckets,
+				  unsigned int used, double value,
+				  uint64_t count)
+{
+	unsigned int bucket = histogram_bucket(value);
+
+	if (bucket >= n_buckets)
+		bucket = n_buckets - 1;
+
+	counts[bucket] += count;
+
+	return bucket >= used ? bucket + 1 : used;
+}
+
+/**
+ * igt_stats_get_histogram:
+ * @stats: An #igt_stats_t instance
+ * @counts: (array length=n_buckets): where to store the histogram
+ * @n_buckets: the number of entries in @counts
+ *
+ * Counts the values of @stats in buckets of powers of two: @counts[0] gets
+ * the number of values below 1 and @counts[i] those from 2^(i - 1) up to
+ * 2^i excluded. Values beyond the last bucket are counted in it; with
+ * #IGT_STATS_HISTOGRAM_BUCKETS buckets there are none.
+ *
+ * Returns: the number of buckets up to the last one not empty
+ */
+unsigned int igt_stats_get_histogram(igt_stats_t *stats,
+				     uint64_t *counts, unsigned int n_buckets)
+{
+	unsigned int i, used = 0;
+
+	igt_assert(n_buckets);
+	memset(counts, 0, n_buckets * sizeof(*counts));
+
+	if (stats->is_sketch) {
+		/* a bucket of the sketch doesn't straddle powers of two */
+		for (i = 0; i < SKETCH_BUCKETS; i++)
+			if (stats->buckets[i])
+				used = histogram_add(counts, n_buckets, used,
+						     sketch_bucket_value(stats, i),
+						     stats->buckets[i]);
+		return used;
+	}
+
+	for (i = 0; i < stats->n_values; i++)
+		used = histogram_add(counts, n_buckets, used,
+				     unsorted_value(stats, i), 1);
+
+	return used;
+}
+
+#define window_tail(w) (((w)->head + (w)->size - (w)->count) % (w)->size)
+
+/**
+ * igt_window_init:
+ * @window: An #igt_window_t instance
+ * @size: the number of samples in the window
+ * @max_age: how long samples stay in the window, in the unit of the
+ *	     timestamps given to igt_window_push(), or 0 for as long as there
+ *	     is room for them
+ *
+ * Initializes a window over the last @size samples pushed, and of those
+ * only the ones less than @max_age older than the last. All the memory it
+ * needs is allocated here. igt_window_fini() must be called once finished
+ * with @window.
+ */
+void igt_window_init(igt_window_t *window, unsigned int size,
+		     uint64_t max_age)
+{
+	igt_assert(size);
+
+	memset(window, 0, sizeof(*window));
+
+	window->samples = calloc(size, sizeof(*window->samples));
+	igt_assert(window->samples);
+	window->size = size;
+	window->max_age = max_age;
+}
+
+/**
+ * igt_window_fini:
+ * @window: An #igt_window_t instance
+ *
+ * Frees resources allocated in igt_window_init().
+ */
+void igt_window_fini(igt_window_t *window)
+{
+	free(window->samples);
+}
+
+static void igt_window_drop(igt_window_t *window)
+{
+	double delta = window->samples[window_tail(window)].value - window->shift;
+
+	window->sum -= delta;
+	window->sum2 -= delta * delta;
+	window->count--;
+}
+
+/*
+ * The sums are of the values less the shift, the oldest value when they
+ * were last summed up from scratch, which keeps the variance accurate for
+ * values far from 0. Summing them up again once per lap of the samples
+ * also stops rounding errors adding up.
+ */
+static void igt_window_resum(igt_window_t *window)
+{
+	unsigned int i, tail = window_tail(window);
+
+	window->shift = window->samples[tail].value;
+	window->sum = window->sum2 = 0.;
+
+	for (i = 0; i < window->count; i++) {
+		double delta = window->samples[(tail + i) % window->size].value -
+			       window->shift;
+
+		window->sum += delta;
+		window->sum2 += delta * delta;
+	}
+}
+
+/**
+ * igt_window_push:
+ * @window: An #igt_window_t instance
+ * @timestamp: when @value was sampled, not before the previous sample
+ * @value: the value
+ *
+ * Adds a sample to @window, dropping the oldest ones to make room for it
+ * and those now too old.
+ */
+void igt_window_push(igt_window_t *window, uint64_t timestamp, double value)
+{
+	double delta;
+
+	if (window->count == window->size)
+		igt_window_drop(window);
+
+	while (window->max_age && window->count &&
+	       timestamp - window->samples[window_tail(window)].timestamp >=
+	       window->max_age)
+		igt_window_drop(window);
+
+	if (window->count == 0) {
+		/* Start afresh rather than from what rounding left behind */
+		window->shift = value;
+		window->sum = window->sum2 = 0.;
+	}
+
+	window->samples[window->head].timestamp = timestamp;
+	window->samples[window->head].value = value;
+	window->head = (window->head + 1) % window->size;
+	window->count++;
+
+	delta = value - window->shift;
+	window->sum += delta;
+	window->sum2 += delta * delta;
+
+	if (window->head == 0)
+		igt_window_resum(window);
+}
+
+/**
+ * igt_window_get_count:
+ * @window: An #igt_window_t instance
+ *
+ * Returns: the number of samples in @window
+ */
+unsigned int igt_window_get_count(igt_window_t *window)
+{
+	return window->count;
+}
+
+/**
+ * igt_window_get_min:
+ * @window: An #igt_window_t instance
+ *
+ * Returns: the smallest sample in @window, 0 if it is empty
+ */
+double igt_window_get_min(igt_window_t *window)
+{
+	unsigned int i, tail = window_tail(window);
+	double min;
+
+	if (window->count == 0)
+		return 0.;
+
+	min = window->samples[tail].value;
+	for (i = 1; i < window->count; i++) {
+		double value = window->samples[(tail + i) % window->size].value;
+
+		if (value < min)
+			min = value;
+	}
+
+	return min;
+}
+
+/**
+ * igt_window_get_max:
+ * @window: An #igt_window_t instance
+ *
+ * Returns: the largest sample in @window, 0 if it is empty
+ */
+double igt_window_get_max(igt_window_t *window)
+{
+	unsigned int i, tail = window_tail(window);
+	double max;
+
+	if (window->count == 0)
+		return 0.;
+
+	max = window->samples[tail].value;
+	for (i = 1; i < window->count; i++) {
+		double value = window->samples[(tail + i) % window->size].value;
+
+		if (value > max)
+			max = value;
+	}
+
+	return max;
+}
+
+/**
+ * igt_window_get_mean:
+ * @window: An #igt_window_t instance
+ *
+ * Returns: the mean of the samples in @window, 0 if it is empty
+ */
+double igt_window_get_mean(igt_window_t *window)
+{
+	if (window->count == 0)
+		return 0.;
+
+	return window->shift + window->sum / window->count;
+}
+
+/**
+ * igt_window_get_variance:
+ * @window: An #igt_window_t instance
+ *
+ * Retrieves the variance of the samples in @window, as a sample of a bigger
+ * population, see igt_stats_set_population().
+ */
+double igt_window_get_variance(igt_window_t *window)
+{
+	double m2;
+
+	if (window->count < 2)
+		return 0.;
+
+	m2 = window->sum2 - window->sum * window->sum / window->count;
+	return m2 > 0. ? m2 / (window->count - 1) : 0.;
+}
+
+/**
+ * igt_window_get_std_deviation:
+ * @window: An #igt_window_t instance
+ *
+ * Retrieves the standard deviation of the samples in @window.
+ */
+double igt_window_get_std_deviation(igt_window_t *window)
+{
+	return sqrt(igt_window_get_variance(window));
+}
+
+/**
+ * igt_window_get_histogram:
+ * @window: An #igt_window_t instance
+ * @counts: (array length=n_buckets): where to store the histogram
+ * @n_buckets: the number of entries in @counts
+ *
+ * Like igt_stats_get_histogram(), for the samples in @window.
+ *
+ * Returns: the number of buckets up to the last one not empty
+ */
+unsigned int igt_window_get_histogram(igt_window_t *window,
+				      uint64_t *counts, unsigned int n_buckets)
+{
+	unsigned int i, used = 0, tail = window_tail(window);
+
+	igt_assert(n_buckets);
+	memset(counts, 0, n_buckets * sizeof(*counts));
+
+	for (i = 0; i < window->count; i++)
+		used = histogram_add(counts, n_buckets, used,
+				     window->samples[(tail + i) % window->size].value,
+				     1);
+
+	return used;
+}
+
+/**
+ * igt_decay_init:
+ * @decay: An #igt_decay_t instance
+ * @half_life: the age at which a sample weighs half as much as a new one, in
+ *	       the unit of the timestamps given to igt_decay_push()
+ *
+ * Initializes exponentially weighted statistics, where each sample weighs
+ * 2^(-age / @half_life). Nothing is allocated, so there is no fini.
+ */
+void igt_decay_init(igt_decay_t *decay, double half_life)
+{
+	igt_assert(half_life > 0.);
+
+	memset(decay, 0, sizeof(*decay));
+	decay->half_life = half_life;
+}
+
+/**
+ * igt_decay_push:
+ * @decay: An #igt_decay_t instance
+ * @timestamp: when @value was sampled, not before the previous sample
+ * @value: the value
+ *
+ * Adds a sample to @decay, with the weights of the previous ones decayed by
+ * the time elapsed since the last.
+ */
+void igt_decay_push(igt_decay_t *decay, uint64_t timestamp, double value)
+{
+	double delta = value - decay->mean;
+
+	/*
+	 * West's weighted incremental mean and variance, scaling the old
+	 * weights down first, which leaves the mean as it is.
+	 */
+	if (decay->weight > 0. && timestamp > decay->last) {
+		double factor = exp2(-(double)(timestamp - decay->last) /
+				     decay->half_life);
+
+		decay->weight *= factor;
+		decay->m2 *= factor;
+	}
+
+	decay->weight += 1.;
+	decay->mean += delta / decay->weight;
+	decay->m2 += delta * (value - decay->mean);
+	decay->last = timestamp;
+}
+
+/**
+ * igt_decay_get_mean:
+ * @decay: An #igt_decay_t instance
+ *
+ * Returns: the weighted mean of the samples, 0 if none was pushed
+ */
+double igt_decay_get_mean(igt_decay_t *decay)
+{
+	return decay->mean;
+}
+
+/**
+ * igt_decay_get_variance:
+ * @decay: An #igt_decay_t instance
+ *
+ * Returns: the weighted variance of the samples
+ */
+double igt_decay_get_variance(igt_decay_t *decay)
+{
+	if (decay->weight == 0.)
+		return 0.;
+
+	return decay->m2 / decay->weight;
+}
+
+/**
+ * igt_decay_get_std_deviation:
+ * @decay: An #igt_decay_t instance
+ *
+ * Returns: the weighted standard deviation of the samples
+ */
+double igt_decay_get_std_deviation(igt_decay_t *decay)
+{
+	return sqrt(igt_decay_get_variance(decay));
+}
@@ -33,6 +33,8 @@
  * @values_u64: An array containing pushed integer values
  * @values_f: An array containing pushed float values
  * @n_values: The number of pushed values
+ *
+ * The values arrays are NULL for a sketch, see igt_stats_init_sketch().
  */
 typedef struct {
 	union {
@@ -46,20 +48,33 @@ typedef struct {
 	unsigned int capacity;
 	unsigned int is_population  : 1;
 	unsigned int mean_variance_valid : 1;
-	unsigned int sorted_array_valid : 1;
+	unsigned int is_sketch : 1;
+	unsigned int n_sorted;
 
 	uint64_t min, max;
 	double range[2];
 	double mean, variance;
+	double m2;
 
 	union {
 		uint64_t *sorted_u64;
 		double *sorted_f;
 	};
+
+	uint64_t *buckets;
 } igt_stats_t;
 
+/**
+ * IGT_STATS_SKETCH_BITS:
+ *
+ * The number of significant bits each value keeps in a sketch, see
+ * igt_stats_init_sketch().
+ */
+#define IGT_STATS_SKETCH_BITS 7
+
 void igt_stats_init(igt_stats_t *stats);
 void igt_stats_init_with_size(igt_stats_t *stats, unsigned int capacity);
+void igt_stats_init_sketch(igt_stats_t *stats);
 void igt_stats_fini(igt_stats_t *stats);
 bool igt_stats_is_population(igt_stats_t *stats);
 void igt_stats_set_population(igt_stats_t *stats, bool full_population);
@@ -80,4 +95,62 @@ double igt_stats_get_median(igt_stats_t *stats);
 double igt_stats_get_variance(igt_stats_t *stats);
 double igt_stats_get_std_deviation(igt_stats_t *stats);
 
+/**
+ * IGT_STATS_HISTOGRAM_BUCKETS:
+ *
+ * The number of buckets needed for the whole histogram of 64-bit values, see
+ * igt_stats_get_histogram().
+ */
+#define IGT_STATS_HISTOGRAM_BUCKETS 65
+
+unsigned int igt_stats_get_histogram(igt_stats_t *stats,
+				     uint64_t *counts, unsigned int n_buckets);
+
+/**
+ * igt_window_t:
+ *
+ * Statistics over the last samples pushed, see igt_window_init().
+ */
+typedef struct {
+	/*< private >*/
+	struct {
+		uint64_t timestamp;
+		double value;
+	} *samples;
+	unsigned int size, head, count;
+	uint64_t max_age;
+	double shift, sum, sum2;
+} igt_window_t;
+
+void igt_window_init(igt_window_t *window, unsigned int size,
+		     uint64_t max_age);
+void igt_window_fini(igt_window_t *window);
+void igt_window_push(igt_window_t *window, uint64_t timestamp, double value);
+unsigned int igt_window_get_count(igt_window_t *window);
+double igt_window_get_min(igt_window_t *window);
+double igt_window_get_max(igt_window_t *window);
+double igt_window_get_mean(igt_window_t *window);
+double igt_window_get_variance(igt_window_t *window);
+double igt_window_get_std_deviation(igt_window_t *window);
+unsigned int igt_window_get_histogram(igt_window_t *window,
+				      uint64_t *counts, unsigned int n_buckets);
+
+/**
+ * igt_decay_t:
+ *
+ * Exponentially weighted statistics, see igt_decay_init().
+ */
+typedef struct {
+	/*< private >*/
+	double half_life;
+	uint64_t last;
+	double weight, mean, m2;
+} igt_decay_t;
+
+void igt_decay_init(igt_decay_t *decay, double half_life);
+void igt_decay_push(igt_decay_t *decay, uint64_t timestamp, double value);
+double igt_decay_get_mean(igt_decay_t *decay);
+double igt_decay_get_variance(igt_decay_t *decay);
+double igt_decay_get_std_deviation(igt_decay_t *decay);
+
 #endif /* __IGT_STATS_H__ */
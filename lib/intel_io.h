@@ -81,9 +81,12 @@ struct intel_register_map {
 	struct intel_register_range *map;
 	uint32_t top;
 	uint32_t alignment_mask;
+	uint32_t count; /* of ranges in map, sorted by base */
+	uint8_t *pages; /* range of each 4KiB page, see intel_reg_map.c */
 };
 struct intel_register_map intel_get_register_map(uint32_t devid);
 struct intel_register_range *intel_get_register_range(struct intel_register_map map, uint32_t offset, uint32_t mode);
+int intel_register_span_allowed(struct intel_register_map map, uint32_t offset, uint32_t size, uint32_t mode);
 #endif /* __GTK_DOC_IGNORE__ */
 
 #endif /* INTEL_GPU_TOOLS_H */
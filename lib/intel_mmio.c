@@ -77,6 +77,7 @@ static struct _mmio_data {
 	int inited;
 	bool safe;
 	uint32_t i915_devid;
+	int gen;
 	struct intel_register_map map;
 	int key;
 } mmio_data;
@@ -95,7 +96,8 @@ intel_mmio_use_dump_file(char *file)
 	int fd;
 	struct stat st;
 
-	fd = open(file, O_RDWR);
+	/* The mapping is private, so read-only snapshots will do. */
+	fd = open(file, O_RDONLY);
 	igt_fail_on_f(fd == -1,
 		      "Couldn't open %s\n", file);
 
@@ -178,8 +180,9 @@ intel_register_access_init(struct pci_device *pci_dev, int safe)
 	if (mmio_data.inited)
 		return -1;
 
-	mmio_data.safe = (safe != 0 &&
-			intel_gen(pci_dev->device_id) >= 4) ? true : false;
+	/* Looked up once, intel_gen() is too slow for every access. */
+	mmio_data.gen = intel_gen(pci_dev->device_id);
+	mmio_data.safe = (safe != 0 && mmio_data.gen >= 4) ? true : false;
 	mmio_data.i915_devid = pci_dev->device_id;
 	if (mmio_data.safe)
 		mmio_data.map = intel_get_register_map(mmio_data.i915_devid);
@@ -249,7 +252,7 @@ intel_register_read(uint32_t reg)
 
 	igt_assert(mmio_data.inited);
 
-	if (intel_gen(mmio_data.i915_devid) >= 6)
+	if (mmio_data.gen >= 6)
 		igt_assert(mmio_data.key != -1);
 
 	if (!mmio_data.safe)
@@ -289,7 +292,7 @@ intel_register_write(uint32_t reg, uint32_t val)
 
 	igt_assert(mmio_data.inited);
 
-	if (intel_gen(mmio_data.i915_devid) >= 6)
+	if (mmio_data.gen >= 6)
 		igt_assert(mmio_data.key != -1);
 
 	if (!mmio_data.safe)
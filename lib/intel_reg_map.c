@@ -127,35 +127,106 @@ static struct intel_register_range gen6_gt_register_map[] = {
 	{0x00000000, 0x00000000, INTEL_RANGE_END}
 };
 
+/*
+ * For each 4KiB page below the top of a map, the range covering all of it,
+ * or RANGE_PAGE_SPLIT if there's no single one and it takes a search.
+ */
+#define RANGE_PAGE_SHIFT 12
+#define RANGE_PAGE_SPLIT 0xff
+
+static uint8_t gen_bwcl_register_pages[0x80000 >> RANGE_PAGE_SHIFT];
+static uint8_t gen4_register_pages[0x80000 >> RANGE_PAGE_SHIFT];
+static uint8_t gen6_gt_register_pages[0x180000 >> RANGE_PAGE_SHIFT];
+
+static uint32_t find_range(struct intel_register_map map, uint32_t offset);
+
+static void build_pages(struct intel_register_map *map, uint8_t *pages)
+{
+	uint32_t page;
+
+	for (page = 0; page < map->top >> RANGE_PAGE_SHIFT; page++) {
+		uint32_t base = page << RANGE_PAGE_SHIFT;
+		uint32_t last = base + (1 << RANGE_PAGE_SHIFT) - 1;
+		uint32_t i = find_range(*map, base);
+
+		if (i < RANGE_PAGE_SPLIT && i < map->count &&
+		    last <= map->map[i].base + map->map[i].size)
+			pages[page] = i;
+		else
+			pages[page] = RANGE_PAGE_SPLIT;
+	}
+
+	map->pages = pages;
+}
+
+/* The number of ranges in map, without the terminating INTEL_RANGE_END */
+static uint32_t map_count(const struct intel_register_range *map)
+{
+	uint32_t count = 0;
+
+	while (!(map[count].flags & INTEL_RANGE_END))
+		count++;
+
+	return count;
+}
+
 struct intel_register_map
 intel_get_register_map(uint32_t devid)
 {
 	struct intel_register_map map;
 	const int gen = intel_gen(devid);
+	uint8_t *pages = NULL;
 
 	if (gen >= 6) {
 		map.map = gen6_gt_register_map;
 		map.top = 0x180000;
+		pages = gen6_gt_register_pages;
 	} else if (IS_BROADWATER(devid) || IS_CRESTLINE(devid)) {
 		map.map = gen_bwcl_register_map;
 		map.top = 0x80000;
+		pages = gen_bwcl_register_pages;
 	} else if (gen >= 4) {
 		map.map = gen4_register_map;
 		map.top = 0x80000;
+		pages = gen4_register_pages;
 	} else {
 		igt_fail_on("Gen2/3 Ranges are not supported. Please use ""unsafe access.");
 	}
 
 	map.alignment_mask = 0x3;
+	map.count = map_count(map.map);
+	build_pages(&map, pages);
 
 	return map;
 }
 
+/*
+ * The list is assumed to be in order and the ranges not to overlap, so
+ * only the last range starting at or below offset can hold it. Returns
+ * map.count if there is none.
+ */
+static uint32_t find_range(struct intel_register_map map, uint32_t offset)
+{
+	uint32_t lo = 0, hi = map.count;
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+
+		if (map.map[mid].base <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo ? lo - 1 : map.count;
+}
+
 struct intel_register_range *
 intel_get_register_range(struct intel_register_map map, uint32_t offset, uint32_t mode)
 {
-	struct intel_register_range *range = map.map;
+	struct intel_register_range *range;
 	uint32_t align = map.alignment_mask;
+	uint32_t i;
 
 	if (offset & map.alignment_mask)
 		return NULL;
@@ -163,18 +234,58 @@ intel_get_register_range(struct intel_register_map map, uint32_t offset, uint32_
 	if (offset >= map.top)
 		return NULL;
 
-	while (!(range->flags & INTEL_RANGE_END)) {
-		/*  list is assumed to be in order */
-		if (offset < range->base)
-			break;
+	i = map.pages[offset >> RANGE_PAGE_SHIFT];
+	if (i == RANGE_PAGE_SPLIT)
+		i = find_range(map, offset);
+	if (i == map.count)
+		return NULL;
+
+	range = &map.map[i];
+	if ((offset + align) <= (range->base + range->size) &&
+	    (mode & range->flags) == mode)
+		return range;
 
-		if ( (offset >= range->base) &&
-		     (offset + align) <= (range->base + range->size)) {
-			if ((mode & range->flags) == mode)
-				return range;
+	return NULL;
+}
+
+/*
+ * Check the size bytes of registers from offset in one walk of the map,
+ * rather than a intel_get_register_range() per register. Returns non-zero
+ * if all of them are in ranges that allow mode.
+ */
+int
+intel_register_span_allowed(struct intel_register_map map, uint32_t offset,
+			    uint32_t size, uint32_t mode)
+{
+	uint64_t pos = offset, end = (uint64_t)offset + size;
+	uint32_t i;
+
+	if (size == 0)
+		return 1;
+
+	if (offset & map.alignment_mask)
+		return 0;
+
+	if (end > map.top)
+		return 0;
+
+	i = find_range(map, offset);
+	if (i == map.count)
+		return 0;
+
+	for (; pos < end && i < map.count; i++) {
+		const struct intel_register_range *range = &map.map[i];
+
+		/* gaps between ranges aren't allowed */
+		if (pos < range->base)
+			return 0;
+
+		if (pos <= (uint64_t)range->base + range->size) {
+			if ((mode & range->flags) != mode)
+				return 0;
+			pos = (uint64_t)range->base + range->size + 1;
 		}
-		range++;
 	}
 
-	return NULL;
+	return pos >= end;
 }
@@ -0,0 +1,130 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "igt_core.h"
+#include "igt_ascii85.h"
+
+/* Encode like the kernel does for the error state */
+static size_t encode(const uint32_t *in, size_t count, char *out)
+{
+	size_t len = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		uint32_t v = in[i];
+
+		if (v == 0) {
+			out[len++] = 'z';
+			continue;
+		}
+
+		for (int j = 4; j >= 0; j--) {
+			out[len + j] = '!' + v % 85;
+			v /= 85;
+		}
+		len += 5;
+	}
+	out[len] = '\0';
+
+	return len;
+}
+
+static void test_known(void)
+{
+	uint32_t out[4];
+
+	igt_assert_eq(igt_ascii85_decode("z!!!!\"s8W-!\n", 12, out), 3);
+	igt_assert_eq(out[0], 0);
+	igt_assert_eq(out[1], 1);
+	igt_assert_eq(out[2], 0xffffffff);
+
+	/* Stops at the first character outside of the alphabet */
+	igt_assert_eq(igt_ascii85_decode("zz zz", 5, out), 2);
+
+	/* and at a trailing partial group */
+	igt_assert_eq(igt_ascii85_decode("z!!!", 4, out), 1);
+}
+
+/*
+ * Round trip random data, with runs of zeroes so that 'z' breaks up the
+ * groups at every alignment, and check the vector paths against the plain
+ * C decoder for every length and starting offset.
+ */
+static void test_random(void)
+{
+	const size_t count = 1000;
+	uint32_t *data, *out, *ref;
+	char *text;
+	size_t len;
+
+	data = malloc(count * sizeof(*data));
+	out = malloc(5 * count * sizeof(*out));
+	ref = malloc(5 * count * sizeof(*ref));
+	text = malloc(5 * count + 1);
+	igt_assert(data && out && ref && text);
+
+	srandom(0xdeadbeef);
+	for (size_t i = 0; i < count; i++)
+		data[i] = random() % 4 ? (uint32_t)random() << 1 ^ random() : 0;
+
+	len = encode(data, count, text);
+	igt_assert_eq(igt_ascii85_decode(text, len, out), count);
+	igt_assert(memcmp(out, data, count * sizeof(*data)) == 0);
+
+	for (size_t offset = 0; offset < 64; offset++) {
+		for (size_t n = 0; n < 200; n++) {
+			size_t expected;
+
+			expected = igt_ascii85_decode_generic(text + offset, n, ref);
+			igt_assert_eq(igt_ascii85_decode(text + offset, n, out),
+				      expected);
+			igt_assert(memcmp(out, ref, expected * sizeof(*ref)) == 0);
+		}
+	}
+
+	/* Characters outside the alphabet anywhere in a vector's reach */
+	for (size_t pos = 0; pos < 100; pos++) {
+		char saved = text[pos];
+		size_t expected;
+
+		text[pos] = '\n';
+		expected = igt_ascii85_decode_generic(text, len, ref);
+		igt_assert_eq(igt_ascii85_decode(text, len, out), expected);
+		igt_assert(memcmp(out, ref, expected * sizeof(*ref)) == 0);
+		text[pos] = saved;
+	}
+
+	free(text);
+	free(ref);
+	free(out);
+	free(data);
+}
+
+igt_simple_main
+{
+	test_known();
+	test_random();
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "igt_core.h"
+#include "igt_sampler.h"
+#include "intel_io.h"
+
+#define ARRAY_SIZE(arr) (sizeof(arr)/sizeof(arr[0]))
+
+static const uint32_t regs[] = { 0x8, 0x0, 0x1c, 0x4 };
+
+/* Each read returns the number of reads before it */
+static uint32_t count_read(void *data, uint32_t reg)
+{
+	uint32_t *count = data;
+
+	return (*count)++;
+}
+
+/* Samples come out in order, all of them, with their reads in order */
+static void test_order(void)
+{
+	igt_sampler_config_t config = {
+		.regs = regs,
+		.num_regs = ARRAY_SIZE(regs),
+		.period_ns = 100000,
+		.cpu = -1,
+		.read = count_read,
+	};
+	igt_sample_t samples[64];
+	igt_sampler_t *sampler;
+	uint32_t count = 0, expected = 0;
+	uint64_t last = 0;
+	unsigned int n, i, j, total = 0;
+
+	config.data = &count;
+	sampler = igt_sampler_start(&config);
+	igt_assert(sampler);
+
+	while (total < 200) {
+		usleep(1000);
+
+		n = igt_sampler_drain(sampler, samples, ARRAY_SIZE(samples));
+		for (i = 0; i < n; i++) {
+			igt_assert(samples[i].timestamp > last);
+			last = samples[i].timestamp;
+
+			for (j = 0; j < ARRAY_SIZE(regs); j++)
+				igt_assert_eq_u32(samples[i].values[j],
+						  expected++);
+		}
+		total += n;
+	}
+
+	igt_assert_eq(igt_sampler_get_dropped(sampler), 0);
+	igt_sampler_stop(sampler);
+}
+
+/* With nobody draining, the oldest samples are kept */
+static void test_full(void)
+{
+	igt_sampler_config_t config = {
+		.regs = regs,
+		.num_regs = 1,
+		.period_ns = 100000,
+		.ring_size = 5,
+		.cpu = -1,
+		.read = count_read,
+	};
+	igt_sample_t samples[16];
+	igt_sampler_t *sampler;
+	uint32_t count = 0;
+	unsigned int n, i;
+
+	config.data = &count;
+	sampler = igt_sampler_start(&config);
+	igt_assert(sampler);
+
+	while (igt_sampler_get_dropped(sampler) == 0)
+		usleep(1000);
+
+	n = igt_sampler_drain(sampler, samples, ARRAY_SIZE(samples));
+	igt_assert_eq(n, 8);
+	for (i = 0; i < n; i++)
+		igt_assert_eq_u32(samples[i].values[0], i);
+
+	igt_sampler_stop(sampler);
+}
+
+/* By default whatever the mmio is gets read, here a dump file */
+static void test_dump_file(void)
+{
+	char file[] = "/tmp/igt_sampler.XXXXXX";
+	uint32_t dump[8];
+	igt_sampler_config_t config = {
+		.regs = regs,
+		.num_regs = ARRAY_SIZE(regs),
+		.period_ns = 100000,
+	};
+	igt_sample_t sample;
+	igt_sampler_t *sampler;
+	unsigned int i;
+	int fd;
+
+	config.cpu = sched_getcpu();
+	igt_assert(config.cpu >= 0);
+
+	for (i = 0; i < ARRAY_SIZE(dump); i++)
+		dump[i] = 0xc0ffee00 + i;
+
+	fd = mkstemp(file);
+	igt_assert(fd >= 0);
+	igt_assert(write(fd, dump, sizeof(dump)) == sizeof(dump));
+	close(fd);
+
+	intel_mmio_use_dump_file(file);
+	unlink(file);
+
+	sampler = igt_sampler_start(&config);
+	igt_assert(sampler);
+
+	while (igt_sampler_drain(sampler, &sample, 1) == 0)
+		usleep(1000);
+
+	for (i = 0; i < ARRAY_SIZE(regs); i++)
+		igt_assert_eq_u32(sample.values[i], dump[regs[i] / 4]);
+
+	igt_sampler_stop(sampler);
+}
+
+/* Pinning to a cpu that isn't there fails the start */
+static void test_bad_cpu(void)
+{
+	igt_sampler_config_t config = {
+		.regs = regs,
+		.num_regs = 1,
+		.period_ns = 100000,
+		.read = count_read,
+	};
+	uint32_t count = 0;
+
+	config.data = &count;
+
+	config.cpu = CPU_SETSIZE - 1;
+	igt_require(sysconf(_SC_NPROCESSORS_CONF) <= config.cpu);
+	igt_assert(igt_sampler_start(&config) == NULL);
+	igt_assert_eq(errno, EINVAL);
+
+	config.cpu = CPU_SETSIZE;
+	igt_assert(igt_sampler_start(&config) == NULL);
+	igt_assert_eq(errno, EINVAL);
+}
+
+igt_simple_main
+{
+	test_order();
+	test_full();
+	test_dump_file();
+	test_bad_cpu();
+}
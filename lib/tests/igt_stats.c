@@ -22,6 +22,10 @@
  *
  */
 
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "igt_core.h"
 #include "igt_stats.h"
 
@@ -228,6 +232,330 @@ static void test_reallocation(void)
 	igt_stats_fini(&stats);
 }
 
+/* Queries between pushes agree with a data set sorted in one go */
+static void test_incremental_sort(void)
+{
+	igt_stats_t stats, ref;
+	uint64_t x = 1;
+	unsigned int i, j;
+
+	igt_stats_init_with_size(&stats, 1);
+
+	for (i = 0; i < 500; i++) {
+		x = x * 6364136223846793005ull + 1442695040888963407ull;
+		if (i == 400)
+			igt_stats_push_float(&stats, (x >> 50) + .5);
+		else
+			igt_stats_push(&stats, x >> 50);
+
+		if (i % 7 != 6)
+			continue;
+
+		igt_stats_init(&ref);
+		for (j = 0; j < stats.n_values; j++) {
+			if (stats.is_float)
+				igt_stats_push_float(&ref, stats.values_f[j]);
+			else
+				igt_stats_push(&ref, stats.values_u64[j]);
+		}
+
+		igt_assert_eq_double(igt_stats_get_median(&stats),
+				     igt_stats_get_median(&ref));
+		igt_assert_eq_double(igt_stats_get_trimean(&stats),
+				     igt_stats_get_trimean(&ref));
+		igt_assert_eq_double(igt_stats_get_iqm(&stats),
+				     igt_stats_get_iqm(&ref));
+
+		igt_stats_fini(&ref);
+	}
+
+	igt_stats_fini(&stats);
+}
+
+/* Small values are counted exactly, so a sketch gives the same results */
+static void test_sketch_exact(void)
+{
+	static const uint64_t s1[] =
+		{ 47, 49, 6, 7, 15, 36, 39, 40, 41, 42, 43 };
+	igt_stats_t stats;
+	double q1, q2, q3;
+
+	igt_stats_init_sketch(&stats);
+	igt_stats_push_array(&stats, s1, ARRAY_SIZE(s1));
+
+	igt_stats_get_quartiles(&stats, &q1, &q2, &q3);
+	igt_assert_eq_double(q1, 25.5);
+	igt_assert_eq_double(q2, 40);
+	igt_assert_eq_double(q3, 42.5);
+	igt_assert_eq_double(igt_stats_get_median(&stats), 40);
+	igt_assert_eq_double(igt_stats_get_iqr(&stats), 42.5 - 25.5);
+	igt_assert_eq(igt_stats_get_min(&stats), 6);
+	igt_assert_eq(igt_stats_get_max(&stats), 49);
+	igt_assert(stats.values_u64 == NULL);
+
+	igt_stats_fini(&stats);
+}
+
+static bool sketch_close(double approx, double exact)
+{
+	return fabs(approx - exact) <= exact / (2 << IGT_STATS_SKETCH_BITS);
+}
+
+/* Larger values are within the documented error of the full data set */
+static void test_sketch_error(void)
+{
+	igt_stats_t stats, sketch;
+	double q1, q2, q3, s1, s2, s3;
+	uint64_t x = 1;
+	unsigned int i;
+
+	igt_stats_init(&stats);
+	igt_stats_init_sketch(&sketch);
+
+	for (i = 0; i < 10001; i++) {
+		uint64_t v;
+
+		x = x * 6364136223846793005ull + 1442695040888963407ull;
+		v = 1000 + (x >> 40) % 1000000 + (x >> 20 & 1) * 100000000;
+
+		igt_stats_push(&stats, v);
+		igt_stats_push(&sketch, v);
+	}
+
+	igt_stats_get_quartiles(&stats, &q1, &q2, &q3);
+	igt_stats_get_quartiles(&sketch, &s1, &s2, &s3);
+	igt_assert(sketch_close(s1, q1));
+	igt_assert(sketch_close(s2, q2));
+	igt_assert(sketch_close(s3, q3));
+	igt_assert(sketch_close(igt_stats_get_iqm(&sketch),
+				igt_stats_get_iqm(&stats)));
+	igt_assert(sketch_close(igt_stats_get_trimean(&sketch),
+				igt_stats_get_trimean(&stats)));
+
+	igt_assert_eq(igt_stats_get_min(&sketch), igt_stats_get_min(&stats));
+	igt_assert_eq(igt_stats_get_max(&sketch), igt_stats_get_max(&stats));
+	igt_assert(fabs(igt_stats_get_mean(&sketch) -
+			igt_stats_get_mean(&stats)) < 1e-6);
+	igt_assert(fabs(igt_stats_get_std_deviation(&sketch) /
+			igt_stats_get_std_deviation(&stats) - 1) < 1e-9);
+
+	igt_stats_fini(&sketch);
+	igt_stats_fini(&stats);
+}
+
+static void test_histogram(void)
+{
+	static const uint64_t s1[] = { 0, 1, 2, 3, 4, 7, 8, 1000, 1ull << 63 };
+	uint64_t counts[IGT_STATS_HISTOGRAM_BUCKETS], sketch[8];
+	igt_stats_t stats;
+
+	igt_stats_init(&stats);
+	igt_stats_push_array(&stats, s1, ARRAY_SIZE(s1));
+
+	igt_assert_eq(igt_stats_get_histogram(&stats, counts,
+					      ARRAY_SIZE(counts)), 65);
+	igt_assert_eq(counts[0], 1);
+	igt_assert_eq(counts[1], 1);
+	igt_assert_eq(counts[2], 2);
+	igt_assert_eq(counts[3], 2);
+	igt_assert_eq(counts[4], 1);
+	igt_assert_eq(counts[10], 1);
+	igt_assert_eq(counts[64], 1);
+
+	/* The last bucket takes the rest, and a sketch agrees */
+	igt_assert_eq(igt_stats_get_histogram(&stats, counts, 8), 8);
+	igt_stats_fini(&stats);
+
+	igt_stats_init_sketch(&stats);
+	igt_stats_push_array(&stats, s1, ARRAY_SIZE(s1));
+	igt_assert_eq(igt_stats_get_histogram(&stats, sketch, 8), 8);
+	igt_assert(memcmp(counts, sketch, sizeof(sketch)) == 0);
+	igt_assert_eq(counts[7], 2);
+	igt_stats_fini(&stats);
+}
+
+static void test_window(void)
+{
+	uint64_t counts[4];
+	igt_window_t window;
+	unsigned int i;
+
+	/* the last 4 samples */
+	igt_window_init(&window, 4, 0);
+	igt_assert_eq_double(igt_window_get_mean(&window), 0.);
+
+	for (i = 0; i < 10; i++)
+		igt_window_push(&window, i, 1e9 + 2 * i);
+
+	igt_assert_eq(igt_window_get_count(&window), 4);
+	igt_assert_eq_double(igt_window_get_min(&window), 1e9 + 12);
+	igt_assert_eq_double(igt_window_get_max(&window), 1e9 + 18);
+	igt_assert_eq_double(igt_window_get_mean(&window), 1e9 + 15);
+	igt_assert_eq_double(igt_window_get_variance(&window), 20. / 3);
+
+	igt_assert_eq(igt_window_get_histogram(&window, counts, 4), 4);
+	igt_assert_eq(counts[3], 4);
+	igt_window_fini(&window);
+
+	/* what is less than 10 old */
+	igt_window_init(&window, 100, 10);
+	for (i = 0; i < 50; i++)
+		igt_window_push(&window, 5 * i, i);
+
+	igt_assert_eq(igt_window_get_count(&window), 2);
+	igt_assert_eq_double(igt_window_get_mean(&window), 48.5);
+
+	igt_window_push(&window, 1000, 1);
+	igt_assert_eq(igt_window_get_count(&window), 1);
+	igt_assert_eq_double(igt_window_get_mean(&window), 1);
+	igt_assert_eq_double(igt_window_get_variance(&window), 0);
+
+	/* nothing is left over from samples which all aged out */
+	for (i = 0; i < 5; i++)
+		igt_window_push(&window, 2000 + i, 1.1 + 0.7 * i);
+	igt_window_push(&window, 3000, 1e-3);
+	igt_assert_eq(igt_window_get_count(&window), 1);
+	igt_assert_eq_double(igt_window_get_mean(&window), 1e-3);
+	igt_assert_eq_double(igt_window_get_variance(&window), 0);
+	igt_window_fini(&window);
+}
+
+static void test_decay(void)
+{
+	igt_decay_t decay;
+
+	igt_decay_init(&decay, 10);
+
+	igt_decay_push(&decay, 0, 4);
+	igt_assert_eq_double(igt_decay_get_mean(&decay), 4);
+	igt_assert_eq_double(igt_decay_get_variance(&decay), 0);
+
+	/* same time, same weight */
+	igt_decay_push(&decay, 0, 8);
+	igt_assert_eq_double(igt_decay_get_mean(&decay), 6);
+	igt_assert_eq_double(igt_decay_get_variance(&decay), 4);
+
+	/* a half-life later, the first two weigh as much as the new one */
+	igt_decay_push(&decay, 10, 12);
+	igt_assert_eq_double(igt_decay_get_mean(&decay), 9);
+	igt_assert_eq_double(igt_decay_get_variance(&decay), 11);
+}
+
+static void naive_mean_variance(const double *values, unsigned int n,
+				double *mean, double *variance)
+{
+	long double sum = 0, sum2 = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		sum += values[i];
+	sum /= n;
+
+	for (i = 0; i < n; i++)
+		sum2 += (values[i] - sum) * (values[i] - sum);
+
+	*mean = sum;
+	*variance = sum2 / (n - 1);
+}
+
+static bool rel_close(double value, double ref, double eps)
+{
+	return fabs(value - ref) <= eps * fabs(ref);
+}
+
+/*
+ * The blocked mean and variance agree with a plain two pass computation,
+ * across block boundaries and on values far from 0 with a small spread
+ */
+static void test_blocked_mean_variance(void)
+{
+	static const unsigned int checks[] = { 2, 255, 256, 257, 513, 100003 };
+	igt_stats_t stats, stats_f;
+	double *values, *values_f, mean, variance;
+	uint64_t x = 1;
+	unsigned int i, n = 0;
+
+	values = malloc(100003 * sizeof(*values));
+	values_f = malloc(100003 * sizeof(*values_f));
+	igt_assert(values && values_f);
+
+	igt_stats_init(&stats);
+	igt_stats_init(&stats_f);
+
+	for (i = 0; i < ARRAY_SIZE(checks); i++) {
+		for (; n < checks[i]; n++) {
+			uint64_t v;
+
+			x = x * 6364136223846793005ull + 1442695040888963407ull;
+			v = (1ull << 40) + (x >> 44);
+
+			values[n] = v;
+			igt_stats_push(&stats, v);
+
+			values_f[n] = 1e9 + (x >> 11) * 0x1p-53;
+			igt_stats_push_float(&stats_f, values_f[n]);
+		}
+
+		naive_mean_variance(values, n, &mean, &variance);
+		igt_assert(rel_close(igt_stats_get_mean(&stats), mean, 1e-12));
+		igt_assert(rel_close(igt_stats_get_variance(&stats),
+				     variance, 1e-9));
+
+		naive_mean_variance(values_f, n, &mean, &variance);
+		igt_assert(rel_close(igt_stats_get_mean(&stats_f), mean, 1e-12));
+		igt_assert(rel_close(igt_stats_get_variance(&stats_f),
+				     variance, 1e-6));
+	}
+
+	igt_stats_fini(&stats_f);
+	igt_stats_fini(&stats);
+	free(values_f);
+	free(values);
+}
+
+/* Pushing an array is the same as pushing its values one by one */
+static void test_push_array(void)
+{
+	igt_stats_t stats, ref;
+	uint64_t values[1000];
+	uint64_t x = 1;
+	unsigned int i, j;
+
+	igt_stats_init_with_size(&stats, 1);
+	igt_stats_init(&ref);
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < ARRAY_SIZE(values); j++) {
+			x = x * 6364136223846793005ull + 1442695040888963407ull;
+			values[j] = 1000 + (x >> 54);
+		}
+		/* stretch the range both ways on each push */
+		values[i * 7] = 999 - i;
+		values[ARRAY_SIZE(values) - 1 - i] = 3000 + i;
+
+		igt_stats_push_array(&stats, values, ARRAY_SIZE(values));
+		for (j = 0; j < ARRAY_SIZE(values); j++)
+			igt_stats_push(&ref, values[j]);
+
+		igt_assert_eq(stats.n_values, ref.n_values);
+		igt_assert_eq_u64(igt_stats_get_min(&stats),
+				  igt_stats_get_min(&ref));
+		igt_assert_eq_u64(igt_stats_get_max(&stats),
+				  igt_stats_get_max(&ref));
+		igt_assert_eq_u64(igt_stats_get_range(&stats),
+				  igt_stats_get_range(&ref));
+		igt_assert_eq_double(igt_stats_get_mean(&stats),
+				     igt_stats_get_mean(&ref));
+		igt_assert_eq_double(igt_stats_get_variance(&stats),
+				     igt_stats_get_variance(&ref));
+		igt_assert_eq_double(igt_stats_get_median(&stats),
+				     igt_stats_get_median(&ref));
+	}
+
+	igt_stats_fini(&ref);
+	igt_stats_fini(&stats);
+}
+
 igt_simple_main
 {
 	test_init_zero();
@@ -240,4 +568,12 @@ igt_simple_main
 	test_invalidate_mean();
 	test_std_deviation();
 	test_reallocation();
+	test_incremental_sort();
+	test_sketch_exact();
+	test_sketch_error();
+	test_histogram();
+	test_window();
+	test_decay();
+	test_blocked_mean_variance();
+	test_push_array();
 }
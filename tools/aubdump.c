@@ -37,6 +37,8 @@
 #include <errno.h>
 #include <sys/mman.h>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <zlib.h>
 #include <i915_drm.h>
 
 #include "intel_aub.h"
@@ -50,15 +52,17 @@ static char *filename;
 static FILE *file;
 static int gen = 0;
 static int verbose = 0;
-static const uint32_t gtt_size = 0x10000;
 static bool device_override;
 static uint32_t device;
+static bool dedup = true;
+static bool verify;
+static int compress_level;
 
 #define MAX_BO_COUNT 64 * 1024
 
 struct bo {
 	uint32_t size;
-	uint64_t offset;
+	uint64_t offset; /* 0 while the bo has no GTT address */
 	void *map;
 };
 
@@ -121,22 +125,413 @@ align_u64(uint64_t v, uint64_t a)
 	return (v + a - 1) & ~(a - 1);
 }
 
+/*
+ * Output goes through a small ring of blocks: the application thread only
+ * copies into the current block, and a writer thread compresses (when
+ * requested) and writes out full blocks. Each compressed block is a
+ * complete gzip member, so the file as a whole is a valid gzip stream
+ * that can be read incrementally. The application only stalls when all
+ * blocks are waiting to be written.
+ *
+ * The writer thread never exits the process, as the destructor would then
+ * run on it and wait for itself: the first error is recorded, later blocks
+ * are dropped, and out_finish() reports it.
+ *
+ * A forked child has the blocks and the file of its parent but no writer,
+ * and can't start one before it execs, so it doesn't write anything. The
+ * file is unbuffered, as the writer only writes whole blocks anyway, so
+ * that the child has no copy of the parent's output to flush at exit.
+ */
+#define OUT_BLOCK_SIZE (1 << 20)
+#define OUT_BLOCK_COUNT 8
+
+static struct {
+	uint8_t *block[OUT_BLOCK_COUNT];
+	size_t len[OUT_BLOCK_COUNT];
+	unsigned head, tail;
+	bool running, done, forked;
+	const char *error;
+	int error_errno;
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} out = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* Called from the writer thread, keeps the first error only */
 static void
-dword_out(uint32_t data)
+out_error(const char *error, int err)
+{
+	pthread_mutex_lock(&out.lock);
+	if (out.error == NULL) {
+		out.error = error;
+		out.error_errno = err;
+	}
+	pthread_mutex_unlock(&out.lock);
+}
+
+static void *
+out_writer(void *arg)
 {
-	fwrite(&data, 1, 4, file);
+	z_stream z = {};
+	uint8_t *zbuf = NULL;
+	uLong zbuf_size = 0;
+	bool failed = false;
+
+	if (compress_level) {
+		if (deflateInit2(&z, compress_level, Z_DEFLATED, 15 + 16,
+				 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			out_error("failed to initialize zlib", 0);
+			failed = true;
+		} else {
+			zbuf_size = deflateBound(&z, OUT_BLOCK_SIZE);
+			zbuf = malloc(zbuf_size);
+			if (zbuf == NULL) {
+				out_error("out of memory", 0);
+				failed = true;
+			}
+		}
+	}
+
+	pthread_mutex_lock(&out.lock);
+	for (;;) {
+		unsigned idx;
+
+		while (out.tail == out.head && !out.done)
+			pthread_cond_wait(&out.cond, &out.lock);
+		if (out.tail == out.head)
+			break;
+
+		idx = out.tail % OUT_BLOCK_COUNT;
+		pthread_mutex_unlock(&out.lock);
+
+		/* After an error, blocks are just dropped */
+		if (!failed && compress_level) {
+			size_t len;
+
+			z.next_in = out.block[idx];
+			z.avail_in = out.len[idx];
+			z.next_out = zbuf;
+			z.avail_out = zbuf_size;
+			if (deflate(&z, Z_FINISH) != Z_STREAM_END) {
+				out_error("compression failed", 0);
+				failed = true;
+			} else {
+				len = zbuf_size - z.avail_out;
+				if (fwrite(zbuf, 1, len, file) != len) {
+					out_error("failed to write file", errno);
+					failed = true;
+				}
+			}
+			deflateReset(&z);
+		} else if (!failed &&
+			   fwrite(out.block[idx], 1, out.len[idx], file) !=
+			   out.len[idx]) {
+			out_error("failed to write file", errno);
+			failed = true;
+		}
+
+		pthread_mutex_lock(&out.lock);
+		out.tail++;
+		pthread_cond_broadcast(&out.cond);
+	}
+	pthread_mutex_unlock(&out.lock);
+
+	if (compress_level)
+		deflateEnd(&z);
+	free(zbuf);
+	if (!failed && fflush(file))
+		out_error("failed to write file", errno);
+
+	return NULL;
+}
+
+static void
+out_start(void)
+{
+	for (int i = 0; i < OUT_BLOCK_COUNT; i++) {
+		out.block[i] = malloc(OUT_BLOCK_SIZE);
+		fail_if(out.block[i] == NULL, "intel_aubdump: out of memory\n");
+	}
+
+	fail_if(pthread_create(&out.writer, NULL, out_writer, NULL),
+		"intel_aubdump: failed to start writer thread\n");
+	out.running = true;
+}
+
+/* Hand the current block to the writer and wait for a free one */
+static void
+out_submit(void)
+{
+	pthread_mutex_lock(&out.lock);
+	out.head++;
+	pthread_cond_broadcast(&out.cond);
+	while (out.head - out.tail == OUT_BLOCK_COUNT)
+		pthread_cond_wait(&out.cond, &out.lock);
+	out.len[out.head % OUT_BLOCK_COUNT] = 0;
+	pthread_mutex_unlock(&out.lock);
+}
+
+static void
+out_finish(void)
+{
+	if (!out.running || out.forked)
+		return;
+
+	if (out.len[out.head % OUT_BLOCK_COUNT])
+		out_submit();
+
+	pthread_mutex_lock(&out.lock);
+	out.done = true;
+	pthread_cond_broadcast(&out.cond);
+	pthread_mutex_unlock(&out.lock);
+
+	pthread_join(out.writer, NULL);
+	out.running = false;
+
+	if (out.error)
+		fprintf(stderr, "intel_aubdump: %s%s%s, '%s' is incomplete\n",
+			out.error, out.error_errno ? ": " : "",
+			out.error_errno ? strerror(out.error_errno) : "",
+			filename);
+
+	for (int i = 0; i < OUT_BLOCK_COUNT; i++)
+		free(out.block[i]);
 }
 
 static void
 data_out(const void *data, size_t size)
 {
-	fwrite(data, 1, size, file);
+	const uint8_t *ptr = data;
+
+	if (out.forked)
+		return;
+
+	if (!out.running)
+		out_start();
+
+	while (size) {
+		unsigned idx = out.head % OUT_BLOCK_COUNT;
+		size_t len = OUT_BLOCK_SIZE - out.len[idx];
+
+		if (len > size)
+			len = size;
+
+		memcpy(out.block[idx] + out.len[idx], ptr, len);
+		out.len[idx] += len;
+		ptr += len;
+		size -= len;
+
+		if (out.len[idx] == OUT_BLOCK_SIZE)
+			out_submit();
+	}
+}
+
+static void
+dword_out(uint32_t data)
+{
+	data_out(&data, 4);
+}
+
+/*
+ * The low end of the address space is never handed out, so that an offset
+ * of 0 can mean "not bound".
+ */
+#define GTT_START 0x10000
+
+/* Granularity at which the GTT mapping is extended, in pages */
+#define GTT_MAP_PAGES 16384
+
+/*
+ * GTT address allocator. Each bo keeps the address it was first given
+ * until it is closed, so that its pages stay where the consumer of the
+ * AUB file last saw them. Free space below gtt.top is kept as a sorted
+ * array of holes, allocated from first-fit and coalesced on free; space
+ * from gtt.top upwards has never been used. Only [0, gtt.mapped) has
+ * GTT entries written for it, and the mapping is extended as gtt.top
+ * grows.
+ */
+struct gtt_hole {
+	uint64_t start, end;
+};
+
+static struct {
+	struct gtt_hole *holes;
+	unsigned num_holes, max_holes;
+	uint64_t top, limit, mapped;
+	uint64_t ring_offset;
+} gtt;
+
+static void
+gtt_map(uint64_t end)
+{
+	uint32_t pte_size = gen >= 8 ? 8 : 4;
+	uint64_t page, last;
+
+	if (end <= gtt.mapped)
+		return;
+
+	page = gtt.mapped >> 12;
+	last = align_u64(end >> 12, GTT_MAP_PAGES);
+	while (page < last) {
+		uint64_t count = last - page;
+
+		/* Keep each block within the 16 bit size field */
+		if (count > 8192 / pte_size)
+			count = 8192 / pte_size;
+
+		dword_out(CMD_AUB_TRACE_HEADER_BLOCK | ((gen >= 8 ? 6 : 5) - 2));
+		dword_out(AUB_TRACE_MEMTYPE_GTT_ENTRY |
+			  AUB_TRACE_TYPE_NOTYPE | AUB_TRACE_OP_DATA_WRITE);
+		dword_out(0); /* subtype */
+		dword_out(page * pte_size); /* offset */
+		dword_out(count * pte_size); /* size */
+		if (gen >= 8)
+			dword_out((page * pte_size) >> 32);
+
+		for (; count; count--, page++) {
+			uint64_t entry = 0x200003 + (page << 12);
+
+			dword_out(entry);
+			if (gen >= 8)
+				dword_out(entry >> 32);
+		}
+	}
+
+	gtt.mapped = last << 12;
+}
+
+static void
+gtt_insert_hole(unsigned idx, uint64_t start, uint64_t end)
+{
+	if (gtt.num_holes == gtt.max_holes) {
+		gtt.max_holes = gtt.max_holes ? 2 * gtt.max_holes : 64;
+		gtt.holes = realloc(gtt.holes,
+				    gtt.max_holes * sizeof(*gtt.holes));
+		fail_if(gtt.holes == NULL, "intel_aubdump: out of memory\n");
+	}
+
+	memmove(&gtt.holes[idx + 1], &gtt.holes[idx],
+		(gtt.num_holes - idx) * sizeof(*gtt.holes));
+	gtt.holes[idx].start = start;
+	gtt.holes[idx].end = end;
+	gtt.num_holes++;
+}
+
+static void
+gtt_remove_hole(unsigned idx)
+{
+	gtt.num_holes--;
+	memmove(&gtt.holes[idx], &gtt.holes[idx + 1],
+		(gtt.num_holes - idx) * sizeof(*gtt.holes));
+}
+
+static uint64_t
+gtt_alloc(uint64_t size, uint64_t alignment)
+{
+	uint64_t start;
+
+	size = align_u64(size, 4096);
+	if (alignment < 4096)
+		alignment = 4096;
+
+	for (unsigned i = 0; i < gtt.num_holes; i++) {
+		struct gtt_hole *hole = &gtt.holes[i];
+		uint64_t end;
+
+		start = align_u64(hole->start, alignment);
+		end = start + size;
+		if (end > hole->end)
+			continue;
+
+		if (end == hole->end) {
+			if (start == hole->start)
+				gtt_remove_hole(i);
+			else
+				hole->end = start;
+		} else if (start == hole->start) {
+			hole->start = end;
+		} else {
+			gtt_insert_hole(i + 1, end, hole->end);
+			gtt.holes[i].end = start;
+		}
+
+		return start;
+	}
+
+	start = align_u64(gtt.top, alignment);
+	fail_if(start + size > gtt.limit,
+		"intel_aubdump: out of GTT space (%llu bytes requested)\n",
+		(long long)size);
+
+	if (start > gtt.top) {
+		if (gtt.num_holes && gtt.holes[gtt.num_holes - 1].end == gtt.top)
+			gtt.holes[gtt.num_holes - 1].end = start;
+		else
+			gtt_insert_hole(gtt.num_holes, gtt.top, start);
+	}
+	gtt.top = start + size;
+	gtt_map(gtt.top);
+
+	return start;
+}
+
+static void
+gtt_free(uint64_t start, uint64_t size)
+{
+	uint64_t end = start + align_u64(size, 4096);
+	unsigned lo = 0, hi = gtt.num_holes;
+
+	/* Find the first hole above the range being freed */
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+
+		if (gtt.holes[mid].start < start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo < gtt.num_holes && gtt.holes[lo].start == end) {
+		end = gtt.holes[lo].end;
+		gtt_remove_hole(lo);
+	}
+	if (lo > 0 && gtt.holes[lo - 1].end == start) {
+		start = gtt.holes[lo - 1].start;
+		gtt_remove_hole(--lo);
+	}
+
+	if (end == gtt.top)
+		gtt.top = start;
+	else
+		gtt_insert_hole(lo, start, end);
+}
+
+static void
+gtt_bind(struct bo *bo, uint64_t alignment)
+{
+	if (bo->offset && alignment > 1 && (bo->offset & (alignment - 1))) {
+		gtt_free(bo->offset, bo->size);
+		bo->offset = 0;
+	}
+
+	if (bo->offset == 0)
+		bo->offset = gtt_alloc(bo->size, alignment);
+}
+
+static void
+gtt_unbind(struct bo *bo)
+{
+	if (bo->offset)
+		gtt_free(bo->offset, bo->size);
+	bo->offset = 0;
 }
 
 static void
 write_header(void)
 {
-	uint32_t entry = 0x200003;
 
 	/* Start with a (required) version packet. */
 	dword_out(CMD_AUB_HEADER | (13 - 2));
@@ -149,17 +544,124 @@ write_header(void)
 	dword_out(0); /* timestamp */
 	dword_out(0); /* comment len */
 
-	/* Set up the GTT. The max we can handle is 256M */
-	dword_out(CMD_AUB_TRACE_HEADER_BLOCK | ((gen >= 8 ? 6 : 5) - 2));
-	dword_out(AUB_TRACE_MEMTYPE_GTT_ENTRY |
-		  AUB_TRACE_TYPE_NOTYPE | AUB_TRACE_OP_DATA_WRITE);
-	dword_out(0); /* subtype */
-	dword_out(0); /* offset */
-	dword_out(gtt_size); /* size */
-	if (gen >= 8)
-		dword_out(0);
-	for (uint32_t i = 0; i < gtt_size; i += 4, entry += 0x1000)
-		dword_out(entry);
+	/*
+	 * Set up the GTT. Everything goes in the global GTT, which is at most
+	 * 4GiB even where the PPGTT has 48 bit addresses, as on gen8.
+	 */
+	gtt.limit = gen >= 8 ? 1ull << 32 : 1ull << 31;
+	gtt.top = GTT_START;
+	gtt_map(gtt.top);
+
+	gtt.ring_offset = gtt_alloc(4096, 4096);
+}
+
+/*
+ * Shadow of the GTT as seen by the consumer of the AUB file: for every
+ * page we remember a hash of what we last wrote there, so that pages
+ * whose contents and placement have not changed since are not emitted
+ * again. A hash of 0 means the page contents are unknown. In verify mode
+ * we additionally keep a full copy of every page written, and check
+ * after each execbuffer that it matches what a full dump would contain.
+ */
+static struct {
+	uint64_t *hash;
+	uint8_t **image;
+	uint64_t num_pages;
+} shadow;
+
+static uint64_t
+hash_page(const void *data, uint32_t size)
+{
+	const uint8_t *ptr = data;
+	uint64_t h = 0xcbf29ce484222325ull ^ size;
+
+	for (; size >= 8; size -= 8, ptr += 8) {
+		uint64_t v;
+
+		memcpy(&v, ptr, 8);
+		h = (h ^ v) * 0x100000001b3ull;
+		h ^= h >> 29;
+	}
+	for (; size; size--, ptr++)
+		h = (h ^ *ptr) * 0x100000001b3ull;
+
+	return h | 1;
+}
+
+static void
+shadow_reserve(uint64_t page)
+{
+	uint64_t num_pages = shadow.num_pages;
+
+	if (page < num_pages)
+		return;
+
+	while (num_pages <= page)
+		num_pages = num_pages ? 2 * num_pages : 16384;
+
+	shadow.hash = realloc(shadow.hash, num_pages * sizeof(*shadow.hash));
+	fail_if(shadow.hash == NULL, "intel_aubdump: out of memory\n");
+	memset(shadow.hash + shadow.num_pages, 0,
+	       (num_pages - shadow.num_pages) * sizeof(*shadow.hash));
+
+	if (verify) {
+		shadow.image = realloc(shadow.image, num_pages * sizeof(*shadow.image));
+		fail_if(shadow.image == NULL, "intel_aubdump: out of memory\n");
+		memset(shadow.image + shadow.num_pages, 0,
+		       (num_pages - shadow.num_pages) * sizeof(*shadow.image));
+	}
+
+	shadow.num_pages = num_pages;
+}
+
+/* Record that [gtt_offset, gtt_offset + size) now holds data */
+static void
+shadow_update(const void *data, uint32_t size, uint64_t gtt_offset)
+{
+	for (uint32_t offset = 0; offset < size; ) {
+		uint64_t page = (gtt_offset + offset) >> 12;
+		uint32_t in_page = (gtt_offset + offset) & 4095;
+		uint32_t len = 4096 - in_page;
+
+		if (len > size - offset)
+			len = size - offset;
+
+		shadow_reserve(page);
+		if (in_page == 0 && data)
+			shadow.hash[page] = hash_page((const char *)data + offset, len);
+		else
+			shadow.hash[page] = 0;
+
+		if (verify) {
+			if (shadow.image[page] == NULL) {
+				shadow.image[page] = calloc(1, 4096);
+				fail_if(shadow.image[page] == NULL,
+					"intel_aubdump: out of memory\n");
+			}
+			if (data)
+				memcpy(shadow.image[page] + in_page,
+				       (const char *)data + offset, len);
+			else
+				memset(shadow.image[page] + in_page, 0, len);
+		}
+
+		offset += len;
+	}
+}
+
+/* Check that the consumer's view of memory matches a full dump of data */
+static void
+shadow_verify(const void *data, uint32_t size, uint64_t gtt_offset)
+{
+	for (uint32_t offset = 0; offset < size; offset += 4096) {
+		uint64_t page = (gtt_offset + offset) >> 12;
+		uint32_t len = size - offset < 4096 ? size - offset : 4096;
+
+		fail_if(page >= shadow.num_pages || shadow.image[page] == NULL ||
+			memcmp(shadow.image[page], (const char *)data + offset, len),
+			"intel_aubdump: verify: page 0x%llx differs from a full dump\n",
+			(long long)(gtt_offset + offset));
+	}
 }
 
 /**
@@ -198,6 +700,45 @@ aub_write_trace_block(uint32_t type, void *virtual, uint32_t size, uint64_t gtt_
 		/* Pad to a multiple of 4 bytes. */
 		data_out(null_block, -block_size & 3);
 	}
+
+	shadow_update(virtual ? GET_PTR(virtual) : NULL, size, gtt_offset);
+}
+
+/**
+ * Write out a bo, skipping the pages that the consumer already has at
+ * this address from an earlier execbuffer.
+ */
+static void
+aub_write_bo(uint32_t type, void *virtual, uint32_t size, uint64_t gtt_offset)
+{
+	const char *data = GET_PTR(virtual);
+	uint32_t start = 0, offset;
+
+	if (!dedup || data == NULL || (gtt_offset & 4095)) {
+		aub_write_trace_block(type, virtual, size, gtt_offset);
+		return;
+	}
+
+	shadow_reserve((gtt_offset + size) >> 12);
+	for (offset = 0; offset < size; offset += 4096) {
+		uint32_t len = size - offset < 4096 ? size - offset : 4096;
+		uint64_t page = (gtt_offset + offset) >> 12;
+
+		if (shadow.hash[page] != hash_page(data + offset, len))
+			continue;
+
+		/* Clean page, flush the preceding run of dirty ones */
+		if (offset > start)
+			aub_write_trace_block(type, (char *)data + start,
+					      offset - start, gtt_offset + start);
+		start = offset + len;
+	}
+	if (size > start)
+		aub_write_trace_block(type, (char *)data + start,
+				      size - start, gtt_offset + start);
+
+	if (verify)
+		shadow_verify(data, size, gtt_offset);
 }
 
 static void
@@ -236,6 +777,7 @@ aub_dump_ringbuffer(uint64_t batch_offset, uint64_t offset, int ring_flag)
 		dword_out(offset >> 32);
 
 	data_out(ringbuffer, ring_count * 4);
+	shadow_update(NULL, ring_count * 4, offset);
 }
 
 static void *
@@ -247,22 +789,25 @@ relocate_bo(struct bo *bo, const struct drm_i915_gem_execbuffer2 *execbuffer2,
 	const struct drm_i915_gem_relocation_entry *relocs =
 		(const struct drm_i915_gem_relocation_entry *) (uintptr_t) obj->relocs_ptr;
 	void *relocated;
-	uint32_t *dw;
+	uint64_t address;
 	int handle;
 
 	relocated = malloc(bo->size);
 	fail_if(relocated == NULL, "intel_aubdump: out of memory\n");
 	memcpy(relocated, GET_PTR(bo->map), bo->size);
 	for (size_t i = 0; i < obj->relocation_count; i++) {
-		fail_if(relocs[i].offset >= bo->size, "intel_aubdump: reloc outside bo\n");
+		fail_if(relocs[i].offset + (gen >= 8 ? 8 : 4) > bo->size,
+			"intel_aubdump: reloc outside bo\n");
 
 		if (execbuffer2->flags & I915_EXEC_HANDLE_LUT)
 			handle = exec_objects[relocs[i].target_handle].handle;
 		else
 			handle = relocs[i].target_handle;
 
-		dw = (uint32_t*)(((char *) relocated) + relocs[i].offset);
-		*dw = bos[handle].offset + relocs[i].delta;
+		/* Relocations are 64 bits wide from gen8 onwards */
+		address = bos[handle].offset + relocs[i].delta;
+		memcpy((char *) relocated + relocs[i].offset, &address,
+		       gen >= 8 ? 8 : 4);
 	}
 
 	return relocated;
@@ -316,7 +861,6 @@ dump_execbuffer2(int fd, struct drm_i915_gem_execbuffer2 *execbuffer2)
 	struct drm_i915_gem_exec_object2 *exec_objects =
 		(struct drm_i915_gem_exec_object2 *) (uintptr_t) execbuffer2->buffers_ptr;
 	uint32_t ring_flag = execbuffer2->flags & I915_EXEC_RING_MASK;
-	uint32_t offset = gtt_size;
 	struct drm_i915_gem_exec_object2 *obj;
 	struct bo *bo, *batch_bo;
 	void *data;
@@ -340,8 +884,7 @@ dump_execbuffer2(int fd, struct drm_i915_gem_execbuffer2 *execbuffer2)
 		obj = &exec_objects[i];
 		bo = &bos[obj->handle];
 
-		bo->offset = offset;
-		offset = align_u32(offset + bo->size + 4095, 4096);
+		gtt_bind(bo, obj->alignment);
 
 		if (bo->map == NULL)
 			bo->map = gem_mmap(fd, obj->handle, 0, bo->size);
@@ -359,11 +902,11 @@ dump_execbuffer2(int fd, struct drm_i915_gem_execbuffer2 *execbuffer2)
 			data = bo->map;
 
 		if (bo == batch_bo) {
-			aub_write_trace_block(AUB_TRACE_TYPE_BATCH,
-					      data, bo->size, bo->offset);
+			aub_write_bo(AUB_TRACE_TYPE_BATCH,
+				     data, bo->size, bo->offset);
 		} else {
-			aub_write_trace_block(AUB_TRACE_TYPE_NOTYPE,
-					      data, bo->size, bo->offset);
+			aub_write_bo(AUB_TRACE_TYPE_NOTYPE,
+				     data, bo->size, bo->offset);
 		}
 		if (data != bo->map)
 			free(data);
@@ -371,9 +914,7 @@ dump_execbuffer2(int fd, struct drm_i915_gem_execbuffer2 *execbuffer2)
 
 	/* Dump ring buffer */
 	aub_dump_ringbuffer(batch_bo->offset + execbuffer2->batch_start_offset,
-			    offset, ring_flag);
-
-	fflush(file);
+			    gtt.ring_offset, ring_flag);
 }
 
 static void
@@ -384,6 +925,7 @@ add_new_bo(int handle, uint64_t size, void *map)
 	fail_if(handle >= MAX_BO_COUNT, "intel_aubdump: bo handle out of range\n");
 
 	bo->size = size;
+	bo->offset = 0;
 	bo->map = map;
 }
 
@@ -395,6 +937,7 @@ remove_bo(int handle)
 	if (bo->map && !IS_USERPTR(bo->map))
 		munmap(bo->map, bo->size);
 	bo->map = NULL;
+	gtt_unbind(bo);
 }
 
 int
@@ -527,35 +1070,61 @@ ioctl(int fd, unsigned long request, ...)
 	}
 }
 
+static void
+out_atfork_child(void)
+{
+	out.forked = true;
+}
+
 static void __attribute__ ((constructor))
 init(void)
 {
 	const char *args = getenv("INTEL_AUBDUMP_ARGS");
+	int dedup_arg = 1, verify_arg = 0;
 
 	libc_close = dlsym(RTLD_NEXT, "close");
 	libc_ioctl = dlsym(RTLD_NEXT, "ioctl");
 	fail_if(libc_close == NULL || libc_ioctl == NULL,
 		"intel_aubdump: failed to get libc ioctl or close\n");
 
-	if (sscanf(args, "verbose=%d;file=%m[^;];device=%i",
-		   &verbose, &filename, &device) != 3)
+	if (sscanf(args, "verbose=%d;file=%m[^;];device=%i;dedup=%d;verify=%d;compress=%d",
+		   &verbose, &filename, &device, &dedup_arg, &verify_arg,
+		   &compress_level) < 3)
 		filename = strdup("intel.aub");
 	fail_if(filename == NULL, "intel_aubdump: out of memory\n");
 
+	dedup = dedup_arg;
+	verify = verify_arg && dedup;
+	if (compress_level < 0 || compress_level > 9)
+		compress_level = Z_DEFAULT_COMPRESSION;
+
 	if (device)
 		device_override = true;
 
-	bos = malloc(MAX_BO_COUNT * sizeof(bos[0]));
+	bos = calloc(MAX_BO_COUNT, sizeof(bos[0]));
 	fail_if(bos == NULL, "intel_aubdump: out of memory\n");
 
 	file = fopen(filename, "w+");
 	fail_if(file == NULL, "intel_aubdump: failed to open file '%s'\n", filename);
+	setvbuf(file, NULL, _IONBF, 0);
+
+	fail_if(pthread_atfork(NULL, NULL, out_atfork_child),
+		"intel_aubdump: failed to register fork handler\n");
 }
 
 static void __attribute__ ((destructor))
 fini(void)
 {
+	out_finish();
 	free(filename);
 	fclose(file);
 	free(bos);
+	free(gtt.holes);
+
+	if (shadow.image) {
+		for (uint64_t i = 0; i < shadow.num_pages; i++)
+			free(shadow.image[i]);
+		free(shadow.image);
+	}
+	free(shadow.hash);
 }
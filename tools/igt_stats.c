@@ -22,55 +22,147 @@
  *
  */
 
-/* Simple tool to print statistics on incoming line buffers intervals */
+/*
+ * Simple tool to print statistics on incoming line buffers intervals, or
+ * to compare two sets of benchmark results.
+ */
 
-#define _ISOC99_SOURCE
+#define _GNU_SOURCE
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <unistd.h>
 
 #include "igt_stats.h"
 
-static void statify(FILE *file, const char *name)
+#define BATCH 4096
+
+struct batch {
+	igt_stats_t *stats;
+	uint64_t values[BATCH];
+	unsigned int count;
+};
+
+static void flush(struct batch *batch)
 {
-	igt_stats_t stats;
-	char *line = NULL;
-	size_t line_len = 0;
+	igt_stats_push_array(batch->stats, batch->values, batch->count);
+	batch->count = 0;
+}
 
-	igt_stats_init(&stats);
-	while (getline(&line, &line_len, file) != -1) {
-		char *end, *start = line;
-		union {
-			unsigned long long u64;
-			double fp;
-		} u;
-		int is_float;
-
-		is_float = 0;
-		u.u64 = strtoull(start, &end, 0);
-		if (*end == '.') {
-			u.fp = strtod(start, &end);
-			is_float = 1;
+static void push(struct batch *batch, uint64_t value)
+{
+	batch->values[batch->count++] = value;
+	if (batch->count == BATCH)
+		flush(batch);
+}
+
+/*
+ * Takes all the numbers from the start of each line up to the first thing
+ * that isn't one, as strtoull() or, with a decimal point, strtod() read
+ * them. Plain decimal integers are read inline, anything else (hex, octal,
+ * signs, floats, too many digits) by the libc functions.
+ */
+static void parse(struct batch *batch, const char *s, const char *end)
+{
+	while (s < end) {
+		const char *t;
+		uint64_t value = 0;
+		char *e;
+
+		while (isspace((unsigned char)*s))
+			s++;
+
+		for (t = s; *t >= '0' && *t <= '9' && t - s < 19; t++)
+			value = value * 10 + *t - '0';
+
+		if (t > s && (*s != '0' || t - s == 1) &&
+		    !isdigit((unsigned char)*t) && *t != '.' && *t != 'x' && *t != 'X') {
+			push(batch, value);
+			s = t;
+			continue;
 		}
-		while (start != end) {
-			if (is_float)
-				igt_stats_push_float(&stats, u.fp);
-			else
-				igt_stats_push(&stats, u.u64);
-
-			is_float = 0;
-			u.u64 = strtoull(start = end, &end, 0);
-			if (*end == '.') {
-				u.fp = strtod(start, &end);
-				is_float = 1;
-			}
+
+		value = strtoull(s, &e, 0);
+		if (*e == '.') {
+			double fp = strtod(s, &e);
+
+			flush(batch);
+			igt_stats_push_float(batch->stats, fp);
+		} else if (e != s) {
+			push(batch, value);
+		} else {
+			/* the rest of the line isn't taken */
+			e = memchr(s, '\n', end - s);
+			if (e == NULL)
+				break;
 		}
+		s = e;
 	}
-	free(line);
+}
+
+static void load(FILE *file, igt_stats_t *stats)
+{
+	size_t size = 1 << 20, len = 0, n;
+	char *buf, *end;
+	struct batch *batch;
+
+	buf = malloc(size + 1);
+	batch = malloc(sizeof(*batch));
+	if (buf == NULL || batch == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	batch->stats = stats;
+	batch->count = 0;
+
+	/* Parse whole lines a buffer at a time, up to the end of the file */
+	do {
+		n = fread(buf + len, 1, size - len, file);
+		len += n;
+
+		end = n ? memrchr(buf, '\n', len) : buf + len;
+		if (end == NULL) {
+			if (len == size) {
+				size *= 2;
+				buf = realloc(buf, size + 1);
+				if (buf == NULL) {
+					perror("realloc");
+					exit(1);
+				}
+			}
+			continue;
+		}
+
+		*end = '\0';
+		parse(batch, buf, end);
+
+		len -= end - buf;
+		if (len) {
+			len--;
+			memmove(buf, end + 1, len);
+		}
+	} while (n);
+	flush(batch);
+	free(batch);
+	free(buf);
+}
+
+static void statify(FILE *file, const char *name)
+{
+	igt_stats_t stats;
+
+	igt_stats_init(&stats);
+	load(file, &stats);
 
 	if (name)
 		printf("%s: ", name);
@@ -80,14 +172,406 @@ static void statify(FILE *file, const char *name)
 	igt_stats_fini(&stats);
 }
 
+/* A set of results to compare, without its outliers */
+struct sample {
+	const char *name;
+	double *values;
+	unsigned int count;
+	unsigned int outliers;
+	double median, trimean;
+};
+
+static void load_sample(struct sample *sample, const char *name,
+			bool keep_outliers)
+{
+	double q1, q3, lo = -HUGE_VAL, hi = HUGE_VAL;
+	igt_stats_t stats;
+	unsigned int i;
+	FILE *file;
+
+	file = fopen(name, "r");
+	if (file == NULL) {
+		perror(name);
+		exit(2);
+	}
+
+	igt_stats_init(&stats);
+	load(file, &stats);
+	fclose(file);
+
+	if (stats.n_values < 3) {
+		fprintf(stderr, "%s: not enough values to compare\n", name);
+		exit(2);
+	}
+
+	/* Tukey's fences */
+	if (!keep_outliers) {
+		igt_stats_get_quartiles(&stats, &q1, NULL, &q3);
+		lo = q1 - 1.5 * (q3 - q1);
+		hi = q3 + 1.5 * (q3 - q1);
+	}
+
+	sample->name = name;
+	sample->values = malloc(stats.n_values * sizeof(*sample->values));
+	if (sample->values == NULL) {
+		perror("malloc");
+		exit(2);
+	}
+	sample->count = 0;
+	for (i = 0; i < stats.n_values; i++) {
+		double v = stats.is_float ? stats.values_f[i] : stats.values_u64[i];
+
+		if (v >= lo && v <= hi)
+			sample->values[sample->count++] = v;
+	}
+	sample->outliers = stats.n_values - sample->count;
+	igt_stats_fini(&stats);
+
+	igt_stats_init_with_size(&stats, sample->count);
+	for (i = 0; i < sample->count; i++)
+		igt_stats_push_float(&stats, sample->values[i]);
+	sample->median = igt_stats_get_median(&stats);
+	sample->trimean = igt_stats_get_trimean(&stats);
+	igt_stats_fini(&stats);
+}
+
+/*
+ * Each resample gets a generator of its own seeded with its index, so the
+ * results don't depend on how the resamples are spread over the threads.
+ */
+static uint64_t splitmix64(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+struct bootstrap {
+	const struct sample *old, *new;
+	unsigned int resamples, threads;
+	double *median, *trimean; /* differences, one per resample */
+};
+
+struct bootstrap_thread {
+	struct bootstrap *bootstrap;
+	unsigned int first;
+	pthread_t thread;
+};
+
+static void resample(const struct sample *sample, uint64_t *rng,
+		     double *median, double *trimean)
+{
+	igt_stats_t stats;
+	unsigned int i;
+
+	igt_stats_init_with_size(&stats, sample->count);
+	for (i = 0; i < sample->count; i++)
+		igt_stats_push_float(&stats, sample->values[splitmix64(rng) %
+							    sample->count]);
+	*median = igt_stats_get_median(&stats);
+	*trimean = igt_stats_get_trimean(&stats);
+	igt_stats_fini(&stats);
+}
+
+static void *bootstrap_thread(void *arg)
+{
+	struct bootstrap_thread *t = arg;
+	struct bootstrap *b = t->bootstrap;
+	unsigned int r;
+
+	for (r = t->first; r < b->resamples; r += b->threads) {
+		double old_median, old_trimean, new_median, new_trimean;
+		uint64_t rng = r;
+
+		resample(b->old, &rng, &old_median, &old_trimean);
+		resample(b->new, &rng, &new_median, &new_trimean);
+
+		b->median[r] = new_median - old_median;
+		b->trimean[r] = new_trimean - old_trimean;
+	}
+
+	return NULL;
+}
+
+static int cmp_double(const void *pa, const void *pb)
+{
+	const double *a = pa, *b = pb;
+
+	return (*a > *b) - (*a < *b);
+}
+
+/* The 95% percentile interval of the differences */
+static void confidence(double *diff, unsigned int count, double *lo, double *hi)
+{
+	uint64_t last = count - 1;
+
+	/* The 2.5th and 97.5th percentiles, rounded outwards */
+	qsort(diff, count, sizeof(*diff), cmp_double);
+	*lo = diff[last * 25 / 1000];
+	*hi = diff[(last * 975 + 999) / 1000];
+}
+
+static void bootstrap(struct bootstrap *b)
+{
+	struct bootstrap_thread *threads;
+	unsigned int i;
+
+	b->median = malloc(b->resamples * sizeof(*b->median));
+	b->trimean = malloc(b->resamples * sizeof(*b->trimean));
+	threads = calloc(b->threads, sizeof(*threads));
+	if (b->median == NULL || b->trimean == NULL || threads == NULL) {
+		perror("malloc");
+		exit(2);
+	}
+
+	for (i = 0; i < b->threads; i++) {
+		threads[i].bootstrap = b;
+		threads[i].first = i;
+		if (pthread_create(&threads[i].thread, NULL,
+				   bootstrap_thread, &threads[i])) {
+			perror("pthread_create");
+			exit(2);
+		}
+	}
+
+	for (i = 0; i < b->threads; i++)
+		pthread_join(threads[i].thread, NULL);
+
+	free(threads);
+}
+
+struct ranked {
+	double value;
+	bool old;
+};
+
+static int cmp_ranked(const void *pa, const void *pb)
+{
+	const struct ranked *a = pa, *b = pb;
+
+	return (a->value > b->value) - (a->value < b->value);
+}
+
+/*
+ * Mann-Whitney U test, with average ranks for ties and the normal
+ * approximation corrected for them and for continuity.
+ *
+ * Returns: the two-sided p-value that both sets come from the same
+ * distribution
+ */
+static double mann_whitney(const struct sample *old, const struct sample *new,
+			   double *u)
+{
+	unsigned int n = old->count + new->count, i, j;
+	double n1 = old->count, n2 = new->count;
+	double rank_sum = 0., ties = 0., mean, sigma, z;
+	struct ranked *all;
+
+	all = malloc(n * sizeof(*all));
+	if (all == NULL) {
+		perror("malloc");
+		exit(2);
+	}
+	for (i = 0; i < old->count; i++)
+		all[i] = (struct ranked){ old->values[i], true };
+	for (i = 0; i < new->count; i++)
+		all[old->count + i] = (struct ranked){ new->values[i], false };
+	qsort(all, n, sizeof(*all), cmp_ranked);
+
+	for (i = 0; i < n; i = j) {
+		double t, rank;
+
+		for (j = i + 1; j < n && all[j].value == all[i].value; j++)
+			;
+
+		t = j - i;
+		rank = (i + 1 + j) / 2.;
+		ties += t * t * t - t;
+
+		for (; i < j; i++)
+			if (all[i].old)
+				rank_sum += rank;
+	}
+	free(all);
+
+	*u = rank_sum - n1 * (n1 + 1) / 2;
+
+	mean = n1 * n2 / 2;
+	sigma = sqrt(n1 * n2 / 12 * ((n + 1) - ties / ((double)n * (n - 1))));
+	if (sigma == 0.)
+		return 1.;
+
+	z = (fabs(*u - mean) - .5) / sigma;
+	if (z < 0.)
+		z = 0.;
+
+	return erfc(z / sqrt(2));
+}
+
+static void print_sample(const struct sample *sample)
+{
+	printf("%s: %u values, %u outliers, median %f, trimean %f\n",
+	       sample->name, sample->count, sample->outliers,
+	       sample->median, sample->trimean);
+}
+
+static void print_difference(const char *what, double old, double new,
+			     double lo, double hi)
+{
+	printf("%s: %+f (%+.2f%%), 95%% CI [%+f, %+f]\n",
+	       what, new - old, old ? 100. * (new - old) / old : 0., lo, hi);
+}
+
+/*
+ * A change is significant when the Mann-Whitney U test rejects the sets
+ * being the same at 5%, and the bootstrapped 95% confidence interval of
+ * the difference of the trimeans doesn't include 0, which rules out both
+ * tiny shifts of large samples and flukes of small ones.
+ */
+static int compare(const char *old_name, const char *new_name,
+		   unsigned int resamples, unsigned int threads,
+		   bool keep_outliers)
+{
+	struct sample old, new;
+	struct bootstrap b;
+	double median_lo, median_hi, trimean_lo, trimean_hi, u, p;
+	bool significant;
+
+	load_sample(&old, old_name, keep_outliers);
+	load_sample(&new, new_name, keep_outliers);
+
+	b.old = &old;
+	b.new = &new;
+	b.resamples = resamples;
+	b.threads = threads;
+	bootstrap(&b);
+	confidence(b.median, resamples, &median_lo, &median_hi);
+	confidence(b.trimean, resamples, &trimean_lo, &trimean_hi);
+
+	p = mann_whitney(&old, &new, &u);
+	significant = p < 0.05 && (trimean_lo > 0. || trimean_hi < 0.);
+
+	print_sample(&old);
+	print_sample(&new);
+	print_difference("median", old.median, new.median,
+			 median_lo, median_hi);
+	print_difference("trimean", old.trimean, new.trimean,
+			 trimean_lo, trimean_hi);
+	printf("Mann-Whitney U: %.1f, p = %.4f\n", u, p);
+	printf("%s\n", significant ? "significant" : "not significant");
+
+	free(b.median);
+	free(b.trimean);
+	free(old.values);
+	free(new.values);
+
+	return significant;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [FILE...]\n"
+		"       %s -c [-r RESAMPLES] [-j THREADS] [-k] OLD NEW\n"
+		"\n"
+		"Prints the trimean of the numbers in each FILE, or stdin.\n"
+		"\n"
+		"With -c, compares the results in OLD and NEW, reporting the\n"
+		"differences of their medians and trimeans with bootstrapped 95%%\n"
+		"confidence intervals and a Mann-Whitney U test, after dropping\n"
+		"the values outside 1.5 IQR of the quartiles unless -k is given.\n"
+		"Exits with 1 if the difference is significant.\n"
+		"\n"
+		"  -r RESAMPLES  bootstrap resamples (default 10000)\n"
+		"  -j THREADS    threads to resample with (default: cpus online)\n"
+		"  -k            keep the outliers\n",
+		name, name);
+}
+
+/* The argument of -r or -j, 0 if it isn't a positive number */
+static unsigned int parse_count(const char *arg)
+{
+	unsigned long count;
+	char *end;
+
+	if (!isdigit((unsigned char)*arg))
+		return 0;
+
+	errno = 0;
+	count = strtoul(arg, &end, 10);
+	if (errno || *end || count > UINT_MAX)
+		return 0;
+
+	return count;
+}
+
 int main(int argc, char **argv)
 {
-	if (argc == 1) {
+	unsigned int resamples = 10000, threads = 0;
+	bool comparison = false, keep_outliers = false;
+	int c;
+
+	while ((c = getopt(argc, argv, "cr:j:kh")) != -1) {
+		switch (c) {
+		case 'c':
+			comparison = true;
+			break;
+		case 'r':
+			resamples = parse_count(optarg);
+			if (resamples == 0) {
+				fprintf(stderr, "invalid number of resamples: %s\n",
+					optarg);
+				usage(argv[0]);
+				return 2;
+			}
+			break;
+		case 'j':
+			threads = parse_count(optarg);
+			if (threads == 0) {
+				fprintf(stderr, "invalid number of threads: %s\n",
+					optarg);
+				usage(argv[0]);
+				return 2;
+			}
+			break;
+		case 'k':
+			keep_outliers = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (comparison) {
+		if (argc - optind != 2) {
+			usage(argv[0]);
+			return 2;
+		}
+
+		if (threads == 0) {
+			long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+			threads = cpus > 0 ? cpus : 1;
+		}
+		if (threads > resamples)
+			threads = resamples;
+
+		return compare(argv[optind], argv[optind + 1],
+			       resamples, threads, keep_outliers);
+	}
+
+	if (optind == argc) {
 		statify(stdin, NULL);
 	} else {
 		int i;
 
-		for (i = 1; i < argc; i++) {
+		for (i = optind; i < argc; i++) {
 			FILE *file;
 
 			file = fopen(argv[i], "r");
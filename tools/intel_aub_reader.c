@@ -0,0 +1,324 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "intel_aub.h"
+#include "intel_aub_reader.h"
+
+/* How much of a plain file to map at a time */
+#define AUB_WINDOW_SIZE (64 << 20)
+
+struct aub_reader {
+	char *filename;
+	int fd;
+	gzFile gz;	/* NULL when mmapping */
+
+	/* The part of the stream held in memory, [base, base + len) */
+	uint8_t *window;
+	uint64_t base;
+	size_t len, alloc;
+
+	uint64_t pos;
+	uint64_t size;	/* only valid once eof is set */
+	bool eof;
+
+	uint32_t version;
+	bool gen8;
+};
+
+static const uint8_t *
+map_window(struct aub_reader *r, uint64_t pos, size_t len)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	uint64_t base;
+	size_t map_len;
+	void *ptr;
+
+	if (pos + len > r->size)
+		return NULL;
+
+	if (r->window) {
+		if (pos >= r->base && pos + len <= r->base + r->len)
+			return r->window + (pos - r->base);
+
+		munmap(r->window, r->len);
+		r->window = NULL;
+	}
+
+	base = pos & ~(uint64_t)(page_size - 1);
+	map_len = AUB_WINDOW_SIZE;
+	if (map_len < pos + len - base)
+		map_len = pos + len - base;
+	if (map_len > r->size - base)
+		map_len = r->size - base;
+
+	ptr = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, r->fd, base);
+	if (ptr == MAP_FAILED) {
+		fprintf(stderr, "Failed to map %s: %s\n",
+			r->filename, strerror(errno));
+		return NULL;
+	}
+	madvise(ptr, map_len, MADV_SEQUENTIAL);
+
+	r->window = ptr;
+	r->base = base;
+	r->len = map_len;
+
+	return r->window + (pos - r->base);
+}
+
+static const uint8_t *
+read_window(struct aub_reader *r, uint64_t pos, size_t len)
+{
+	size_t need;
+
+	/* Drop what has already been consumed once it is worth the copy */
+	if (pos - r->base > r->alloc / 2 || pos + len - r->base > r->alloc) {
+		size_t keep = r->len - (pos - r->base);
+
+		memmove(r->window, r->window + (pos - r->base), keep);
+		r->base = pos;
+		r->len = keep;
+	}
+
+	need = pos + len - r->base;
+	if (need > r->alloc) {
+		size_t alloc = r->alloc ? r->alloc : 1 << 20;
+
+		while (alloc < need)
+			alloc *= 2;
+
+		r->window = realloc(r->window, alloc);
+		if (r->window == NULL) {
+			fprintf(stderr, "Out of memory reading %s\n",
+				r->filename);
+			exit(1);
+		}
+		r->alloc = alloc;
+	}
+
+	while (r->len < need && !r->eof) {
+		int ret = gzread(r->gz, r->window + r->len, r->alloc - r->len);
+
+		if (ret < 0) {
+			int err;
+
+			fprintf(stderr, "Failed to read %s: %s\n",
+				r->filename, gzerror(r->gz, &err));
+			return NULL;
+		}
+
+		if (ret == 0) {
+			r->eof = true;
+			r->size = r->base + r->len;
+		}
+		r->len += ret;
+	}
+
+	if (r->len < need)
+		return NULL;
+
+	return r->window + (pos - r->base);
+}
+
+/* Make [pos, pos + len) of the stream resident and return a pointer to it */
+static const uint8_t *
+aub_reader_peek(struct aub_reader *r, uint64_t pos, size_t len)
+{
+	if (r->gz)
+		return read_window(r, pos, len);
+	else
+		return map_window(r, pos, len);
+}
+
+struct aub_reader *
+aub_reader_open(const char *filename)
+{
+	struct aub_reader *r;
+	struct stat st;
+	uint8_t magic[2];
+
+	r = calloc(1, sizeof(*r));
+	if (r == NULL)
+		return NULL;
+
+	r->filename = strdup(filename);
+	if (!strcmp(filename, "-"))
+		r->fd = dup(fileno(stdin));
+	else
+		r->fd = open(filename, O_RDONLY);
+	if (r->fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n",
+			filename, strerror(errno));
+		goto err;
+	}
+
+	/*
+	 * Plain files are mapped. Everything else, compressed files
+	 * and pipes, is streamed through zlib.
+	 */
+	if (fstat(r->fd, &st) == 0 && S_ISREG(st.st_mode) &&
+	    (pread(r->fd, magic, 2, 0) != 2 ||
+	     magic[0] != 0x1f || magic[1] != 0x8b)) {
+		r->size = st.st_size;
+		r->eof = true;
+		return r;
+	}
+
+	r->gz = gzdopen(r->fd, "r");
+	if (r->gz == NULL) {
+		fprintf(stderr, "Failed to open %s\n", filename);
+		goto err;
+	}
+
+	return r;
+
+err:
+	if (r->fd >= 0)
+		close(r->fd);
+	free(r->filename);
+	free(r);
+	return NULL;
+}
+
+void
+aub_reader_close(struct aub_reader *r)
+{
+	if (r->gz) {
+		free(r->window);
+		gzclose(r->gz);
+	} else {
+		if (r->window)
+			munmap(r->window, r->len);
+		close(r->fd);
+	}
+
+	free(r->filename);
+	free(r);
+}
+
+/**
+ * aub_reader_next:
+ * @r: the reader
+ * @block: filled in with the next block
+ *
+ * Returns 1 when a block was read, 0 at the end of the file and -1 if the
+ * file is truncated or malformed.
+ */
+int
+aub_reader_next(struct aub_reader *r, struct aub_block *block)
+{
+	const uint32_t *p;
+	uint32_t dw0, dwords;
+	uint64_t len;
+
+	p = (const uint32_t *)aub_reader_peek(r, r->pos, 4);
+	if (p == NULL) {
+		if (r->eof && r->pos == r->size)
+			return 0;
+		goto truncated;
+	}
+
+	dw0 = p[0];
+	if ((dw0 & 0xe0000000) != CMD_AUB) {
+		fprintf(stderr, "%s: invalid AUB block 0x%08x at offset %llu\n",
+			r->filename, dw0, (long long)r->pos);
+		return -1;
+	}
+
+	memset(block, 0, sizeof(*block));
+	block->offset = r->pos;
+	block->opcode = dw0 & 0xffff0000;
+	dwords = (dw0 & 0xffff) + 2;
+	len = 4 * dwords;
+
+	p = (const uint32_t *)aub_reader_peek(r, r->pos, len);
+	if (p == NULL)
+		goto truncated;
+
+	if (block->opcode == CMD_AUB_TRACE_HEADER_BLOCK) {
+		if (dwords < 5) {
+			fprintf(stderr, "%s: short trace header at offset %llu\n",
+				r->filename, (long long)r->pos);
+			return -1;
+		}
+
+		block->operation = p[1] & AUB_TRACE_OPERATION_MASK;
+		block->type = p[1] & AUB_TRACE_TYPE_MASK;
+		block->address_space = p[1] & AUB_TRACE_ADDRESS_SPACE_MASK;
+		block->subtype = p[2];
+		block->address = p[3];
+		block->size = p[4];
+		if (dwords > 5) {
+			block->address |= (uint64_t)p[5] << 32;
+			r->gen8 = true;
+		}
+
+		/* The payload is padded to a multiple of 4 bytes */
+		len += ((uint64_t)block->size + 3) & ~3ull;
+		p = (const uint32_t *)aub_reader_peek(r, r->pos, len);
+		if (p == NULL)
+			goto truncated;
+
+		block->data = p + dwords;
+	} else if (block->opcode == CMD_AUB_HEADER) {
+		r->version = p[1];
+	}
+
+	block->header = p;
+	block->header_dwords = dwords;
+	r->pos += len;
+
+	return 1;
+
+truncated:
+	fprintf(stderr, "%s: truncated block at offset %llu\n",
+		r->filename, (long long)r->pos);
+	return -1;
+}
+
+/* The version dword of the AUB header, once it has been read */
+uint32_t
+aub_reader_version(struct aub_reader *r)
+{
+	return r->version;
+}
+
+/* Whether a trace block with a 64 bit address (gen8+) has been read */
+int
+aub_reader_gen8(struct aub_reader *r)
+{
+	return r->gen8;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef INTEL_AUB_READER_H
+#define INTEL_AUB_READER_H
+
+#include <stdint.h>
+
+/*
+ * Streaming reader for AUB files, such as the ones written by
+ * intel_aubdump.
+ *
+ * Blocks are returned one at a time, in file order. Only a window of the
+ * file around the current block is kept in memory, so files of any size
+ * can be read: plain files are mmapped a window at a time, and gzip
+ * compressed files or pipes are decompressed into a buffer that never
+ * holds much more than the current block.
+ *
+ * Pointers returned in a struct aub_block are only valid until the next
+ * call to aub_reader_next().
+ */
+
+struct aub_reader;
+
+struct aub_block {
+	/* Offset of the block in the (uncompressed) stream */
+	uint64_t offset;
+
+	/* Instruction opcode, i.e. dword 0 without the length field */
+	uint32_t opcode;
+	const uint32_t *header;
+	uint32_t header_dwords;
+
+	/*
+	 * For CMD_AUB_TRACE_HEADER_BLOCK, the decoded trace header and
+	 * the size bytes of payload that follow it. Zero otherwise.
+	 */
+	uint32_t operation;	/* AUB_TRACE_OP_* */
+	uint32_t type;		/* AUB_TRACE_TYPE_* */
+	uint32_t address_space;	/* AUB_TRACE_MEMTYPE_* */
+	uint32_t subtype;
+	uint64_t address;
+	uint32_t size;
+	const void *data;
+};
+
+struct aub_reader *aub_reader_open(const char *filename);
+int aub_reader_next(struct aub_reader *r, struct aub_block *block);
+void aub_reader_close(struct aub_reader *r);
+
+uint32_t aub_reader_version(struct aub_reader *r);
+int aub_reader_gen8(struct aub_reader *r);
+
+#endif /* INTEL_AUB_READER_H */
@@ -0,0 +1,568 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Summarise the contents of an AUB file: how many bytes of each buffer type
+ * it uploads, how many execbuffers it submits to each ring and how many
+ * bytes each of them uploads, how large the batches are and which commands
+ * they contain.
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <getopt.h>
+
+#include <intel_bufmgr.h>
+
+#include "igt_stats.h"
+#include "intel_aub.h"
+#include "intel_aub_reader.h"
+
+/* Batches larger than this are only decoded up to this size */
+#define MAX_BATCH_SIZE (1 << 20)
+
+#define MI_BATCH_BUFFER_END (0xa << 23)
+
+/*
+ * Contents of the pages that batches were written to, keyed by GTT page.
+ * Since intel_aubdump only writes out pages that changed, a batch can't be
+ * decoded from the blocks of its own execbuffer alone, so we keep what we
+ * last saw of every batch page. This is bounded by the batch working set
+ * of the traced application, not by the size of the file.
+ */
+struct batch_page {
+	uint64_t page;	/* GTT page number + 1, 0 for an empty slot */
+	uint8_t *data;
+};
+
+static struct {
+	struct batch_page *slots;
+	uint64_t count, size;
+} pages;
+
+static uint64_t
+batch_page_hash(uint64_t key)
+{
+	return (key * 0x9e3779b97f4a7c15ull) >> 32;
+}
+
+static struct batch_page *
+batch_page_slot(uint64_t key)
+{
+	uint64_t mask = pages.size - 1, i;
+
+	for (i = batch_page_hash(key) & mask;
+	     pages.slots[i].page && pages.slots[i].page != key;
+	     i = (i + 1) & mask)
+		;
+
+	return &pages.slots[i];
+}
+
+static struct batch_page *
+batch_page_lookup(uint64_t page, bool create)
+{
+	struct batch_page *p;
+
+	if (create && 2 * (pages.count + 1) > pages.size) {
+		struct batch_page *old = pages.slots;
+		uint64_t old_size = pages.size;
+
+		pages.size = pages.size ? 2 * pages.size : 1024;
+		pages.slots = calloc(pages.size, sizeof(*pages.slots));
+		if (pages.slots == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+
+		for (uint64_t i = 0; i < old_size; i++) {
+			if (old[i].page)
+				*batch_page_slot(old[i].page) = old[i];
+		}
+		free(old);
+	}
+
+	if (pages.size == 0)
+		return NULL;
+
+	p = batch_page_slot(page + 1);
+	if (p->page || !create)
+		return p->page ? p : NULL;
+
+	p->page = page + 1;
+	p->data = calloc(1, 4096);
+	if (p->data == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	pages.count++;
+
+	return p;
+}
+
+/* Track writes that land on (or create) batch pages */
+static void
+batch_pages_write(const struct aub_block *b)
+{
+	bool batch = b->type == AUB_TRACE_TYPE_BATCH;
+	uint32_t offset = 0;
+
+	while (offset < b->size) {
+		uint64_t address = b->address + offset;
+		uint32_t in_page = address & 4095;
+		uint32_t len = 4096 - in_page;
+		struct batch_page *p;
+
+		if (len > b->size - offset)
+			len = b->size - offset;
+
+		p = batch_page_lookup(address >> 12, batch);
+		if (p)
+			memcpy(p->data + in_page,
+			       (const uint8_t *)b->data + offset, len);
+
+		offset += len;
+	}
+}
+
+static void
+batch_pages_fini(void)
+{
+	for (uint64_t i = 0; i < pages.size; i++)
+		free(pages.slots[i].data);
+	free(pages.slots);
+}
+
+/* Command name -> number of occurrences */
+struct opcode_count {
+	char *name;
+	uint64_t count;
+};
+
+static struct {
+	struct opcode_count *entries;
+	unsigned count, size;
+	uint64_t total;
+} opcodes;
+
+static void
+opcode_add(const char *name, size_t len)
+{
+	struct opcode_count *e;
+	unsigned i;
+
+	for (i = 0; i < opcodes.count; i++) {
+		e = &opcodes.entries[i];
+		if (strlen(e->name) == len && !memcmp(e->name, name, len))
+			goto found;
+	}
+
+	if (opcodes.count == opcodes.size) {
+		opcodes.size = opcodes.size ? 2 * opcodes.size : 64;
+		opcodes.entries = realloc(opcodes.entries,
+					  opcodes.size * sizeof(*opcodes.entries));
+		if (opcodes.entries == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+
+	e = &opcodes.entries[opcodes.count++];
+	e->name = strndup(name, len);
+	e->count = 0;
+
+found:
+	e->count++;
+	opcodes.total++;
+
+	/* Keep the most frequent commands near the front */
+	while (e > opcodes.entries && e[-1].count < e->count) {
+		struct opcode_count tmp = e[-1];
+
+		e[-1] = *e;
+		*e = tmp;
+		e--;
+	}
+}
+
+struct aub_stat {
+	struct drm_intel_decode *ctx;
+	uint32_t devid;
+	bool decode;
+
+	uint64_t blocks;
+	uint64_t type_bytes[256];
+	uint64_t gtt_entry_bytes;
+	uint64_t other_bytes;
+	uint64_t ring_execs[256];
+	uint64_t unterminated;
+	uint64_t exec_bytes;
+
+	igt_stats_t bytes_per_exec;
+	igt_stats_t batch_size;
+};
+
+static const char *
+type_name(unsigned type)
+{
+	static const char *names[] = {
+		[AUB_TRACE_TYPE_NOTYPE >> 8] = "notype",
+		[AUB_TRACE_TYPE_BATCH >> 8] = "batch",
+		[AUB_TRACE_TYPE_VERTEX_BUFFER >> 8] = "vertex buffer",
+		[AUB_TRACE_TYPE_2D_MAP >> 8] = "2d map",
+		[AUB_TRACE_TYPE_CUBE_MAP >> 8] = "cube map",
+		[AUB_TRACE_TYPE_VOLUME_MAP >> 8] = "volume map",
+		[AUB_TRACE_TYPE_1D_MAP >> 8] = "1d map",
+		[AUB_TRACE_TYPE_CONSTANT_BUFFER >> 8] = "constant buffer",
+		[AUB_TRACE_TYPE_CONSTANT_URB >> 8] = "constant urb",
+		[AUB_TRACE_TYPE_INDEX_BUFFER >> 8] = "index buffer",
+		[AUB_TRACE_TYPE_GENERAL >> 8] = "general",
+		[AUB_TRACE_TYPE_SURFACE >> 8] = "surface",
+	};
+
+	if (type < sizeof(names) / sizeof(names[0]) && names[type])
+		return names[type];
+
+	return "unknown";
+}
+
+static const char *
+ring_name(unsigned type)
+{
+	switch (type << 8) {
+	case AUB_TRACE_TYPE_RING_HWB: return "hwb";
+	case AUB_TRACE_TYPE_RING_PRB0: return "render";
+	case AUB_TRACE_TYPE_RING_PRB1: return "bsd";
+	case AUB_TRACE_TYPE_RING_PRB2: return "blt";
+	default: return "unknown";
+	}
+}
+
+/*
+ * Run the batch through the libdrm decoder and count the commands it
+ * names. The first line of every command has the form
+ * "0x<offset>: <info> 0x<dword>: <NAME>..." while the lines for the
+ * following dwords are indented further.
+ *
+ * Returns the size of the batch up to and including MI_BATCH_BUFFER_END,
+ * or 0 if it does not contain one.
+ */
+static uint32_t
+decode_batch(struct aub_stat *s, uint32_t *data, uint32_t offset, uint32_t count)
+{
+	uint32_t size = 0;
+	char *text = NULL, *line, *next;
+	size_t text_len = 0;
+	FILE *out;
+
+	out = open_memstream(&text, &text_len);
+	if (out == NULL)
+		return 0;
+
+	drm_intel_decode_set_output_file(s->ctx, out);
+	drm_intel_decode_set_batch_pointer(s->ctx, data, offset, count);
+	drm_intel_decode(s->ctx);
+	fclose(out);
+
+	for (line = text; line && *line; line = next) {
+		char *name, *end;
+		uint32_t address;
+
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+
+		if (strncmp(line, "0x", 2))
+			continue;
+		address = strtoul(line, &end, 16);
+		if (*end != ':')
+			continue;
+
+		name = strstr(end + 1, ": ");
+		if (name == NULL || name[2] == ' ')
+			continue;
+		name += 2;
+
+		opcode_add(name, strcspn(name, " :("));
+		if (!strncmp(name, "MI_BATCH_BUFFER_END", 19)) {
+			size = address - offset + 4;
+			break;
+		}
+	}
+
+	free(text);
+	return size;
+}
+
+/* Find the batch started by a ring command and record its size and contents */
+static void
+stat_batch(struct aub_stat *s, uint64_t address)
+{
+	uint32_t *data, count = 0, size = 0;
+
+	data = malloc(MAX_BATCH_SIZE);
+	if (data == NULL)
+		return;
+
+	/* Gather the contiguous pages we know of */
+	while (4 * count < MAX_BATCH_SIZE) {
+		uint64_t addr = address + 4 * count;
+		struct batch_page *p = batch_page_lookup(addr >> 12, false);
+		uint32_t len = 4096 - (addr & 4095);
+
+		if (p == NULL)
+			break;
+
+		if (len > MAX_BATCH_SIZE - 4 * count)
+			len = MAX_BATCH_SIZE - 4 * count;
+		memcpy(data + count, p->data + (addr & 4095), len);
+		count += len / 4;
+	}
+
+	if (s->decode && count) {
+		size = decode_batch(s, data, address, count);
+	} else {
+		for (uint32_t i = 0; i < count; i++) {
+			if (data[i] == MI_BATCH_BUFFER_END) {
+				size = 4 * (i + 1);
+				break;
+			}
+		}
+	}
+
+	if (size)
+		igt_stats_push(&s->batch_size, size);
+	else
+		s->unterminated++;
+
+	free(data);
+}
+
+static void
+stat_exec(struct aub_stat *s, struct aub_reader *r, const struct aub_block *b)
+{
+	const uint32_t *ring = b->data;
+
+	s->ring_execs[b->type >> 8]++;
+
+	if (s->ctx == NULL) {
+		/* AUB files do not record the device, guess one of the right gen */
+		if (s->devid == 0)
+			s->devid = aub_reader_gen8(r) ? 0x1616 : 0x0166;
+		s->ctx = drm_intel_decode_context_alloc(s->devid);
+		drm_intel_decode_set_dump_past_end(s->ctx, 0);
+	}
+
+	for (uint32_t i = 0; i < b->size / 4; i++) {
+		uint64_t address;
+
+		if ((ring[i] & 0xff800000) != AUB_MI_BATCH_BUFFER_START)
+			continue;
+		if (i + 1 >= b->size / 4)
+			break;
+
+		address = ring[i + 1];
+		if ((ring[i] & 0xff) >= 1 && i + 2 < b->size / 4)
+			address |= (uint64_t)ring[i + 2] << 32;
+
+		stat_batch(s, address);
+		break;
+	}
+
+	igt_stats_push(&s->bytes_per_exec, s->exec_bytes);
+	s->exec_bytes = 0;
+}
+
+static void print_stats(const char *name, igt_stats_t *stats)
+{
+	double q1, q2, q3;
+
+	if (stats->n_values == 0) {
+		printf("  %-24s: no samples\n", name);
+		return;
+	}
+
+	igt_stats_get_quartiles(stats, &q1, &q2, &q3);
+	printf("  %-24s: min %"PRIu64", q1 %.0f, median %.0f, q3 %.0f, max %"PRIu64", mean %.1f\n",
+	       name, igt_stats_get_min(stats), q1, q2, q3,
+	       igt_stats_get_max(stats), igt_stats_get_mean(stats));
+}
+
+static int
+aub_stat(const char *filename, uint32_t devid, bool decode)
+{
+	struct aub_stat s = { .devid = devid, .decode = decode };
+	struct aub_reader *r;
+	struct aub_block b;
+	uint64_t total = 0;
+	int ret;
+
+	r = aub_reader_open(filename);
+	if (r == NULL)
+		return 1;
+
+	igt_stats_init(&s.bytes_per_exec);
+	igt_stats_init(&s.batch_size);
+
+	while ((ret = aub_reader_next(r, &b)) > 0) {
+		s.blocks++;
+
+		if (b.opcode != CMD_AUB_TRACE_HEADER_BLOCK)
+			continue;
+
+		switch (b.operation) {
+		case AUB_TRACE_OP_DATA_WRITE:
+			if (b.address_space == AUB_TRACE_MEMTYPE_GTT_ENTRY) {
+				s.gtt_entry_bytes += b.size;
+				break;
+			}
+
+			s.type_bytes[b.type >> 8] += b.size;
+			s.exec_bytes += b.size;
+			if (b.address_space == AUB_TRACE_MEMTYPE_GTT)
+				batch_pages_write(&b);
+			break;
+
+		case AUB_TRACE_OP_COMMAND_WRITE:
+			stat_exec(&s, r, &b);
+			break;
+
+		default:
+			s.other_bytes += b.size;
+			break;
+		}
+	}
+
+	printf("%s: AUB version %d.%d, %"PRIu64" blocks%s\n", filename,
+	       aub_reader_version(r) >> AUB_HEADER_MAJOR_SHIFT,
+	       (aub_reader_version(r) >> AUB_HEADER_MINOR_SHIFT) & 0xff,
+	       s.blocks, ret < 0 ? " (truncated)" : "");
+
+	for (unsigned i = 0; i < 256; i++)
+		total += s.type_bytes[i];
+	printf("  %-24s: %"PRIu64"\n", "bytes written", total);
+	for (unsigned i = 0; i < 256; i++) {
+		if (!s.type_bytes[i])
+			continue;
+		printf("    %-22s: %"PRIu64" (%.1f%%)\n", type_name(i),
+		       s.type_bytes[i], 100. * s.type_bytes[i] / total);
+	}
+	printf("  %-24s: %"PRIu64"\n", "GTT entry bytes", s.gtt_entry_bytes);
+	if (s.other_bytes)
+		printf("  %-24s: %"PRIu64"\n", "other trace bytes", s.other_bytes);
+
+	printf("  %-24s: %"PRIu64"\n", "execbuffers",
+	       (uint64_t)s.bytes_per_exec.n_values);
+	for (unsigned i = 0; i < 256; i++) {
+		if (s.ring_execs[i])
+			printf("    %-22s: %"PRIu64"\n", ring_name(i), s.ring_execs[i]);
+	}
+
+	print_stats("bytes per exec", &s.bytes_per_exec);
+	print_stats("batch size (B)", &s.batch_size);
+	if (s.unterminated)
+		printf("  %-24s: %"PRIu64"\n", "incomplete batches", s.unterminated);
+
+	if (opcodes.total) {
+		printf("  commands (decoded as devid 0x%04x):\n", s.devid);
+		for (unsigned i = 0; i < opcodes.count; i++)
+			printf("    %-40s: %"PRIu64" (%.1f%%)\n",
+			       opcodes.entries[i].name, opcodes.entries[i].count,
+			       100. * opcodes.entries[i].count / opcodes.total);
+	}
+
+	for (unsigned i = 0; i < opcodes.count; i++)
+		free(opcodes.entries[i].name);
+	free(opcodes.entries);
+	memset(&opcodes, 0, sizeof(opcodes));
+	batch_pages_fini();
+	memset(&pages, 0, sizeof(pages));
+
+	igt_stats_fini(&s.bytes_per_exec);
+	igt_stats_fini(&s.batch_size);
+	if (s.ctx)
+		drm_intel_decode_context_free(s.ctx);
+	aub_reader_close(r);
+
+	return ret < 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [--devid=ID] [--no-decode] FILE...\n"
+		"\n"
+		"Print statistics about the contents of AUB files. Files may be\n"
+		"gzip compressed, and - reads from standard input.\n"
+		"\n"
+		"  -d, --devid=ID   Decode batches for this PCI ID\n"
+		"  -n, --no-decode  Do not decode batches; skips the command\n"
+		"                   histogram\n",
+		name);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{"devid", 1, 0, 'd'},
+		{"no-decode", 0, 0, 'n'},
+		{"help", 0, 0, 'h'},
+		{ 0 }
+	};
+	char *devid_str = getenv("INTEL_DEVID_OVERRIDE");
+	uint32_t devid = 0;
+	bool decode = true;
+	int c, ret = 0;
+
+	while ((c = getopt_long(argc, argv, "d:nh", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'd':
+			devid_str = optarg;
+			break;
+		case 'n':
+			decode = false;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind == argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (devid_str)
+		devid = strtoul(devid_str, NULL, 0);
+
+	for (int i = optind; i < argc; i++)
+		ret |= aub_stat(argv[i], devid, decode);
+
+	return ret;
+}
@@ -0,0 +1,347 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "intel_decode_records.h"
+
+static const struct {
+	uint32_t opcode;
+	const char *name;
+} command_names[] = {
+	{ 0x00000000, "MI_NOOP" },
+	{ 0x01000000, "MI_USER_INTERRUPT" },
+	{ 0x01800000, "MI_WAIT_FOR_EVENT" },
+	{ 0x02000000, "MI_FLUSH" },
+	{ 0x02800000, "MI_ARB_CHECK" },
+	{ 0x03800000, "MI_REPORT_HEAD" },
+	{ 0x04000000, "MI_ARB_ON_OFF" },
+	{ 0x05000000, "MI_BATCH_BUFFER_END" },
+	{ 0x05800000, "MI_SUSPEND_FLUSH" },
+	{ 0x0a000000, "MI_DISPLAY_FLIP" },
+	{ 0x0b000000, "MI_SEMAPHORE_MBOX" },
+	{ 0x0c000000, "MI_SET_CONTEXT" },
+	{ 0x0e000000, "MI_SEMAPHORE_WAIT" },
+	{ 0x10000000, "MI_STORE_DATA_IMM" },
+	{ 0x10800000, "MI_STORE_DATA_INDEX" },
+	{ 0x11000000, "MI_LOAD_REGISTER_IMM" },
+	{ 0x12000000, "MI_STORE_REGISTER_MEM" },
+	{ 0x13000000, "MI_FLUSH_DW" },
+	{ 0x14800000, "MI_LOAD_REGISTER_MEM" },
+	{ 0x15000000, "MI_LOAD_REGISTER_REG" },
+	{ 0x18800000, "MI_BATCH_BUFFER_START" },
+	{ 0x1b000000, "MI_CONDITIONAL_BATCH_BUFFER_END" },
+	{ 0x40400000, "XY_SETUP_BLT" },
+	{ 0x50800000, "XY_FAST_COPY_BLT" },
+	{ 0x54000000, "XY_COLOR_BLT" },
+	{ 0x54c00000, "XY_SRC_COPY_BLT" },
+	{ 0x61010000, "STATE_BASE_ADDRESS" },
+	{ 0x69040000, "PIPELINE_SELECT" },
+	{ 0x70000000, "MEDIA_VFE_STATE" },
+	{ 0x70040000, "MEDIA_STATE_FLUSH" },
+	{ 0x71000000, "MEDIA_OBJECT" },
+	{ 0x71050000, "GPGPU_WALKER" },
+	{ 0x78080000, "3DSTATE_VERTEX_BUFFERS" },
+	{ 0x78090000, "3DSTATE_VERTEX_ELEMENTS" },
+	{ 0x780a0000, "3DSTATE_INDEX_BUFFER" },
+	{ 0x79000000, "3DSTATE_DRAWING_RECTANGLE" },
+	{ 0x7a000000, "PIPE_CONTROL" },
+	{ 0x7b000000, "3DPRIMITIVE" },
+};
+
+/* The first dword of a command without its length field */
+static uint32_t command_opcode(uint32_t cmd)
+{
+	switch (cmd >> 29) {
+	case 0x0: return cmd & 0xff800000; /* MI */
+	case 0x2: return cmd & 0xffc00000; /* 2D */
+	case 0x3: /* 3D, media and video */
+		if ((cmd >> 27 & 3) == 2)
+			return cmd & 0xfffff000;
+		return cmd & 0xffff0000;
+	default: return cmd;
+	}
+}
+
+static const char *command_name(uint32_t opcode)
+{
+	int lo = 0, hi = sizeof(command_names) / sizeof(command_names[0]);
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (command_names[mid].opcode == opcode)
+			return command_names[mid].name;
+		if (command_names[mid].opcode < opcode)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
+
+/**
+ * record_command_length:
+ * @cmd: the first dword of a command
+ *
+ * Returns: the length of the command in dwords, going by the gen4+ rules
+ */
+uint32_t record_command_length(uint32_t cmd)
+{
+	switch (cmd >> 29) {
+	case 0x0: /* MI, those below 0x10 have no length field */
+		if ((cmd >> 23 & 0x3f) < 0x10)
+			return 1;
+		return (cmd & 0xff) + 2;
+	case 0x2: /* 2D */
+		return (cmd & 0xff) + 2;
+	case 0x3:
+		switch (cmd >> 27 & 3) {
+		case 1: /* single dword */
+			return 1;
+		case 2: /* media and video */
+			return (cmd & 0xfff) + 2;
+		default:
+			return (cmd & 0xff) + 2;
+		}
+	default:
+		return 1;
+	}
+}
+
+int record_parse_format(const char *str, enum record_format *format)
+{
+	if (!strcmp(str, "text"))
+		*format = RECORD_TEXT;
+	else if (!strcmp(str, "json"))
+		*format = RECORD_JSON;
+	else if (!strcmp(str, "binary"))
+		*format = RECORD_BINARY;
+	else
+		return -1;
+
+	return 0;
+}
+
+void record_begin(FILE *out, enum record_format format)
+{
+	if (format == RECORD_BINARY)
+		fwrite("IGTREC\0\1", 8, 1, out);
+}
+
+static void json_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (; *str; str++) {
+		unsigned char c = *str;
+
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(out, "\\u%04x", c);
+		else
+			fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+static size_t binary_string_size(const char *str)
+{
+	return 2 + (str ? strlen(str) : 0);
+}
+
+static void binary_string(FILE *out, const char *str)
+{
+	uint16_t len = str ? strlen(str) : 0;
+
+	fwrite(&len, sizeof(len), 1, out);
+	fwrite(str, 1, len, out);
+}
+
+static void binary_header(FILE *out, uint32_t type, size_t size)
+{
+	struct record_header hdr = { type, size };
+
+	fwrite(&hdr, sizeof(hdr), 1, out);
+}
+
+void record_buffer(FILE *out, enum record_format format, const char *name,
+		   const char *ring, uint64_t gtt_offset, uint32_t dwords)
+{
+	if (format == RECORD_BINARY) {
+		binary_header(out, RECORD_BUFFER,
+			      sizeof(gtt_offset) + sizeof(dwords) +
+			      binary_string_size(name) +
+			      binary_string_size(ring));
+		fwrite(&gtt_offset, sizeof(gtt_offset), 1, out);
+		fwrite(&dwords, sizeof(dwords), 1, out);
+		binary_string(out, name);
+		binary_string(out, ring);
+		return;
+	}
+
+	fputs("{\"type\":\"buffer\",\"name\":", out);
+	json_string(out, name);
+	if (ring) {
+		fputs(",\"ring\":", out);
+		json_string(out, ring);
+	}
+	fprintf(out, ",\"gtt_offset\":%" PRIu64 ",\"dwords\":%u}\n",
+		gtt_offset, dwords);
+}
+
+void record_register(FILE *out, enum record_format format, const char *ring,
+		     const char *name, uint64_t value,
+		     const struct record_field *fields, int num_fields)
+{
+	int i;
+
+	if (format == RECORD_BINARY) {
+		uint32_t n = num_fields;
+		size_t size;
+
+		size = sizeof(value) + binary_string_size(ring) +
+			binary_string_size(name) + sizeof(n);
+		for (i = 0; i < num_fields; i++)
+			size += binary_string_size(fields[i].name) +
+				sizeof(fields[i].value);
+
+		binary_header(out, RECORD_REGISTER, size);
+		fwrite(&value, sizeof(value), 1, out);
+		binary_string(out, ring);
+		binary_string(out, name);
+		fwrite(&n, sizeof(n), 1, out);
+		for (i = 0; i < num_fields; i++) {
+			binary_string(out, fields[i].name);
+			fwrite(&fields[i].value, sizeof(fields[i].value), 1, out);
+		}
+		return;
+	}
+
+	fputs("{\"type\":\"register\"", out);
+	if (ring) {
+		fputs(",\"ring\":", out);
+		json_string(out, ring);
+	}
+	fputs(",\"name\":", out);
+	json_string(out, name);
+	fprintf(out, ",\"value\":%" PRIu64, value);
+	if (num_fields) {
+		fputs(",\"fields\":{", out);
+		for (i = 0; i < num_fields; i++) {
+			if (i)
+				fputc(',', out);
+			json_string(out, fields[i].name);
+			fprintf(out, ":%" PRIu64, fields[i].value);
+		}
+		fputc('}', out);
+	}
+	fputs("}\n", out);
+}
+
+/**
+ * record_command:
+ * @out: where to write the record
+ * @format: RECORD_JSON or RECORD_BINARY
+ * @data: the command
+ * @count: the number of dwords left in the buffer from @data on
+ * @address: the gtt address of @data
+ *
+ * Returns: the number of dwords the command takes up, which may be more
+ * than @count if it is truncated
+ */
+uint32_t record_command(FILE *out, enum record_format format,
+			const uint32_t *data, uint64_t count,
+			uint64_t address)
+{
+	uint32_t opcode = command_opcode(data[0]);
+	uint32_t length = record_command_length(data[0]);
+	uint32_t n = length < count ? length : count;
+	const char *name;
+	char buf[4096];
+	uint32_t i;
+	int len;
+
+	if (format == RECORD_BINARY) {
+		struct {
+			struct record_header hdr;
+			uint64_t address;
+			uint32_t opcode, length, count;
+		} __attribute__((packed)) cmd = {
+			{ RECORD_COMMAND, 20 + n * sizeof(uint32_t) },
+			address, opcode, length, n
+		};
+
+		fwrite(&cmd, sizeof(cmd), 1, out);
+		fwrite(data, sizeof(uint32_t), n, out);
+		return length;
+	}
+
+	name = command_name(opcode);
+	len = snprintf(buf, sizeof(buf),
+		       "{\"type\":\"command\",\"address\":%" PRIu64
+		       ",\"opcode\":%u%s%s%s,\"length\":%u,\"dwords\":[",
+		       address, opcode,
+		       name ? ",\"name\":\"" : "", name ? name : "",
+		       name ? "\"" : "", length);
+
+	/* Formatting the dwords by hand, a buffer at a time, is much faster */
+	for (i = 0; i < n; i++) {
+		uint32_t v = data[i];
+		char tmp[12], *p = tmp + sizeof(tmp);
+
+		*--p = i + 1 < n ? ',' : ']';
+		do {
+			*--p = '0' + v % 10;
+			v /= 10;
+		} while (v);
+
+		if (len + 12 > (int)sizeof(buf)) {
+			fwrite(buf, 1, len, out);
+			len = 0;
+		}
+		memcpy(buf + len, p, tmp + sizeof(tmp) - p);
+		len += tmp + sizeof(tmp) - p;
+	}
+	if (n == 0)
+		buf[len++] = ']';
+	fwrite(buf, 1, len, out);
+	fputs(n < length ? ",\"truncated\":true}\n" : "}\n", out);
+
+	return length;
+}
+
+/* Writes a record for each command in the buffer */
+void record_commands(FILE *out, enum record_format format,
+		     const uint32_t *data, uint64_t count, uint64_t address)
+{
+	uint64_t i = 0;
+
+	while (i < count)
+		i += record_command(out, format, data + i, count - i,
+				    address + 4 * i);
+}
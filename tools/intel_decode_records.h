@@ -0,0 +1,102 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef INTEL_DECODE_RECORDS_H
+#define INTEL_DECODE_RECORDS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Machine readable output for intel_error_decode and intel_dump_decode,
+ * as a stream of records describing buffers, the commands in them and
+ * registers, written straight from the values rather than parsed back
+ * out of the text decode.
+ *
+ * With RECORD_JSON, each record is a JSON object on a line of its own:
+ *
+ *	{"type":"buffer","name":...,"ring":...,"gtt_offset":N,"dwords":N}
+ *	{"type":"command","address":N,"opcode":N,"name":...,"length":N,
+ *	 "dwords":[N,...],"truncated":true}
+ *	{"type":"register","ring":...,"name":...,"value":N,
+ *	 "fields":{"name":N,...}}
+ *
+ * where "name" of a command, "ring" and "fields" are only present when
+ * known, and "truncated" only when the buffer ends within the command.
+ *
+ * With RECORD_BINARY, the stream starts with the 8 bytes "IGTREC\0\1"
+ * followed by records of a struct record_header and its payload, in host
+ * byte order and without any padding:
+ *
+ *	RECORD_BUFFER:   u64 gtt_offset, u32 dwords, string name, string ring
+ *	RECORD_COMMAND:  u64 address, u32 opcode, u32 length, u32 count,
+ *			 u32 dwords[count]
+ *	RECORD_REGISTER: u64 value, string ring, string name, u32 num_fields,
+ *			 { string name, u64 value }[num_fields]
+ *
+ * where a string is a u16 length followed by that many bytes, and count
+ * is less than length for a truncated command.
+ *
+ * Commands are split using the gen4+ length fields; the opcode is the
+ * first dword without its length field.
+ */
+
+enum record_format {
+	RECORD_TEXT,
+	RECORD_JSON,
+	RECORD_BINARY,
+};
+
+enum record_type {
+	RECORD_BUFFER = 1,
+	RECORD_COMMAND,
+	RECORD_REGISTER,
+};
+
+struct record_header {
+	uint32_t type;
+	uint32_t size; /* of the payload */
+};
+
+struct record_field {
+	const char *name;
+	uint64_t value;
+};
+
+int record_parse_format(const char *str, enum record_format *format);
+void record_begin(FILE *out, enum record_format format);
+
+void record_buffer(FILE *out, enum record_format format, const char *name,
+		   const char *ring, uint64_t gtt_offset, uint32_t dwords);
+void record_register(FILE *out, enum record_format format, const char *ring,
+		     const char *name, uint64_t value,
+		     const struct record_field *fields, int num_fields);
+
+uint32_t record_command_length(uint32_t cmd);
+uint32_t record_command(FILE *out, enum record_format format,
+			const uint32_t *data, uint64_t count,
+			uint64_t address);
+void record_commands(FILE *out, enum record_format format,
+		     const uint32_t *data, uint64_t count, uint64_t address);
+
+#endif /* INTEL_DECODE_RECORDS_H */
@@ -34,19 +34,190 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
 
 #include <intel_bufmgr.h>
 
+#include "intel_decode_records.h"
+
 struct drm_intel_decode *ctx;
 
+/* Text from libdrm, or records of the commands, see --format */
+static enum record_format format = RECORD_TEXT;
+
+/* The part of the input to decode, set with --offset and --length */
+static uint64_t window_offset;
+static uint64_t window_length; /* 0 for the rest of the input */
+
+/*
+ * libdrm takes an int count of dwords and prints 32 bit offsets, so
+ * larger dumps are handed over in pieces of this size.
+ */
+#define MAX_DECODE_SIZE (1ull << 32)
+
+/*
+ * Binary dumps are mapped and decoded in one go, so that commands are
+ * never split. To keep the resident set bounded on multi-GB dumps, the
+ * offsets the decoder prints at the start of each line are followed and
+ * the pages it is done with dropped once there are enough of them. They
+ * are clean file pages, so should the decoder look back any further
+ * than RECLAIM_LAG they are simply read in again.
+ */
+#define RECLAIM_SIZE (32 << 20)
+#define RECLAIM_LAG (4 << 20)
+
+static struct progress {
+	const uint8_t *map;
+	uint64_t map_offset;
+	uint64_t map_size;
+
+	uint64_t pos;		/* offset of the last line printed */
+	uint32_t last;		/* as printed, i.e. truncated to 32 bits */
+	uint64_t reclaimed;	/* [map_offset, reclaimed) has been dropped */
+
+	char line[12];		/* "0x%08x: " */
+	int line_len;
+} progress;
+
+static void progress_reclaim(struct progress *p);
+
+static void
+progress_line(struct progress *p)
+{
+	uint32_t offset, delta;
+	char *tail;
+
+	if (p->line[0] != '0' || p->line[1] != 'x' || p->line[10] != ':')
+		return;
+
+	offset = strtoul(p->line + 2, &tail, 16);
+	if (tail != p->line + 10)
+		return;
+
+	/* Only ever moves forward, wrapping past 4GiB */
+	delta = offset - p->last;
+	if (delta & 0x80000000)
+		return;
+	p->pos += delta;
+	p->last = offset;
+
+	progress_reclaim(p);
+}
+
+/* Drop the pages the decoder is done with, see struct progress */
+static void
+progress_reclaim(struct progress *p)
+{
+	uint64_t end;
+
+	if (p->pos < p->reclaimed + RECLAIM_SIZE + RECLAIM_LAG)
+		return;
+
+	end = (p->pos - RECLAIM_LAG) & ~(uint64_t)(sysconf(_SC_PAGESIZE) - 1);
+	madvise((void *)(p->map + (p->reclaimed - p->map_offset)),
+		end - p->reclaimed, MADV_DONTNEED);
+	p->reclaimed = end;
+}
+
+static ssize_t
+progress_write(void *cookie, const char *buf, size_t size)
+{
+	struct progress *p = cookie;
+	const char *end = buf + size;
+
+	if (fwrite(buf, 1, size, stdout) != size)
+		return -1;
+
+	while (buf < end) {
+		const char *nl = memchr(buf, '\n', end - buf);
+		const char *eol = nl ? nl : end;
+
+		if (p->line_len < sizeof(p->line)) {
+			size_t len = sizeof(p->line) - p->line_len;
+
+			if (len > eol - buf)
+				len = eol - buf;
+			memcpy(p->line + p->line_len, buf, len);
+			p->line_len += len;
+
+			if (p->line_len == sizeof(p->line))
+				progress_line(p);
+		}
+
+		if (nl == NULL)
+			break;
+
+		p->line_len = 0;
+		buf = nl + 1;
+	}
+
+	return size;
+}
+
+/*
+ * Compressed dumps and pipes cannot be mapped, so inflate them to an
+ * unlinked temporary file first.
+ */
+static int
+inflate_to_tmpfile(int fd, const char *filename)
+{
+	char buf[65536];
+	FILE *tmp;
+	gzFile gz;
+	int ret;
+
+	tmp = tmpfile();
+	if (tmp == NULL) {
+		fprintf (stderr, "Failed to create temporary file: %s\n",
+			 strerror (errno));
+		exit (1);
+	}
+
+	/* gzread() passes uncompressed input through unchanged */
+	gz = gzdopen(fd, "r");
+	if (gz == NULL) {
+		fprintf (stderr, "Failed to open %s\n", filename);
+		exit (1);
+	}
+
+	while ((ret = gzread (gz, buf, sizeof(buf))) > 0) {
+		if (fwrite(buf, 1, ret, tmp) != (size_t)ret) {
+			fprintf (stderr, "Failed to write temporary file: %s\n",
+				 strerror (errno));
+			exit (1);
+		}
+	}
+	if (ret < 0) {
+		int err;
+
+		fprintf (stderr, "Failed to read %s: %s\n",
+			 filename, gzerror(gz, &err));
+		exit (1);
+	}
+	gzclose (gz);
+
+	fflush(tmp);
+	fd = dup(fileno(tmp));
+	fclose(tmp);
+
+	return fd;
+}
+
 static void
 read_bin_file(const char * filename)
 {
-	uint32_t buf[16384];
-	int fd, offset, ret;
+	cookie_io_functions_t io = { .write = progress_write };
+	uint64_t start, end, size, pos;
+	uint8_t magic[2];
+	struct stat st;
+	FILE *out;
+	void *map;
+	int fd;
 
 	if (!strcmp(filename, "-"))
-		fd = fileno(stdin);
+		fd = dup(fileno(stdin));
 	else
 		fd = open (filename, O_RDONLY);
 	if (fd < 0) {
@@ -55,15 +226,104 @@ read_bin_file(const char * filename)
 		exit (1);
 	}
 
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) ||
+	    (pread(fd, magic, 2, 0) == 2 &&
+	     magic[0] == 0x1f && magic[1] == 0x8b)) {
+		fd = inflate_to_tmpfile(fd, filename);
+		if (fstat(fd, &st)) {
+			fprintf (stderr, "Failed to stat temporary file: %s\n",
+				 strerror (errno));
+			exit (1);
+		}
+	}
+	size = st.st_size;
+
+	/* An empty dump has nothing to decode */
+	if (size == 0) {
+		close(fd);
+		return;
+	}
+
+	if (window_offset >= size) {
+		fprintf (stderr, "%s: offset %llu is past the end\n",
+			 filename, (long long)window_offset);
+		close(fd);
+		return;
+	}
+
+	start = window_offset & ~3ull;
+	end = size;
+	if (window_length && window_length < size - window_offset)
+		end = window_offset + window_length;
+
+	memset(&progress, 0, sizeof(progress));
+	progress.map_offset = start & ~(uint64_t)(sysconf(_SC_PAGESIZE) - 1);
+	progress.map_size = end - progress.map_offset;
+	progress.reclaimed = progress.map_offset;
+
+	map = mmap(NULL, progress.map_size, PROT_READ, MAP_PRIVATE,
+		   fd, progress.map_offset);
+	if (map == MAP_FAILED) {
+		fprintf (stderr, "Failed to map %s: %s\n",
+			 filename, strerror (errno));
+		exit (1);
+	}
+	close(fd);
+	madvise(map, progress.map_size, MADV_SEQUENTIAL);
+	progress.map = map;
+
+	if (format != RECORD_TEXT) {
+		const uint32_t *data = (const uint32_t *)
+			(progress.map + (start - progress.map_offset));
+		uint64_t count = (end - start) / 4, i = 0;
+
+		record_buffer(stdout, format, filename, NULL, start,
+			      count > UINT32_MAX ? UINT32_MAX : count);
+		while (i < count) {
+			i += record_command(stdout, format, data + i,
+					    count - i, start + 4 * i);
+
+			progress.pos = start + 4 * i;
+			progress_reclaim(&progress);
+		}
+
+		munmap(map, progress.map_size);
+		return;
+	}
+
+	out = fopencookie(&progress, "w", io);
+	if (out == NULL) {
+		fprintf (stderr, "Out of memory.\n");
+		exit (1);
+	}
+
+	fflush(stdout);
+	drm_intel_decode_set_output_file(ctx, out);
 	drm_intel_decode_set_dump_past_end(ctx, 1);
 
-	offset = 0;
-	while ((ret = read (fd, buf, sizeof(buf))) > 0) {
-		drm_intel_decode_set_batch_pointer(ctx, buf, offset, ret/4);
+	for (pos = start; end - pos >= 4; ) {
+		uint64_t len = end - pos;
+
+		if (len > MAX_DECODE_SIZE)
+			len = MAX_DECODE_SIZE;
+
+		progress.pos = pos;
+		progress.last = pos;
+		progress.line_len = 0;
+
+		drm_intel_decode_set_batch_pointer(ctx,
+						   (void *)(progress.map + (pos - progress.map_offset)),
+						   (uint32_t)pos, len / 4);
 		drm_intel_decode(ctx);
-		offset += ret;
+		fflush(out);
+
+		pos += len & ~3ull;
 	}
-	close (fd);
+
+	fclose(out);
+	drm_intel_decode_set_output_file(ctx, stdout);
+
+	munmap(map, progress.map_size);
 }
 
 static void
@@ -75,7 +335,8 @@ read_data_file(const char * filename)
     char *line = NULL;
     size_t line_size;
     uint32_t offset, value;
-    uint32_t gtt_offset = 0;
+    uint64_t start = window_offset & ~3ull, pos = 0;
+    uint32_t gtt_offset = start;
 
 	if (!strcmp(filename, "-"))
 		file = stdin;
@@ -98,6 +359,12 @@ read_data_file(const char * filename)
 	    continue;
 	}
 
+	/* --offset and --length count bytes, as for binary dumps */
+	pos += 4;
+	if (pos <= start ||
+	    (window_length && pos > window_offset + window_length))
+	    continue;
+
 	count++;
 
 	if (count > data_size) {
@@ -112,7 +379,10 @@ read_data_file(const char * filename)
 	data[count-1] = value;
     }
 
-    if (count) {
+    if (count && format != RECORD_TEXT) {
+	record_buffer(stdout, format, filename, NULL, gtt_offset, count);
+	record_commands(stdout, format, data, count, gtt_offset);
+    } else if (count) {
 	drm_intel_decode_set_batch_pointer(ctx, data, gtt_offset, count);
 	drm_intel_decode(ctx);
     }
@@ -126,25 +396,27 @@ read_data_file(const char * filename)
 static void
 read_autodetect_file(const char * filename)
 {
-	int binary = 0, c;
-	FILE *file;
+	uint8_t buf[4096];
+	int binary = 0, fd;
+	ssize_t len, i;
 
-	file = fopen (filename, "r");
-	if (file == NULL) {
+	fd = open (filename, O_RDONLY);
+	if (fd < 0) {
 		fprintf (stderr, "Failed to open %s: %s\n",
 			 filename, strerror (errno));
 		exit (1);
 	}
 
-	while ((c = fgetc(file)) != EOF) {
-		/* totally lazy binary detector */
-		if (c < 10) {
+	/* totally lazy binary detector, the start will do */
+	len = read(fd, buf, sizeof(buf));
+	for (i = 0; i < len; i++) {
+		if (buf[i] < 10) {
 			binary = 1;
 			break;
 		}
 	}
 
-	fclose(file);
+	close(fd);
 
 	if (binary == 1)
 		read_bin_file(filename);
@@ -167,12 +439,15 @@ main (int argc, char *argv[])
 		{"devid", 1, 0, 'd'},
 		{"ascii", 0, 0, 'a'},
 		{"binary", 0, 0, 'b'},
+		{"offset", 1, 0, 'o'},
+		{"length", 1, 0, 'l'},
+		{"format", 1, 0, 'f'},
 		{ 0 }
 	};
 
 	devid_str = getenv("INTEL_DEVID_OVERRIDE");
 
-	while((c = getopt_long(argc, argv, "ad:b",
+	while((c = getopt_long(argc, argv, "ad:bo:l:f:",
 			       long_options, &option_index)) != -1) {
 		switch(c) {
 		case 'd':
@@ -184,6 +459,19 @@ main (int argc, char *argv[])
 		case 'a':
 			binary = 0;
 			break;
+		case 'o':
+			window_offset = strtoull(optarg, NULL, 0);
+			break;
+		case 'l':
+			window_length = strtoull(optarg, NULL, 0);
+			break;
+		case 'f':
+			if (record_parse_format(optarg, &format)) {
+				fprintf(stderr, "unknown format %s, expected "
+					"text, json or binary\n", optarg);
+				exit(-1);
+			}
+			break;
 		default:
 			printf("unkown command options\n");
 			break;
@@ -200,6 +488,8 @@ main (int argc, char *argv[])
 		exit(-1);
 	}
 
+	record_begin(stdout, format);
+
 	for (i = optind; i < argc; i++) {
 		/* For stdin input, let's read as data file */
 		if (!strcmp(argv[i], "-")) {
@@ -48,7 +48,9 @@
 #include <inttypes.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <pthread.h>
 #include <err.h>
+#include <getopt.h>
 #include <assert.h>
 #include <intel_bufmgr.h>
 #include <zlib.h>
@@ -58,11 +60,20 @@
 #include "instdone.h"
 #include "intel_reg.h"
 #include "drmtest.h"
+#include "igt_ascii85.h"
+#include "intel_error_index.h"
+#include "intel_decode_records.h"
+
+/* Where the text of the error state goes, see read_data_file() */
+static FILE *outfile;
+
+/* Text, or records of the buffers, commands and registers, see --format */
+static enum record_format format = RECORD_TEXT;
 
 static uint32_t
 print_head(unsigned int reg)
 {
-	printf("    head = 0x%08x, wraps = %d\n", reg & (0x7ffff<<2), reg >> 21);
+	fprintf(outfile, "    head = 0x%08x, wraps = %d\n", reg & (0x7ffff<<2), reg >> 21);
 	return reg & (0x7ffff<<2);
 }
 
@@ -73,10 +84,10 @@ print_ctl(unsigned int reg)
 
 #define BIT_STR(reg, x, on, off) ((1 << (x)) & reg) ? on : off
 
-	printf("    len=%d%s%s%s\n", ring_length,
-	       BIT_STR(reg, 0, ", enabled", ", disabled"),
-	       BIT_STR(reg, 10, ", semaphore wait ", ""),
-	       BIT_STR(reg, 11, ", rb wait ", "")
+	fprintf(outfile, "    len=%d%s%s%s\n", ring_length,
+		BIT_STR(reg, 0, ", enabled", ", disabled"),
+		BIT_STR(reg, 10, ", semaphore wait ", ""),
+		BIT_STR(reg, 11, ", rb wait ", "")
 		);
 #undef BIT_STR
 	return ring_length;
@@ -86,9 +97,9 @@ static void
 print_acthd(unsigned int reg, unsigned int ring_length)
 {
 	if ((reg & (0x7ffff << 2)) < ring_length)
-		printf("    at ring: 0x%08x\n", reg & (0x7ffff << 2));
+		fprintf(outfile, "    at ring: 0x%08x\n", reg & (0x7ffff << 2));
 	else
-		printf("    at batch: 0x%08x\n", reg);
+		fprintf(outfile, "    at batch: 0x%08x\n", reg);
 }
 
 static void
@@ -115,7 +126,7 @@ print_instdone(uint32_t devid, unsigned int instdone, unsigned int instdone1)
 		}
 
 		if (busy)
-			printf("    busy: %s\n", instdone_bits[i].name);
+			fprintf(outfile, "    busy: %s\n", instdone_bits[i].name);
 	}
 }
 
@@ -141,7 +152,7 @@ print_i830_pgtbl_err(unsigned int reg)
 	}
 
 	if (str)
-		printf("    source = %s\n", str);
+		fprintf(outfile, "    source = %s\n", str);
 
 	switch(reg & 0x7) {
 	case 0x0: str  = "Invalid GTT"; break;
@@ -153,85 +164,85 @@ print_i830_pgtbl_err(unsigned int reg)
 	case 0x6: str = "Invalid Tiling"; break;
 	case 0x7: str = "Host to CAM"; break;
 	}
-	printf("    error = %s\n", str);
+	fprintf(outfile, "    error = %s\n", str);
 }
 
 static void
 print_i915_pgtbl_err(unsigned int reg)
 {
 	if (reg & (1 << 29))
-		printf("    Cursor A: Invalid GTT PTE\n");
+		fprintf(outfile, "    Cursor A: Invalid GTT PTE\n");
 	if (reg & (1 << 28))
-		printf("    Cursor B: Invalid GTT PTE\n");
+		fprintf(outfile, "    Cursor B: Invalid GTT PTE\n");
 	if (reg & (1 << 27))
-		printf("    MT: Invalid tiling\n");
+		fprintf(outfile, "    MT: Invalid tiling\n");
 	if (reg & (1 << 26))
-		printf("    MT: Invalid GTT PTE\n");
+		fprintf(outfile, "    MT: Invalid GTT PTE\n");
 	if (reg & (1 << 25))
-		printf("    LC: Invalid tiling\n");
+		fprintf(outfile, "    LC: Invalid tiling\n");
 	if (reg & (1 << 24))
-		printf("    LC: Invalid GTT PTE\n");
+		fprintf(outfile, "    LC: Invalid GTT PTE\n");
 	if (reg & (1 << 23))
-		printf("    BIN VertexData: Invalid GTT PTE\n");
+		fprintf(outfile, "    BIN VertexData: Invalid GTT PTE\n");
 	if (reg & (1 << 22))
-		printf("    BIN Instruction: Invalid GTT PTE\n");
+		fprintf(outfile, "    BIN Instruction: Invalid GTT PTE\n");
 	if (reg & (1 << 21))
-		printf("    CS VertexData: Invalid GTT PTE\n");
+		fprintf(outfile, "    CS VertexData: Invalid GTT PTE\n");
 	if (reg & (1 << 20))
-		printf("    CS Instruction: Invalid GTT PTE\n");
+		fprintf(outfile, "    CS Instruction: Invalid GTT PTE\n");
 	if (reg & (1 << 19))
-		printf("    CS: Invalid GTT\n");
+		fprintf(outfile, "    CS: Invalid GTT\n");
 	if (reg & (1 << 18))
-		printf("    Overlay: Invalid tiling\n");
+		fprintf(outfile, "    Overlay: Invalid tiling\n");
 	if (reg & (1 << 16))
-		printf("    Overlay: Invalid GTT PTE\n");
+		fprintf(outfile, "    Overlay: Invalid GTT PTE\n");
 	if (reg & (1 << 14))
-		printf("    Display C: Invalid tiling\n");
+		fprintf(outfile, "    Display C: Invalid tiling\n");
 	if (reg & (1 << 12))
-		printf("    Display C: Invalid GTT PTE\n");
+		fprintf(outfile, "    Display C: Invalid GTT PTE\n");
 	if (reg & (1 << 10))
-		printf("    Display B: Invalid tiling\n");
+		fprintf(outfile, "    Display B: Invalid tiling\n");
 	if (reg & (1 << 8))
-		printf("    Display B: Invalid GTT PTE\n");
+		fprintf(outfile, "    Display B: Invalid GTT PTE\n");
 	if (reg & (1 << 6))
-		printf("    Display A: Invalid tiling\n");
+		fprintf(outfile, "    Display A: Invalid tiling\n");
 	if (reg & (1 << 4))
-		printf("    Display A: Invalid GTT PTE\n");
+		fprintf(outfile, "    Display A: Invalid GTT PTE\n");
 	if (reg & (1 << 1))
-		printf("    Host Invalid PTE data\n");
+		fprintf(outfile, "    Host Invalid PTE data\n");
 	if (reg & (1 << 0))
-		printf("    Host Invalid GTT PTE\n");
+		fprintf(outfile, "    Host Invalid GTT PTE\n");
 }
 
 static void
 print_i965_pgtbl_err(unsigned int reg)
 {
 	if (reg & (1 << 26))
-		printf("    Invalid Sampler Cache GTT entry\n");
+		fprintf(outfile, "    Invalid Sampler Cache GTT entry\n");
 	if (reg & (1 << 24))
-		printf("    Invalid Render Cache GTT entry\n");
+		fprintf(outfile, "    Invalid Render Cache GTT entry\n");
 	if (reg & (1 << 23))
-		printf("    Invalid Instruction/State Cache GTT entry\n");
+		fprintf(outfile, "    Invalid Instruction/State Cache GTT entry\n");
 	if (reg & (1 << 22))
-		printf("    There is no ROC, this cannot occur!\n");
+		fprintf(outfile, "    There is no ROC, this cannot occur!\n");
 	if (reg & (1 << 21))
-		printf("    Invalid GTT entry during Vertex Fetch\n");
+		fprintf(outfile, "    Invalid GTT entry during Vertex Fetch\n");
 	if (reg & (1 << 20))
-		printf("    Invalid GTT entry during Command Fetch\n");
+		fprintf(outfile, "    Invalid GTT entry during Command Fetch\n");
 	if (reg & (1 << 19))
-		printf("    Invalid GTT entry during CS\n");
+		fprintf(outfile, "    Invalid GTT entry during CS\n");
 	if (reg & (1 << 18))
-		printf("    Invalid GTT entry during Cursor Fetch\n");
+		fprintf(outfile, "    Invalid GTT entry during Cursor Fetch\n");
 	if (reg & (1 << 17))
-		printf("    Invalid GTT entry during Overlay Fetch\n");
+		fprintf(outfile, "    Invalid GTT entry during Overlay Fetch\n");
 	if (reg & (1 << 8))
-		printf("    Invalid GTT entry during Display B Fetch\n");
+		fprintf(outfile, "    Invalid GTT entry during Display B Fetch\n");
 	if (reg & (1 << 4))
-		printf("    Invalid GTT entry during Display A Fetch\n");
+		fprintf(outfile, "    Invalid GTT entry during Display A Fetch\n");
 	if (reg & (1 << 1))
-		printf("    Valid PTE references illegal memory\n");
+		fprintf(outfile, "    Valid PTE references illegal memory\n");
 	if (reg & (1 << 0))
-		printf("    Invalid GTT entry during fetch for host\n");
+		fprintf(outfile, "    Invalid GTT entry during fetch for host\n");
 }
 
 static void
@@ -249,45 +260,45 @@ print_pgtbl_err(unsigned int reg, unsigned int devid)
 static void print_ivb_error(unsigned int reg, unsigned int devid)
 {
 	if (reg & (1 << 0))
-		printf("    TLB page fault error (GTT entry not valid)\n");
+		fprintf(outfile, "    TLB page fault error (GTT entry not valid)\n");
 	if (reg & (1 << 1))
-		printf("    Invalid physical address in RSTRM interface (PAVP)\n");
+		fprintf(outfile, "    Invalid physical address in RSTRM interface (PAVP)\n");
 	if (reg & (1 << 2))
-		printf("    Invalid page directory entry error\n");
+		fprintf(outfile, "    Invalid page directory entry error\n");
 	if (reg & (1 << 3))
-		printf("    Invalid physical address in ROSTRM interface (PAVP)\n");
+		fprintf(outfile, "    Invalid physical address in ROSTRM interface (PAVP)\n");
 	if (reg & (1 << 4))
-		printf("    TLB page VTD translation generated an error\n");
+		fprintf(outfile, "    TLB page VTD translation generated an error\n");
 	if (reg & (1 << 5))
-		printf("    Invalid physical address in WRITE interface (PAVP)\n");
+		fprintf(outfile, "    Invalid physical address in WRITE interface (PAVP)\n");
 	if (reg & (1 << 6))
-		printf("    Page directory VTD translation generated error\n");
+		fprintf(outfile, "    Page directory VTD translation generated error\n");
 	if (reg & (1 << 8))
-		printf("    Cacheline containing a PD was marked as invalid\n");
+		fprintf(outfile, "    Cacheline containing a PD was marked as invalid\n");
 	if (IS_HASWELL(devid) && (reg >> 10) & 0x1f)
-		printf("    %d pending page faults\n", (reg >> 10) & 0x1f);
+		fprintf(outfile, "    %d pending page faults\n", (reg >> 10) & 0x1f);
 }
 
 static void print_snb_error(unsigned int reg)
 {
 	if (reg & (1 << 0))
-		printf("    TLB page fault error (GTT entry not valid)\n");
+		fprintf(outfile, "    TLB page fault error (GTT entry not valid)\n");
 	if (reg & (1 << 1))
-		printf("    Context page GTT translation generated a fault (GTT entry not valid)\n");
+		fprintf(outfile, "    Context page GTT translation generated a fault (GTT entry not valid)\n");
 	if (reg & (1 << 2))
-		printf("    Invalid page directory entry error\n");
+		fprintf(outfile, "    Invalid page directory entry error\n");
 	if (reg & (1 << 3))
-		printf("    HWS page GTT translation generated a page fault (GTT entry not valid)\n");
+		fprintf(outfile, "    HWS page GTT translation generated a page fault (GTT entry not valid)\n");
 	if (reg & (1 << 4))
-		printf("    TLB page VTD translation generated an error\n");
+		fprintf(outfile, "    TLB page VTD translation generated an error\n");
 	if (reg & (1 << 5))
-		printf("    Context page VTD translation generated an error\n");
+		fprintf(outfile, "    Context page VTD translation generated an error\n");
 	if (reg & (1 << 6))
-		printf("    Page directory VTD translation generated error\n");
+		fprintf(outfile, "    Page directory VTD translation generated error\n");
 	if (reg & (1 << 7))
-		printf("    HWS page VTD translation generated an error\n");
+		fprintf(outfile, "    HWS page VTD translation generated an error\n");
 	if (reg & (1 << 8))
-		printf("    Cacheline containing a PD was marked as invalid\n");
+		fprintf(outfile, "    Cacheline containing a PD was marked as invalid\n");
 }
 
 static void print_bdw_error(unsigned int reg, unsigned int devid)
@@ -295,17 +306,17 @@ static void print_bdw_error(unsigned int reg, unsigned int devid)
 	print_ivb_error(reg, devid);
 
 	if (reg & (1 << 10))
-		printf("    Non WB memory type for Advanced Context\n");
+		fprintf(outfile, "    Non WB memory type for Advanced Context\n");
 	if (reg & (1 << 11))
-		printf("    PASID not enabled\n");
+		fprintf(outfile, "    PASID not enabled\n");
 	if (reg & (1 << 12))
-		printf("    PASID boundary violation\n");
+		fprintf(outfile, "    PASID boundary violation\n");
 	if (reg & (1 << 13))
-		printf("    PASID not valid\n");
+		fprintf(outfile, "    PASID not valid\n");
 	if (reg & (1 << 14))
-		printf("    PASID was zero for untranslated request\n");
+		fprintf(outfile, "    PASID was zero for untranslated request\n");
 	if (reg & (1 << 15))
-		printf("    Context was not marked as present when doing DMA\n");
+		fprintf(outfile, "    Context was not marked as present when doing DMA\n");
 }
 
 static void
@@ -321,7 +332,7 @@ print_error(unsigned int reg, unsigned int devid)
 static void
 print_snb_fence(unsigned int devid, uint64_t fence)
 {
-	printf("    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %u\n",
+	fprintf(outfile, "    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %u\n",
 			fence & 1 ? "" : "in",
 			fence & (1<<1) ? 'y' : 'x',
 			(int)(((fence>>32)&0xfff)+1)*128,
@@ -332,7 +343,7 @@ print_snb_fence(unsigned int devid, uint64_t fence)
 static void
 print_i965_fence(unsigned int devid, uint64_t fence)
 {
-	printf("    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %u\n",
+	fprintf(outfile, "    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %u\n",
 			fence & 1 ? "" : "in",
 			fence & (1<<1) ? 'y' : 'x',
 			(int)(((fence>>2)&0x1ff)+1)*128,
@@ -349,7 +360,7 @@ print_i915_fence(unsigned int devid, uint64_t fence)
 	else
 		tile_width = 512;
 
-	printf("    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %i\n",
+	fprintf(outfile, "    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %i\n",
 			fence & 1 ? "" : "in",
 			fence & (1<<12) ? 'y' : 'x',
 			(1<<((fence>>4)&0xf))*tile_width,
@@ -360,7 +371,7 @@ print_i915_fence(unsigned int devid, uint64_t fence)
 static void
 print_i830_fence(unsigned int devid, uint64_t fence)
 {
-	printf("    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %i\n",
+	fprintf(outfile, "    %svalid, %c-tiled, pitch: %i, start: 0x%08x, size: %i\n",
 			fence & 1 ? "" : "in",
 			fence & (1<<12) ? 'y' : 'x',
 			(1<<((fence>>4)&0xf))*128,
@@ -402,22 +413,22 @@ print_fault_reg(unsigned devid, uint32_t reg)
 		return;
 
 	if (reg & (1 << 0))
-		printf("    Valid\n");
+		fprintf(outfile, "    Valid\n");
 	else
 		return;
 
 	if (intel_gen(devid) < 8)
-		printf("    %s Fault (%s)\n", gen7_types[reg >> 1 & 0x3],
-		       reg & (1 << 11) ? "GGTT" : "PPGTT");
+		fprintf(outfile, "    %s Fault (%s)\n", gen7_types[reg >> 1 & 0x3],
+			reg & (1 << 11) ? "GGTT" : "PPGTT");
 	else
-		printf("    Invalid %s Fault\n", gen8_types[reg >> 1 & 0x3]);
+		fprintf(outfile, "    Invalid %s Fault\n", gen8_types[reg >> 1 & 0x3]);
 
 	if (intel_gen(devid) < 8)
-		printf("    Address 0x%08x\n", reg & ~((1 << 12)-1));
+		fprintf(outfile, "    Address 0x%08x\n", reg & ~((1 << 12)-1));
 	else
-		printf("    Engine %s\n", engine[reg >> 12 & 0x7]);
+		fprintf(outfile, "    Engine %s\n", engine[reg >> 12 & 0x7]);
 
-	printf("    Source ID %d\n", reg >> 3 & 0xff);
+	fprintf(outfile, "    Source ID %d\n", reg >> 3 & 0xff);
 }
 
 static void
@@ -429,141 +440,617 @@ print_fault_data(unsigned devid, uint32_t data1, uint32_t data0)
 		return;
 
 	address = ((uint64_t)(data0) << 12) | ((uint64_t)data1 & 0xf) << 44;
-	printf("    Address 0x%016" PRIx64 " %s\n", address,
-	       data1 & (1 << 4) ? "GGTT" : "PPGTT");
+	fprintf(outfile, "    Address 0x%016" PRIx64 " %s\n", address,
+		data1 & (1 << 4) ? "GGTT" : "PPGTT");
 }
 
 #define MAX_RINGS 10 /* I really hope this never... */
 
-static void decode(struct drm_intel_decode *ctx,
-		   const char *buffer_name,
-		   const char *ring_name,
-		   uint64_t gtt_offset,
-		   uint32_t head_offset,
-		   uint32_t *data,
-		   int *count)
-{
-	if (!*count)
-		return;
-
-	printf("%s (%s) at 0x%08x_%08x", buffer_name, ring_name,
-	       (unsigned)(gtt_offset >> 32),
-	       (unsigned)(gtt_offset & 0xffffffff));
-	if (head_offset != -1)
-		printf("; HEAD points to: 0x%08x_%08x",
-		       (unsigned)((head_offset + gtt_offset) >> 32),
-		       (unsigned)((head_offset + gtt_offset) & 0xffffffff));
-	printf("\n");
-
-	drm_intel_decode_set_batch_pointer(ctx, data, gtt_offset, *count);
-	drm_intel_decode(ctx);
-	*count = 0;
-}
+/*
+ * Without the object size from the buffer list, guess at it from the
+ * compressed size; the objects are mostly empty and compress very well.
+ */
+#define INFLATE_MIN_GUESS (128*4096)
+#define INFLATE_RATIO 8
 
-static int zlib_inflate(uint32_t **ptr, int len)
+static int zlib_inflate(const uint32_t *in, size_t len, uint32_t size,
+			uint32_t **ptr)
 {
 	struct z_stream_s zstream;
-	void *out;
+	size_t out_size;
+	uint8_t *out;
+	int ret;
 
 	memset(&zstream, 0, sizeof(zstream));
 
-	zstream.next_in = (unsigned char *)*ptr;
+	zstream.next_in = (unsigned char *)in;
 	zstream.avail_in = 4*len;
 
 	if (inflateInit(&zstream) != Z_OK)
 		return 0;
 
-	out = malloc(128*4096); /* approximate obj size */
+	out_size = size;
+	if (out_size == 0) {
+		out_size = INFLATE_RATIO * 4*len;
+		if (out_size < INFLATE_MIN_GUESS)
+			out_size = INFLATE_MIN_GUESS;
+	}
+
+	out = malloc(out_size);
+	if (out == NULL) {
+		inflateEnd(&zstream);
+		return 0;
+	}
 	zstream.next_out = out;
-	zstream.avail_out = 40*len;
+	zstream.avail_out = out_size;
 
-	do {
-		switch (inflate(&zstream, Z_SYNC_FLUSH)) {
-		case Z_STREAM_END:
-			goto end;
-		case Z_OK:
-			break;
-		default:
+	/* In one go when the size is right, doubling the buffer otherwise */
+	while ((ret = inflate(&zstream, Z_FINISH)) != Z_STREAM_END) {
+		uint8_t *tmp;
+
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			free(out);
 			inflateEnd(&zstream);
 			return 0;
 		}
 
+		/* Truncated, keep what there is */
 		if (zstream.avail_out)
 			break;
 
-		out = realloc(out, 2*zstream.total_out);
-		if (out == NULL) {
+		out_size *= 2;
+		tmp = realloc(out, out_size);
+		if (tmp == NULL) {
+			free(out);
 			inflateEnd(&zstream);
 			return 0;
 		}
+		out = tmp;
+
+		zstream.next_out = out + zstream.total_out;
+		zstream.avail_out = out_size - zstream.total_out;
+	}
 
-		zstream.next_out = (unsigned char *)out + zstream.total_out;
-		zstream.avail_out = zstream.total_out;
-	} while (1);
-end:
 	inflateEnd(&zstream);
-	free(*ptr);
-	*ptr = out;
+	*ptr = (uint32_t *)out;
 	return zstream.total_out / 4;
 }
 
-static int ascii85_decode(const char *in, uint32_t **out)
+static int ascii85_decode(const char *in, size_t len, uint32_t size,
+			  uint32_t **out)
 {
-	int len = 0, size = 1024;
+	uint32_t *compressed;
+	size_t count;
+	int ret;
 
-	*out = realloc(*out, sizeof(uint32_t)*size);
-	if (*out == NULL)
+	compressed = malloc(igt_ascii85_max_dwords(len) * sizeof(uint32_t));
+	if (compressed == NULL)
 		return 0;
 
-	while (*in >= '!' && *in <= 'z') {
-		uint32_t v = 0;
+	count = igt_ascii85_decode(in, len, compressed);
+	ret = zlib_inflate(compressed, count, size, out);
+	free(compressed);
+
+	return ret;
+}
+
+/*
+ * The error state is decoded in two phases. read_data_file() scans it
+ * line by line and cuts it into sections, each either a run of text
+ * (the lines it echoes plus whatever it prints about them) or a buffer
+ * to decode, and queues them in order. A pool of threads expands the
+ * ascii85/zlib encoded buffers in parallel, which is where most of the
+ * time goes with large error states, while a single output thread
+ * prints the sections in their original order, decoding the buffers as
+ * it reaches them. libdrm's decoder keeps global state, so batches
+ * themselves can only be decoded one at a time.
+ */
+#define MAX_SECTIONS 256
+
+struct section {
+	enum { SECTION_TEXT, SECTION_BUFFER } type;
+	bool ready;
+
+	/* SECTION_TEXT */
+	char *text;
+	size_t length;
+
+	/* SECTION_BUFFER */
+	const char *buffer_name;
+	char *ring_name;
+	uint64_t gtt_offset;
+	uint32_t head_offset;
+	uint32_t devid;
+	bool has_acthd;
+	uint32_t acthd;
+	char *encoded; /* ascii85, NULL if given as a hex dump */
+	size_t encoded_length;
+	uint32_t size; /* from the buffer list, 0 if unknown */
+	uint32_t *data;
+	int count;
+};
+
+static struct {
+	struct section *sections[MAX_SECTIONS];
+	unsigned head, next, tail;
+	bool done;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} queue = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void queue_push(struct section *section)
+{
+	pthread_mutex_lock(&queue.mutex);
+	while (queue.tail - queue.head == MAX_SECTIONS)
+		pthread_cond_wait(&queue.cond, &queue.mutex);
+	queue.sections[queue.tail++ % MAX_SECTIONS] = section;
+	pthread_cond_broadcast(&queue.cond);
+	pthread_mutex_unlock(&queue.mutex);
+}
+
+static void queue_finish(void)
+{
+	pthread_mutex_lock(&queue.mutex);
+	queue.done = true;
+	pthread_cond_broadcast(&queue.cond);
+	pthread_mutex_unlock(&queue.mutex);
+}
 
-		if (len == size) {
-			size *= 2;
-			*out = realloc(*out, sizeof(uint32_t)*size);
-			if (*out == NULL)
-				return 0;
+static void *inflate_thread(void *arg)
+{
+	pthread_mutex_lock(&queue.mutex);
+	for (;;) {
+		struct section *section;
+
+		/*
+		 * The output thread doesn't wait for us to skip the sections
+		 * which are ready from the start, it may already have printed
+		 * and freed them, so never look behind its head.
+		 */
+		if ((int)(queue.head - queue.next) > 0)
+			queue.next = queue.head;
+
+		if (queue.next == queue.tail) {
+			if (queue.done)
+				break;
+			pthread_cond_wait(&queue.cond, &queue.mutex);
+			continue;
 		}
 
-		if (*in == 'z') {
-			in++;
+		section = queue.sections[queue.next++ % MAX_SECTIONS];
+		if (section->ready)
+			continue;
+		pthread_mutex_unlock(&queue.mutex);
+
+		section->count = ascii85_decode(section->encoded,
+						section->encoded_length,
+						section->size,
+						&section->data);
+		free(section->encoded);
+		section->encoded = NULL;
+
+		pthread_mutex_lock(&queue.mutex);
+		section->ready = true;
+		pthread_cond_broadcast(&queue.cond);
+	}
+	pthread_mutex_unlock(&queue.mutex);
+
+	return NULL;
+}
+
+static struct drm_intel_decode *
+decode_context(struct drm_intel_decode *ctx, const struct section *section)
+{
+	static uint32_t devid;
+	static bool has_acthd;
+	static uint32_t acthd;
+
+	/* Replay the decoder setup read_data_file() saw before this buffer */
+	if (ctx && (devid != section->devid ||
+		    (has_acthd && !section->has_acthd))) {
+		drm_intel_decode_context_free(ctx);
+		ctx = NULL;
+	}
+
+	if (ctx == NULL) {
+		ctx = drm_intel_decode_context_alloc(section->devid);
+		devid = section->devid;
+		has_acthd = false;
+	}
+
+	if (section->has_acthd && (!has_acthd || acthd != section->acthd)) {
+		drm_intel_decode_set_head_tail(ctx, section->acthd, 0xffffffff);
+		has_acthd = true;
+		acthd = section->acthd;
+	}
+
+	return ctx;
+}
+
+static void decode(struct drm_intel_decode *ctx, const struct section *section)
+{
+	uint64_t gtt_offset = section->gtt_offset;
+	uint32_t head_offset = section->head_offset;
+
+	if (section->count == 0) {
+		fprintf(stderr, "ASCII85 decode failed.\n");
+		exit(1);
+	}
+
+	if (format != RECORD_TEXT) {
+		record_buffer(stdout, format, section->buffer_name,
+			      section->ring_name, gtt_offset, section->count);
+		record_commands(stdout, format, section->data, section->count,
+				gtt_offset);
+		return;
+	}
+
+	printf("%s (%s) at 0x%08x_%08x", section->buffer_name,
+	       section->ring_name,
+	       (unsigned)(gtt_offset >> 32),
+	       (unsigned)(gtt_offset & 0xffffffff));
+	if (head_offset != -1)
+		printf("; HEAD points to: 0x%08x_%08x",
+		       (unsigned)((head_offset + gtt_offset) >> 32),
+		       (unsigned)((head_offset + gtt_offset) & 0xffffffff));
+	printf("\n");
+
+	drm_intel_decode_set_batch_pointer(ctx, section->data, gtt_offset,
+					   section->count);
+	drm_intel_decode(ctx);
+}
+
+static void *output_thread(void *arg)
+{
+	struct drm_intel_decode *ctx = NULL;
+
+	pthread_mutex_lock(&queue.mutex);
+	for (;;) {
+		struct section *section;
+
+		while (queue.head == queue.tail && !queue.done)
+			pthread_cond_wait(&queue.cond, &queue.mutex);
+		if (queue.head == queue.tail)
+			break;
+
+		section = queue.sections[queue.head % MAX_SECTIONS];
+		while (!section->ready)
+			pthread_cond_wait(&queue.cond, &queue.mutex);
+		pthread_mutex_unlock(&queue.mutex);
+
+		if (section->type == SECTION_TEXT) {
+			fwrite(section->text, 1, section->length, stdout);
+			free(section->text);
 		} else {
-			v += in[0] - 33; v *= 85;
-			v += in[1] - 33; v *= 85;
-			v += in[2] - 33; v *= 85;
-			v += in[3] - 33; v *= 85;
-			v += in[4] - 33;
-			in += 5;
+			if (format == RECORD_TEXT)
+				ctx = decode_context(ctx, section);
+			decode(ctx, section);
+			free(section->ring_name);
+			free(section->data);
 		}
-		(*out)[len++] = v;
+
+		/*
+		 * An inflate thread may be about to look at this section, so
+		 * move past it before freeing it.
+		 */
+		pthread_mutex_lock(&queue.mutex);
+		queue.sections[queue.head++ % MAX_SECTIONS] = NULL;
+		pthread_cond_broadcast(&queue.cond);
+		pthread_mutex_unlock(&queue.mutex);
+
+		free(section);
+		pthread_mutex_lock(&queue.mutex);
 	}
+	pthread_mutex_unlock(&queue.mutex);
 
-	return zlib_inflate(out, len);
+	if (ctx)
+		drm_intel_decode_context_free(ctx);
+
+	return NULL;
+}
+
+static struct section *section_alloc(int type)
+{
+	struct section *section;
+
+	section = calloc(1, sizeof(*section));
+	if (section == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	section->type = type;
+
+	return section;
+}
+
+static struct section *text;
+
+static void text_begin(void)
+{
+	text = section_alloc(SECTION_TEXT);
+	text->ready = true;
+	outfile = open_memstream(&text->text, &text->length);
+	if (outfile == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+}
+
+static void text_end(void)
+{
+	fclose(outfile);
+	outfile = NULL;
+
+	if (text->length) {
+		queue_push(text);
+	} else {
+		free(text->text);
+		free(text);
+	}
+	text = NULL;
+}
+
+struct buffer_size {
+	uint64_t gtt_offset;
+	uint32_t size;
+};
+
+struct scan {
+	uint32_t devid;
+	bool has_acthd;
+	uint32_t acthd;
+	const char *buffer_name;
+	char *ring_name;
+	uint64_t gtt_offset;
+	uint32_t head_offset;
+
+	/* Buffer given as a hex dump, one dword per line */
+	uint32_t *data;
+	int count, data_size;
+
+	/* For --format, the ring the registers belong to */
+	char *register_ring;
+	uint32_t ring_length;
+
+	/* Object sizes from the buffer lists, sorted on lookup */
+	struct buffer_size *sizes;
+	int num_sizes, max_sizes;
+	bool sorted;
+};
+
+static void add_buffer_size(struct scan *scan, uint64_t gtt_offset,
+			    uint32_t size)
+{
+	if (scan->num_sizes == scan->max_sizes) {
+		scan->max_sizes = scan->max_sizes ? 2 * scan->max_sizes : 256;
+		scan->sizes = realloc(scan->sizes,
+				      scan->max_sizes * sizeof(*scan->sizes));
+		if (scan->sizes == NULL) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+	}
+
+	scan->sizes[scan->num_sizes].gtt_offset = gtt_offset;
+	scan->sizes[scan->num_sizes].size = size;
+	scan->num_sizes++;
+	scan->sorted = false;
+}
+
+static int cmp_buffer_size(const void *A, const void *B)
+{
+	const struct buffer_size *a = A, *b = B;
+
+	if (a->gtt_offset < b->gtt_offset)
+		return -1;
+	return a->gtt_offset > b->gtt_offset;
+}
+
+static uint32_t find_buffer_size(struct scan *scan, uint64_t gtt_offset)
+{
+	struct buffer_size key = { .gtt_offset = gtt_offset }, *found;
+
+	if (scan->num_sizes == 0)
+		return 0;
+
+	if (!scan->sorted) {
+		qsort(scan->sizes, scan->num_sizes, sizeof(*scan->sizes),
+		      cmp_buffer_size);
+		scan->sorted = true;
+	}
+
+	found = bsearch(&key, scan->sizes, scan->num_sizes,
+			sizeof(*scan->sizes), cmp_buffer_size);
+	return found ? found->size : 0;
+}
+
+/*
+ * The structured equivalent of echoing a line of the error state and
+ * decoding whatever register is on it: registers are "NAME: 0x%08x",
+ * possibly followed by the low dword of a 64 bit value, and belong to
+ * the ring of the last "<ring> command stream:" line when indented.
+ */
+static void record_line(struct scan *scan, char *line)
+{
+	struct record_field fields[MAX_INSTDONE_BITS];
+	unsigned long long fence;
+	unsigned int hi, lo;
+	uint32_t reg, gen;
+	uint64_t value;
+	char name[64], *str;
+	int n = 0, matched, i;
+
+	if (line[0] != ' ') {
+		free(scan->register_ring);
+		scan->register_ring = NULL;
+
+		str = strstr(line, " command stream:");
+		if (str) {
+			scan->register_ring = strndup(line, str - line);
+			return;
+		}
+	}
+
+	if (sscanf(line, " fence[%d] = %llx", &i, &fence) == 2) {
+		snprintf(name, sizeof(name), "fence[%d]", i);
+		record_register(outfile, format, scan->register_ring,
+				name, fence, NULL, 0);
+		return;
+	}
+
+	matched = sscanf(line, " %63[^:]: 0x%x %x", name, &hi, &lo);
+	if (matched < 2)
+		return;
+	value = matched == 3 ? (uint64_t)hi << 32 | lo : hi;
+	reg = value;
+	gen = intel_gen(scan->devid);
+
+#define FIELD(n__, v__) do { \
+	fields[n].name = n__; \
+	fields[n].value = v__; \
+	n++; \
+} while (0)
+
+	if (!strcmp(name, "PCI ID")) {
+		scan->devid = reg;
+		FIELD("gen", intel_gen(reg));
+	} else if (!strcmp(name, "CTL")) {
+		scan->ring_length = ((reg >> 12 & 0x1ff) + 1) * 4096;
+		FIELD("length", scan->ring_length);
+		FIELD("enabled", reg & 1);
+		FIELD("semaphore_wait", reg >> 10 & 1);
+		FIELD("rb_wait", reg >> 11 & 1);
+	} else if (!strcmp(name, "HEAD")) {
+		FIELD("head", reg & (0x7ffff << 2));
+		FIELD("wraps", reg >> 21);
+	} else if (!strcmp(name, "ACTHD")) {
+		if ((reg & (0x7ffff << 2)) < scan->ring_length)
+			FIELD("ring", reg & (0x7ffff << 2));
+		else
+			FIELD("batch", value);
+	} else if (!strcmp(name, "INSTDONE") || !strcmp(name, "INSTDONE1")) {
+		bool instdone1 = name[8] != '\0';
+
+		/* The units that are busy */
+		if (init_instdone_definitions(scan->devid)) {
+			for (i = 0; i < num_instdone_bits; i++) {
+				if ((instdone_bits[i].reg == INSTDONE_1) != instdone1)
+					continue;
+
+				if (!(reg & instdone_bits[i].bit))
+					FIELD(instdone_bits[i].name, 1);
+			}
+		}
+	} else if (!strcmp(name, "FAULT_REG") && gen >= 7 && reg & 1) {
+		FIELD("type", reg >> 1 & 0x3);
+		FIELD("source_id", reg >> 3 & 0xff);
+		if (gen < 8) {
+			FIELD("ggtt", reg >> 11 & 1);
+			FIELD("address", reg & ~((1 << 12) - 1));
+		} else {
+			FIELD("engine", reg >> 12 & 0x7);
+		}
+	} else if (!strcmp(name, "FAULT_TLB_DATA") && gen >= 8) {
+		FIELD("address", ((uint64_t)lo << 12) | ((uint64_t)hi & 0xf) << 44);
+		FIELD("ggtt", hi >> 4 & 1);
+	}
+#undef FIELD
+
+	record_register(outfile, format, scan->register_ring,
+			name, value, fields, n);
+}
+
+/* Queue a buffer for decoding, given either as ascii85 or in scan->data */
+static void queue_buffer(struct scan *scan, char *encoded, size_t length)
+{
+	struct section *section;
+
+	if (encoded == NULL && scan->count == 0)
+		return;
+
+	section = section_alloc(SECTION_BUFFER);
+	section->buffer_name = scan->buffer_name;
+	section->ring_name = scan->ring_name ? strdup(scan->ring_name) : NULL;
+	section->gtt_offset = scan->gtt_offset;
+	section->head_offset = scan->head_offset;
+	section->devid = scan->devid;
+	section->has_acthd = scan->has_acthd;
+	section->acthd = scan->acthd;
+
+	if (encoded) {
+		section->encoded = encoded;
+		section->encoded_length = length;
+		section->size = find_buffer_size(scan, scan->gtt_offset);
+	} else {
+		section->data = scan->data;
+		section->count = scan->count;
+		section->ready = true;
+
+		scan->data = NULL;
+		scan->count = scan->data_size = 0;
+	}
+
+	text_end();
+	queue_push(section);
+	text_begin();
 }
 
 static void
 read_data_file(FILE *file)
 {
-	struct drm_intel_decode *decode_ctx = NULL;
-	uint32_t devid = PCI_CHIP_I855_GM;
-	uint32_t *data = NULL;
+	struct scan scan = {
+		.devid = PCI_CHIP_I855_GM,
+		.buffer_name = "batch buffer",
+		.head_offset = -1,
+	};
+	pthread_t output, *workers;
+	int num_workers, i;
 	uint32_t head[MAX_RINGS];
 	int head_idx = 0;
 	int num_rings = 0;
 	long long unsigned fence;
-	int data_size = 0, count = 0, line_number = 0, matched;
+	int line_number = 0, matched;
 	char *line = NULL;
-	size_t line_size;
+	size_t line_size = 0;
+	ssize_t len;
 	uint32_t offset, value, ring_length = 0;
-	uint64_t gtt_offset = 0, new_gtt_offset;
-	uint32_t head_offset = -1;
-	const char *buffer_name = "batch buffer";
-	char *ring_name = NULL;
+	uint64_t new_gtt_offset;
+
+	num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_workers < 1)
+		num_workers = 1;
+	workers = calloc(num_workers, sizeof(*workers));
+	if (workers == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
 
-	while (getline(&line, &line_size, file) > 0) {
+	record_begin(stdout, format);
+	text_begin();
+	pthread_create(&output, NULL, output_thread, NULL);
+	for (i = 0; i < num_workers; i++)
+		pthread_create(&workers[i], NULL, inflate_thread, NULL);
+
+	while ((len = getline(&line, &line_size, file)) > 0) {
 		char *dashes;
 		line_number++;
 
+		/*
+		 * Buffers are by far the longest lines, and may well
+		 * contain "---" themselves. Hand the line over to the
+		 * inflate threads rather than copying it.
+		 */
+		if (line[0] == ':') {
+			memmove(line, line + 1, len);
+			queue_buffer(&scan, line, len - 1);
+			line = NULL;
+			line_size = 0;
+			continue;
+		}
+
 		dashes = strstr(line, "---");
 		if (dashes) {
 			uint32_t lo, hi;
@@ -580,15 +1067,12 @@ read_data_file(FILE *file)
 					new_gtt_offset |= lo;
 				}
 
-				decode(decode_ctx,
-				       buffer_name, ring_name,
-				       gtt_offset, head_offset,
-				       data, &count);
-				gtt_offset = new_gtt_offset;
-				head_offset = -1;
-				free(ring_name);
-				ring_name = new_ring_name;
-				buffer_name = "batch buffer";
+				queue_buffer(&scan, NULL, 0);
+				scan.gtt_offset = new_gtt_offset;
+				scan.head_offset = -1;
+				free(scan.ring_name);
+				scan.ring_name = new_ring_name;
+				scan.buffer_name = "batch buffer";
 				continue;
 			}
 
@@ -601,18 +1085,15 @@ read_data_file(FILE *file)
 					new_gtt_offset |= lo;
 				}
 
-				decode(decode_ctx,
-				       buffer_name, ring_name,
-				       gtt_offset, head_offset,
-				       data, &count);
-				gtt_offset = new_gtt_offset;
+				queue_buffer(&scan, NULL, 0);
+				scan.gtt_offset = new_gtt_offset;
 				if (head_idx < num_rings)
-					head_offset = head[head_idx++];
+					scan.head_offset = head[head_idx++];
 				else
-					head_offset = -1;
-				free(ring_name);
-				ring_name = new_ring_name;
-				buffer_name = "ring buffer";
+					scan.head_offset = -1;
+				free(scan.ring_name);
+				scan.ring_name = new_ring_name;
+				scan.buffer_name = "ring buffer";
 				continue;
 			}
 
@@ -625,43 +1106,31 @@ read_data_file(FILE *file)
 					new_gtt_offset |= lo;
 				}
 
-				decode(decode_ctx,
-				       buffer_name, ring_name,
-				       gtt_offset, head_offset,
-				       data, &count);
-				gtt_offset = new_gtt_offset;
-				head_offset = -1;
-				free(ring_name);
-				ring_name = new_ring_name;
-				buffer_name = "HW Context";
+				queue_buffer(&scan, NULL, 0);
+				scan.gtt_offset = new_gtt_offset;
+				scan.head_offset = -1;
+				free(scan.ring_name);
+				scan.ring_name = new_ring_name;
+				scan.buffer_name = "HW Context";
 				continue;
 			}
-		}
 
-		if (line[0] == ':') {
-			count = ascii85_decode(line+1, &data);
-			if (count == 0) {
-				fprintf(stderr, "ASCII85 decode failed.\n");
-				exit(1);
-			}
-			decode(decode_ctx,
-			       buffer_name, ring_name,
-			       gtt_offset, head_offset,
-			       data, &count);
-			continue;
+			free(new_ring_name);
 		}
 
 		matched = sscanf(line, "%08x : %08x", &offset, &value);
 		if (matched != 2) {
-			unsigned int reg, reg2;
+			unsigned int reg, reg2, hi, lo, size, read, write;
 
 			/* display reg section is after the ringbuffers, don't mix them */
-			decode(decode_ctx,
-			       buffer_name, ring_name,
-			       gtt_offset, head_offset,
-			       data, &count);
+			queue_buffer(&scan, NULL, 0);
+
+			if (format != RECORD_TEXT) {
+				record_line(&scan, line);
+				continue;
+			}
 
-			printf("%s", line);
+			fputs(line, outfile);
 
 			matched = sscanf(line, "PCI ID: 0x%04x\n", &reg);
 			if (matched == 0)
@@ -672,11 +1141,10 @@ read_data_file(FILE *file)
 					matched = sscanf(pci_id_start, "PCI ID: 0x%04x\n", &reg);
 			}
 			if (matched == 1) {
-				devid = reg;
-				printf("Detected GEN%i chipset\n",
-						intel_gen(devid));
-
-				decode_ctx = drm_intel_decode_context_alloc(devid);
+				scan.devid = reg;
+				scan.has_acthd = false;
+				fprintf(outfile, "Detected GEN%i chipset\n",
+					intel_gen(scan.devid));
 			}
 
 			matched = sscanf(line, "  CTL: 0x%08x\n", &reg);
@@ -691,62 +1159,381 @@ read_data_file(FILE *file)
 			matched = sscanf(line, "  ACTHD: 0x%08x\n", &reg);
 			if (matched == 1) {
 				print_acthd(reg, ring_length);
-				drm_intel_decode_set_head_tail(decode_ctx, reg, 0xffffffff);
+				scan.has_acthd = true;
+				scan.acthd = reg;
 			}
 
 			matched = sscanf(line, "  PGTBL_ER: 0x%08x\n", &reg);
 			if (matched == 1 && reg)
-				print_pgtbl_err(reg, devid);
+				print_pgtbl_err(reg, scan.devid);
 
 			matched = sscanf(line, "  ERROR: 0x%08x\n", &reg);
 			if (matched == 1 && reg)
-				print_error(reg, devid);
+				print_error(reg, scan.devid);
 
 			matched = sscanf(line, "  INSTDONE: 0x%08x\n", &reg);
 			if (matched == 1)
-				print_instdone(devid, reg, -1);
+				print_instdone(scan.devid, reg, -1);
 
 			matched = sscanf(line, "  INSTDONE1: 0x%08x\n", &reg);
 			if (matched == 1)
-				print_instdone(devid, -1, reg);
+				print_instdone(scan.devid, -1, reg);
 
 			matched = sscanf(line, "  fence[%i] = %Lx\n", &reg, &fence);
 			if (matched == 2)
-				print_fence(devid, fence);
+				print_fence(scan.devid, fence);
 
 			matched = sscanf(line, "  FAULT_REG: 0x%08x\n", &reg);
 			if (matched == 1 && reg)
-				print_fault_reg(devid, reg);
+				print_fault_reg(scan.devid, reg);
 
 			matched = sscanf(line, "  FAULT_TLB_DATA: 0x%08x 0x%08x\n", &reg, &reg2);
 			if (matched == 2)
-				print_fault_data(devid, reg, reg2);
+				print_fault_data(scan.devid, reg, reg2);
+
+			/*
+			 * The buffer lists give the size of each object,
+			 * which is how large they inflate to if they are
+			 * dumped later on.
+			 */
+			matched = sscanf(line, "    %08x_%08x %8u %02x %02x",
+					 &hi, &lo, &size, &read, &write);
+			if (matched == 5)
+				add_buffer_size(&scan, (uint64_t)hi << 32 | lo,
+						size);
+
+			matched = sscanf(line, "  %08x %8u %02x %02x",
+					 &lo, &size, &read, &write);
+			if (matched == 4)
+				add_buffer_size(&scan, lo, size);
 
 			continue;
 		}
 
-		count++;
+		scan.count++;
 
-		if (count > data_size) {
-			data_size = data_size ? data_size * 2 : 1024;
-			data = realloc(data, data_size * sizeof (uint32_t));
-			if (data == NULL) {
+		if (scan.count > scan.data_size) {
+			scan.data_size = scan.data_size ? scan.data_size * 2 : 1024;
+			scan.data = realloc(scan.data, scan.data_size * sizeof (uint32_t));
+			if (scan.data == NULL) {
 				fprintf(stderr, "Out of memory.\n");
 				exit(1);
 			}
 		}
 
-		data[count-1] = value;
+		scan.data[scan.count-1] = value;
 	}
 
-	decode(decode_ctx,
-	       buffer_name, ring_name,
-	       gtt_offset, head_offset,
-	       data, &count);
+	queue_buffer(&scan, NULL, 0);
+	text_end();
+
+	queue_finish();
+	for (i = 0; i < num_workers; i++)
+		pthread_join(workers[i], NULL);
+	pthread_join(output, NULL);
+
+	free(workers);
+	free(line);
+	free(scan.ring_name);
+	free(scan.register_ring);
+	free(scan.sizes);
+}
+
+/*
+ * Indexing only looks at the registers that tell hangs apart and, for
+ * the command at ACTHD, at the batch buffers of the rings that have one;
+ * everything else is skipped without decoding.
+ */
+#define MAX_INDEX_RINGS 16
+
+struct index_ring {
+	char name[64];
+	uint32_t row[EI_NUM_COLUMNS];
+	uint64_t acthd;
+	bool hung;
+};
+
+/* The command without its length field */
+static uint32_t command_opcode(uint32_t cmd)
+{
+	switch (cmd >> 29) {
+	case 0x0: return cmd & 0xff800000; /* MI */
+	case 0x2: return cmd & 0xffc00000; /* 2D */
+	case 0x3: return cmd & 0xffff0000; /* 3D, media and video */
+	default: return cmd;
+	}
+}
+
+static struct index_ring *
+find_index_ring(struct index_ring *rings, int num_rings, const char *name)
+{
+	int i;
+
+	for (i = 0; i < num_rings; i++)
+		if (!strncmp(name, rings[i].name, strlen(rings[i].name)))
+			return &rings[i];
+
+	return NULL;
+}
+
+static void
+index_error_state(FILE *file, struct error_index *idx, uint32_t dump)
+{
+	struct index_ring rings[MAX_INDEX_RINGS], *ring = NULL, *batch = NULL;
+	uint32_t pci_id = 0, eir = 0, pgtbl_er = 0, error = 0, fault_reg = 0;
+	bool has_hangcheck = false;
+	uint64_t batch_offset = 0;
+	int num_rings = 0, i;
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+
+	while ((len = getline(&line, &line_size, file)) > 0) {
+		unsigned int reg, hi, lo;
+		char *str, state[16];
+		int matched;
+
+		if (line[0] == ':') {
+			if (batch) {
+				uint32_t *data = NULL;
+				uint64_t offset = batch->acthd - batch_offset;
+				int count;
+
+				count = ascii85_decode(line + 1, len - 1, 0, &data);
+				if (offset / 4 < (uint64_t)count)
+					batch->row[EI_OPCODE] =
+						command_opcode(data[offset / 4]);
+				free(data);
+				batch = NULL;
+			}
+			continue;
+		}
+
+		if (sscanf(line, "%08x : %08x", &lo, &reg) == 2) {
+			if (batch && lo == (uint32_t)batch->acthd)
+				batch->row[EI_OPCODE] = command_opcode(reg);
+			continue;
+		}
+		batch = NULL;
+
+		str = strstr(line, " --- ");
+		if (str) {
+			*str = '\0';
+			matched = sscanf(str + 1, "--- gtt_offset = 0x%08x %08x",
+					 &hi, &lo);
+			if (matched == 0)
+				continue;
+
+			batch_offset = matched == 2 ? (uint64_t)hi << 32 | lo : hi;
+			batch = find_index_ring(rings, num_rings, line);
+			if (batch && batch->acthd < batch_offset)
+				batch = NULL;
+			continue;
+		}
+
+		if (line[0] != ' ') {
+			ring = NULL;
+
+			str = strstr(line, " command stream:");
+			if (str && num_rings < MAX_INDEX_RINGS) {
+				*str = '\0';
+				ring = &rings[num_rings++];
+				memset(ring, 0, sizeof(*ring));
+				snprintf(ring->name, sizeof(ring->name), "%s", line);
+				ring->row[EI_DUMP] = dump;
+				ring->row[EI_RING] = error_index_ring(line);
+				ring->row[EI_OPCODE] = EI_OPCODE_UNKNOWN;
+				continue;
+			}
+		}
 
-	free(data);
+		str = strstr(line, "PCI ID: ");
+		if (str && sscanf(str, "PCI ID: 0x%04x", &reg) == 1)
+			pci_id = reg;
+
+		if (ring == NULL) {
+			if (sscanf(line, " EIR: 0x%08x", &reg) == 1)
+				eir = reg;
+			else if (sscanf(line, " PGTBL_ER: 0x%08x", &reg) == 1)
+				pgtbl_er = reg;
+			else if (sscanf(line, " ERROR: 0x%08x", &reg) == 1)
+				error = reg;
+			else if (sscanf(line, " FAULT_REG: 0x%08x", &reg) == 1)
+				fault_reg = reg;
+			continue;
+		}
+
+		if (sscanf(line, " HEAD: 0x%08x", &reg) == 1)
+			ring->row[EI_HEAD] = reg;
+		else if ((matched = sscanf(line, " ACTHD: 0x%08x %08x", &hi, &lo)))
+			ring->acthd = matched == 2 ? (uint64_t)hi << 32 | lo : hi;
+		else if (sscanf(line, " IPEIR: 0x%08x", &reg) == 1)
+			ring->row[EI_IPEIR] = reg;
+		else if (sscanf(line, " IPEHR: 0x%08x", &reg) == 1)
+			ring->row[EI_IPEHR] = reg;
+		else if (sscanf(line, " INSTDONE: 0x%08x", &reg) == 1)
+			ring->row[EI_INSTDONE] = reg;
+		else if (sscanf(line, " INSTDONE1: 0x%08x", &reg) == 1)
+			ring->row[EI_INSTDONE1] = reg;
+		else if (sscanf(line, " FAULT_REG: 0x%08x", &reg) == 1)
+			ring->row[EI_FAULT_REG] = reg;
+		else if (sscanf(line, " hangcheck: %15s", state) == 1) {
+			has_hangcheck = true;
+			ring->hung = !strcmp(state, "hung");
+		}
+	}
 	free(line);
-	free(ring_name);
+
+	/*
+	 * Without hangcheck's verdict, which older kernels do not give,
+	 * blame whichever rings were executing a batch.
+	 */
+	for (i = 0; i < num_rings; i++) {
+		ring = &rings[i];
+
+		ring->row[EI_PCI_ID] = pci_id;
+		ring->row[EI_ACTHD] = ring->acthd;
+		ring->row[EI_EIR] = eir;
+		ring->row[EI_PGTBL_ER] = pgtbl_er;
+		ring->row[EI_ERROR] = error;
+		if (ring->row[EI_FAULT_REG] == 0)
+			ring->row[EI_FAULT_REG] = fault_reg;
+		if (has_hangcheck)
+			ring->row[EI_HUNG] = ring->hung;
+		else
+			ring->row[EI_HUNG] = ring->row[EI_OPCODE] != EI_OPCODE_UNKNOWN;
+
+		error_index_add_row(idx, ring->row);
+	}
+}
+
+static void
+index_error_file(struct error_index *idx, const char *path,
+		 int *indexed, int *unchanged)
+{
+	char *real;
+	struct stat st;
+	FILE *file;
+
+	real = realpath(path, NULL);
+	if (real == NULL || stat(real, &st)) {
+		fprintf(stderr, "Error opening %s: %s\n",
+			path, strerror(errno));
+		free(real);
+		return;
+	}
+
+	if (error_index_has_dump(idx, real, st.st_mtime, st.st_size)) {
+		(*unchanged)++;
+		free(real);
+		return;
+	}
+
+	file = fopen(real, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Failed to open %s: %s\n",
+			path, strerror(errno));
+		free(real);
+		return;
+	}
+
+	index_error_state(file,
+			  idx, error_index_add_dump(idx, real,
+						    st.st_mtime, st.st_size));
+	(*indexed)++;
+
+	fclose(file);
+	free(real);
+}
+
+/*
+ * Adds the error states named on the command line, or one per line on
+ * stdin, to the index. Those that have not changed since they were last
+ * indexed are skipped.
+ */
+static int
+index_error_states(const char *filename, char **paths, int num_paths)
+{
+	struct error_index *idx;
+	int indexed = 0, unchanged = 0, i;
+
+	idx = error_index_open(filename);
+	if (idx == NULL)
+		return 1;
+
+	if (num_paths) {
+		for (i = 0; i < num_paths; i++)
+			index_error_file(idx, paths[i], &indexed, &unchanged);
+	} else {
+		char *line = NULL;
+		size_t line_size = 0;
+		ssize_t len;
+
+		while ((len = getline(&line, &line_size, stdin)) > 0) {
+			if (line[len - 1] == '\n')
+				line[--len] = '\0';
+			if (len)
+				index_error_file(idx, line,
+						 &indexed, &unchanged);
+		}
+		free(line);
+	}
+
+	fprintf(stderr, "Indexed %d error states, %d unchanged\n",
+		indexed, unchanged);
+
+	i = error_index_write(idx, filename);
+	error_index_close(idx);
+
+	return i ? 1 : 0;
+}
+
+static int
+query_error_states(const char *filename, const char *columns, bool all)
+{
+	struct error_index *idx;
+	int ret;
+
+	idx = error_index_open(filename);
+	if (idx == NULL)
+		return 1;
+
+	ret = error_index_query(idx, columns, all, stdout);
+	error_index_close(idx);
+
+	return ret ? 1 : 0;
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr,
+		"intel_gpu_decode: Parse an Intel GPU i915_error_state\n"
+		"Usage:\n"
+		"\t%s [--format=text|json|binary] [<file>]\n"
+		"\t%s --index=<index> [<file>...]\n"
+		"\t%s --query=<index> [--by=<column>,...] [--all]\n"
+		"\n"
+		"With no arguments, debugfs-dri-directory is probed for in "
+		"/debug and \n"
+		"/sys/kernel/debug.  Otherwise, it may be "
+		"specified.  If a file is given,\n"
+		"it is parsed as an GPU dump in the format of "
+		"/debug/dri/0/i915_error_state.\n"
+		"\n"
+		"--index adds error states, given as arguments or one per line "
+		"on stdin,\n"
+		"to an index. --query then buckets the hung rings of all the "
+		"indexed\n"
+		"error states by the registers given with --by, by default "
+		"pci_id,ring,\n"
+		"ipehr,instdone,opcode. --all includes the rings that were not "
+		"hung.\n"
+		"\n"
+		"--format=json or binary prints records of the registers, "
+		"buffers and\n"
+		"commands rather than text, see intel_decode_records.h.\n",
+		argv0, argv0, argv0);
 }
 
 int
@@ -757,24 +1544,60 @@ main(int argc, char *argv[])
 	char *filename = NULL;
 	struct stat st;
 	int error;
+	const char *index_file = NULL, *query_file = NULL, *columns = NULL;
+	bool all = false;
+	int c;
+
+	static const struct option long_options[] = {
+		{"index", 1, 0, 'i'},
+		{"query", 1, 0, 'q'},
+		{"by", 1, 0, 'b'},
+		{"all", 0, 0, 'a'},
+		{"format", 1, 0, 'f'},
+		{"help", 0, 0, 'h'},
+		{ 0 }
+	};
+
+	while ((c = getopt_long(argc, argv, "i:q:b:af:h",
+				long_options, NULL)) != -1) {
+		switch (c) {
+		case 'i':
+			index_file = optarg;
+			break;
+		case 'q':
+			query_file = optarg;
+			break;
+		case 'b':
+			columns = optarg;
+			break;
+		case 'a':
+			all = true;
+			break;
+		case 'f':
+			if (record_parse_format(optarg, &format)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (index_file)
+		return index_error_states(index_file,
+					  argv + optind, argc - optind);
+
+	if (query_file)
+		return query_error_states(query_file, columns, all);
 
-	if (argc > 2) {
-		fprintf(stderr,
-				"intel_gpu_decode: Parse an Intel GPU i915_error_state\n"
-				"Usage:\n"
-				"\t%s [<file>]\n"
-				"\n"
-				"With no arguments, debugfs-dri-directory is probed for in "
-				"/debug and \n"
-				"/sys/kernel/debug.  Otherwise, it may be "
-				"specified.  If a file is given,\n"
-				"it is parsed as an GPU dump in the format of "
-				"/debug/dri/0/i915_error_state.\n",
-				argv[0]);
+	if (argc - optind > 1) {
+		usage(argv[0]);
 		return 1;
 	}
 
-	if (argc == 1) {
+	if (optind == argc) {
 		if (isatty(0)) {
 			path = "/sys/class/drm/card0/error";
 			error = stat(path, &st);
@@ -797,7 +1620,7 @@ main(int argc, char *argv[])
 			exit(0);
 		}
 	} else {
-		path = argv[1];
+		path = argv[optind];
 		error = stat(path, &st);
 		if (error != 0) {
 			fprintf(stderr, "Error opening %s: %s\n",
@@ -0,0 +1,95 @@
+#!/bin/sh
+#
+# Copyright © 2015 Intel Corporation
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice (including the next
+# paragraph) shall be included in all copies or substantial portions of the
+# Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+
+#
+# Check that intel_error_decode prints every buffer of an error state once
+# and in order, when text, buffers to inflate and hex dumped buffers (which
+# need no inflating) follow each other many times over. The output thread
+# and the inflating threads then keep overtaking each other, so this is
+# best run with the tools built with CFLAGS=-fsanitize=thread.
+#
+
+DECODE=$top_builddir/tools/intel_error_decode
+if [ ! -x $DECODE ]; then
+	echo "Error: $DECODE not built"
+	exit 99
+fi
+
+TMPDIR=`mktemp -d` || exit 99
+trap "rm -rf $TMPDIR" EXIT
+
+# 64 MI_NOOPs, zlib compressed and ascii85 encoded
+NOOPS='?t7o8!!([h!<<*#'
+
+i=0
+echo "PCI ID: 0x0162" > $TMPDIR/error
+while [ $i -lt 2000 ]; do
+	printf 'render ring --- gtt_offset = 0x00000000 %08x\n' $((i * 8192))
+	echo ":$NOOPS"
+	echo "  seqno: 0x$i"
+	printf 'bsd ring --- gtt_offset = 0x00000000 %08x\n' $((i * 8192 + 4096))
+	echo "00000000 : 00000000"
+	echo "00000004 : 05000000"
+	printf '%d 64\n%d 2\n' $((i * 8192)) $((i * 8192 + 4096)) >&3
+	i=$((i + 1))
+done >> $TMPDIR/error 3> $TMPDIR/expected
+
+check()
+{
+	$DECODE --format=json $TMPDIR/error > $TMPDIR/json
+	if [ $? -ne 0 ]; then
+		echo "Error: decoding failed"
+		exit 1
+	fi
+
+	sed -n 's/.*"type":"buffer".*"gtt_offset":\([0-9]*\),"dwords":\([0-9]*\).*/\1 \2/p' \
+		$TMPDIR/json > $TMPDIR/buffers
+
+	if ! cmp -s $TMPDIR/expected $TMPDIR/buffers; then
+		echo "Error: buffers missing, repeated or out of order"
+		diff $TMPDIR/expected $TMPDIR/buffers | head -n 20
+		exit 1
+	fi
+}
+
+check
+
+#
+# Then many small sections which are ready as soon as they are read, so
+# the output thread frees them while the inflate threads are still
+# walking the queue behind it.
+#
+awk -v expected=$TMPDIR/expected 'BEGIN {
+	print "PCI ID: 0x0162"
+	for (i = 0; i < 50000; i++) {
+		print "  seqno: 0x" i
+		printf "bsd ring --- gtt_offset = 0x00000000 %08x\n", i * 4096
+		print "00000000 : 00000000"
+		print "00000004 : 05000000"
+		printf "%d 2\n", i * 4096 > expected
+	}
+}' > $TMPDIR/error
+
+check
+
+exit 0
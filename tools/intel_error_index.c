@@ -0,0 +1,662 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "intel_error_index.h"
+
+/*
+ * On disk, all little endian as written by the host:
+ *
+ *	struct ei_header
+ *	struct ei_dump[num_dumps]
+ *	char strings[strings_size], padded to 4 bytes
+ *	uint32_t column[num_columns][num_rows]
+ *
+ * Columns added later go at the end, so older indices can still be read
+ * with the new columns set to 0.
+ */
+#define EI_MAGIC "i915ERRI"
+#define EI_VERSION 1
+
+struct ei_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_columns;
+	uint32_t num_rows;
+	uint32_t num_dumps;
+	uint32_t strings_size;
+	uint32_t pad;
+};
+
+struct ei_dump {
+	uint32_t path;	/* offset into the strings */
+	uint32_t pad;
+	int64_t mtime;
+	uint64_t size;
+};
+
+struct error_index {
+	char *strings;
+	uint32_t strings_size, strings_alloc;
+
+	struct ei_dump *dumps;
+	uint32_t num_dumps, max_dumps;
+
+	/* dump + 1 by path, 0 for an empty slot */
+	uint32_t *dump_hash;
+	uint32_t dump_hash_size;
+
+	uint32_t *columns[EI_NUM_COLUMNS];
+	uint32_t num_rows, max_rows;
+};
+
+static const char *column_names[EI_NUM_COLUMNS] = {
+	[EI_DUMP] = "dump",
+	[EI_PCI_ID] = "pci_id",
+	[EI_RING] = "ring",
+	[EI_HUNG] = "hung",
+	[EI_HEAD] = "head",
+	[EI_ACTHD] = "acthd",
+	[EI_IPEIR] = "ipeir",
+	[EI_IPEHR] = "ipehr",
+	[EI_INSTDONE] = "instdone",
+	[EI_INSTDONE1] = "instdone1",
+	[EI_EIR] = "eir",
+	[EI_PGTBL_ER] = "pgtbl_er",
+	[EI_ERROR] = "error",
+	[EI_FAULT_REG] = "fault_reg",
+	[EI_OPCODE] = "opcode",
+};
+
+static const char *ring_names[] = {
+	"render ring",
+	"bsd ring",
+	"blitter ring",
+	"video enhancement ring",
+	"bsd2 ring",
+};
+
+#define DEFAULT_QUERY "pci_id,ring,ipehr,instdone,opcode"
+
+static void *
+xrealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (ptr == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+
+	return ptr;
+}
+
+static uint32_t
+hash_string(const char *str)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*str)
+		hash = (hash ^ (uint8_t)*str++) * 16777619u;
+
+	return hash;
+}
+
+static uint32_t *
+dump_slot(struct error_index *idx, const char *path)
+{
+	uint32_t mask = idx->dump_hash_size - 1;
+	uint32_t i;
+
+	for (i = hash_string(path) & mask; idx->dump_hash[i]; i = (i + 1) & mask) {
+		const struct ei_dump *dump = &idx->dumps[idx->dump_hash[i] - 1];
+
+		if (!strcmp(idx->strings + dump->path, path))
+			break;
+	}
+
+	return &idx->dump_hash[i];
+}
+
+static void
+dump_hash_grow(struct error_index *idx)
+{
+	uint32_t i;
+
+	if (2 * (idx->num_dumps + 1) <= idx->dump_hash_size)
+		return;
+
+	free(idx->dump_hash);
+	idx->dump_hash_size = idx->dump_hash_size ? 2 * idx->dump_hash_size : 1024;
+	while (2 * (idx->num_dumps + 1) > idx->dump_hash_size)
+		idx->dump_hash_size *= 2;
+	idx->dump_hash = calloc(idx->dump_hash_size, sizeof(uint32_t));
+	if (idx->dump_hash == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+
+	for (i = 0; i < idx->num_dumps; i++)
+		*dump_slot(idx, idx->strings + idx->dumps[i].path) = i + 1;
+}
+
+static uint32_t
+add_string(struct error_index *idx, const char *str)
+{
+	uint32_t len = strlen(str) + 1;
+	uint32_t offset = idx->strings_size;
+
+	if (idx->strings_size + len > idx->strings_alloc) {
+		idx->strings_alloc = idx->strings_alloc ? 2 * idx->strings_alloc : 65536;
+		while (idx->strings_size + len > idx->strings_alloc)
+			idx->strings_alloc *= 2;
+		idx->strings = xrealloc(idx->strings, idx->strings_alloc);
+	}
+
+	memcpy(idx->strings + offset, str, len);
+	idx->strings_size += len;
+
+	return offset;
+}
+
+static void
+reserve_rows(struct error_index *idx, uint32_t count)
+{
+	int i;
+
+	if (count <= idx->max_rows)
+		return;
+
+	idx->max_rows = idx->max_rows ? 2 * idx->max_rows : 1024;
+	while (count > idx->max_rows)
+		idx->max_rows *= 2;
+
+	for (i = 0; i < EI_NUM_COLUMNS; i++)
+		idx->columns[i] = xrealloc(idx->columns[i],
+					   idx->max_rows * sizeof(uint32_t));
+}
+
+static bool
+load(struct error_index *idx, const uint8_t *data, size_t size)
+{
+	const struct ei_header *hdr = (const void *)data;
+	const uint32_t *columns;
+	uint64_t need;
+	uint32_t i;
+
+	if (size < sizeof(*hdr) ||
+	    memcmp(hdr->magic, EI_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != EI_VERSION)
+		return false;
+
+	need = sizeof(*hdr) +
+		(uint64_t)hdr->num_dumps * sizeof(struct ei_dump) +
+		((hdr->strings_size + 3) & ~3u) +
+		(uint64_t)hdr->num_columns * hdr->num_rows * sizeof(uint32_t);
+	if (need > size ||
+	    (hdr->strings_size && data[sizeof(*hdr) + hdr->num_dumps * sizeof(struct ei_dump) + hdr->strings_size - 1]))
+		return false;
+
+	idx->num_dumps = idx->max_dumps = hdr->num_dumps;
+	idx->dumps = xrealloc(NULL, idx->max_dumps * sizeof(struct ei_dump) + 1);
+	memcpy(idx->dumps, data + sizeof(*hdr),
+	       idx->num_dumps * sizeof(struct ei_dump));
+
+	idx->strings_size = idx->strings_alloc = hdr->strings_size;
+	idx->strings = xrealloc(NULL, idx->strings_alloc + 1);
+	memcpy(idx->strings,
+	       data + sizeof(*hdr) + idx->num_dumps * sizeof(struct ei_dump),
+	       idx->strings_size);
+
+	for (i = 0; i < idx->num_dumps; i++)
+		if (idx->dumps[i].path >= idx->strings_size)
+			return false;
+
+	reserve_rows(idx, hdr->num_rows);
+	idx->num_rows = hdr->num_rows;
+	columns = (const uint32_t *)(data + sizeof(*hdr) +
+				     idx->num_dumps * sizeof(struct ei_dump) +
+				     ((idx->strings_size + 3) & ~3u));
+	for (i = 0; i < EI_NUM_COLUMNS; i++) {
+		if (i < hdr->num_columns)
+			memcpy(idx->columns[i], columns + i * idx->num_rows,
+			       idx->num_rows * sizeof(uint32_t));
+		else
+			memset(idx->columns[i], 0,
+			       idx->num_rows * sizeof(uint32_t));
+	}
+
+	for (i = 0; i < idx->num_rows; i++)
+		if (idx->columns[EI_DUMP][i] >= idx->num_dumps)
+			return false;
+
+	dump_hash_grow(idx);
+	return true;
+}
+
+/**
+ * error_index_open:
+ * @filename: the index
+ *
+ * Returns an empty index if @filename does not exist yet, NULL if it
+ * cannot be read or is not an index.
+ */
+struct error_index *
+error_index_open(const char *filename)
+{
+	struct error_index *idx;
+	struct stat st;
+	void *data;
+	int fd;
+
+	idx = calloc(1, sizeof(*idx));
+	if (idx == NULL)
+		return NULL;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT) {
+			dump_hash_grow(idx);
+			return idx;
+		}
+
+		fprintf(stderr, "Failed to open %s: %s\n",
+			filename, strerror(errno));
+		goto err;
+	}
+
+	if (fstat(fd, &st)) {
+		fprintf(stderr, "Failed to stat %s: %s\n",
+			filename, strerror(errno));
+		close(fd);
+		goto err;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "Failed to map %s: %s\n",
+			filename, strerror(errno));
+		goto err;
+	}
+
+	if (!load(idx, data, st.st_size)) {
+		fprintf(stderr, "%s is not a valid error state index\n",
+			filename);
+		munmap(data, st.st_size);
+		goto err;
+	}
+
+	munmap(data, st.st_size);
+	return idx;
+
+err:
+	error_index_close(idx);
+	return NULL;
+}
+
+/**
+ * error_index_write:
+ * @idx: the index
+ * @filename: where to write it
+ *
+ * The index is written to a temporary file first and renamed over
+ * @filename, so a concurrent query never sees a partial index.
+ *
+ * Returns 0 on success.
+ */
+int
+error_index_write(struct error_index *idx, const char *filename)
+{
+	struct ei_header hdr;
+	static const char pad[4];
+	char *tmp;
+	FILE *file;
+	int i;
+
+	if (asprintf(&tmp, "%s.XXXXXX", filename) < 0)
+		return -1;
+
+	i = mkstemp(tmp);
+	if (i < 0 || (file = fdopen(i, "w")) == NULL) {
+		fprintf(stderr, "Failed to create %s: %s\n",
+			tmp, strerror(errno));
+		free(tmp);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, EI_MAGIC, sizeof(hdr.magic));
+	hdr.version = EI_VERSION;
+	hdr.num_columns = EI_NUM_COLUMNS;
+	hdr.num_rows = idx->num_rows;
+	hdr.num_dumps = idx->num_dumps;
+	hdr.strings_size = idx->strings_size;
+
+	fwrite(&hdr, sizeof(hdr), 1, file);
+	fwrite(idx->dumps, sizeof(struct ei_dump), idx->num_dumps, file);
+	fwrite(idx->strings, 1, idx->strings_size, file);
+	fwrite(pad, 1, -idx->strings_size & 3, file);
+	for (i = 0; i < EI_NUM_COLUMNS; i++)
+		fwrite(idx->columns[i], sizeof(uint32_t), idx->num_rows, file);
+
+	fchmod(fileno(file), 0644);
+	i = ferror(file);
+	if (fclose(file))
+		i = 1;
+	if (i || rename(tmp, filename)) {
+		fprintf(stderr, "Failed to write %s: %s\n",
+			filename, strerror(errno));
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+
+	free(tmp);
+	return 0;
+}
+
+void
+error_index_close(struct error_index *idx)
+{
+	int i;
+
+	for (i = 0; i < EI_NUM_COLUMNS; i++)
+		free(idx->columns[i]);
+	free(idx->dump_hash);
+	free(idx->dumps);
+	free(idx->strings);
+	free(idx);
+}
+
+/* Whether @path has been indexed, and not changed since */
+bool
+error_index_has_dump(struct error_index *idx, const char *path,
+		     time_t mtime, off_t size)
+{
+	uint32_t slot = *dump_slot(idx, path);
+
+	return slot &&
+		idx->dumps[slot - 1].mtime == mtime &&
+		idx->dumps[slot - 1].size == (uint64_t)size;
+}
+
+/**
+ * error_index_add_dump:
+ * @idx: the index
+ * @path: the error state
+ * @mtime: its modification time
+ * @size: and size
+ *
+ * Adds @path to the index, or drops all the rows from a previous version
+ * of it. The rows for it are then to be added with error_index_add_row().
+ *
+ * Returns: the value for the EI_DUMP column of its rows
+ */
+uint32_t
+error_index_add_dump(struct error_index *idx, const char *path,
+		     time_t mtime, off_t size)
+{
+	uint32_t *slot, dump;
+
+	dump_hash_grow(idx);
+
+	slot = dump_slot(idx, path);
+	if (*slot) {
+		uint32_t i, j;
+		int c;
+
+		dump = *slot - 1;
+		for (i = j = 0; i < idx->num_rows; i++) {
+			if (idx->columns[EI_DUMP][i] == dump)
+				continue;
+
+			if (i != j)
+				for (c = 0; c < EI_NUM_COLUMNS; c++)
+					idx->columns[c][j] = idx->columns[c][i];
+			j++;
+		}
+		idx->num_rows = j;
+	} else {
+		if (idx->num_dumps == idx->max_dumps) {
+			idx->max_dumps = idx->max_dumps ? 2 * idx->max_dumps : 256;
+			idx->dumps = xrealloc(idx->dumps,
+					      idx->max_dumps * sizeof(struct ei_dump));
+		}
+
+		dump = idx->num_dumps++;
+		memset(&idx->dumps[dump], 0, sizeof(idx->dumps[dump]));
+		idx->dumps[dump].path = add_string(idx, path);
+		*slot = dump + 1;
+	}
+
+	idx->dumps[dump].mtime = mtime;
+	idx->dumps[dump].size = size;
+
+	return dump;
+}
+
+void
+error_index_add_row(struct error_index *idx,
+		    const uint32_t row[EI_NUM_COLUMNS])
+{
+	int i;
+
+	reserve_rows(idx, idx->num_rows + 1);
+	for (i = 0; i < EI_NUM_COLUMNS; i++)
+		idx->columns[i][idx->num_rows] = row[i];
+	idx->num_rows++;
+}
+
+const char *
+error_index_dump_path(struct error_index *idx, uint32_t dump)
+{
+	return idx->strings + idx->dumps[dump].path;
+}
+
+/* The value for the EI_RING column given the name in the error state */
+uint32_t
+error_index_ring(const char *name)
+{
+	uint32_t i;
+
+	for (i = 0; i < sizeof(ring_names) / sizeof(ring_names[0]); i++)
+		if (!strcmp(name, ring_names[i]))
+			return i;
+
+	return EI_RING_UNKNOWN;
+}
+
+const char *
+error_index_ring_name(uint32_t ring)
+{
+	if (ring < sizeof(ring_names) / sizeof(ring_names[0]))
+		return ring_names[ring];
+
+	return "unknown";
+}
+
+static void
+print_value(struct error_index *idx, FILE *out, int column, uint32_t value)
+{
+	switch (column) {
+	case EI_DUMP:
+		fputs(error_index_dump_path(idx, value), out);
+		break;
+	case EI_RING:
+		fputs(error_index_ring_name(value), out);
+		break;
+	case EI_HUNG:
+		fprintf(out, "%u", value);
+		break;
+	case EI_PCI_ID:
+		fprintf(out, "0x%04x", value);
+		break;
+	case EI_OPCODE:
+		if (value == EI_OPCODE_UNKNOWN) {
+			fputs("-", out);
+			break;
+		}
+		/* fall through */
+	default:
+		fprintf(out, "0x%08x", value);
+		break;
+	}
+}
+
+struct bucket {
+	uint32_t row;	/* the first one, for the key and as an example */
+	uint32_t count;
+};
+
+static int
+cmp_bucket(const void *A, const void *B)
+{
+	const struct bucket *a = A, *b = B;
+
+	if (a->count != b->count)
+		return a->count > b->count ? -1 : 1;
+	return a->row < b->row ? -1 : a->row > b->row;
+}
+
+/**
+ * error_index_query:
+ * @idx: the index
+ * @columns: comma separated list of columns to bucket by, or NULL for
+ *	the default signature
+ * @all: whether to include every ring, not just the hung ones
+ * @out: where to print the buckets
+ *
+ * Prints one line per distinct signature, most common first, with the
+ * number of rows sharing it and the first error state it was seen in, as
+ * tab separated values.
+ *
+ * Returns 0 on success, -1 if @columns names an unknown column.
+ */
+int
+error_index_query(struct error_index *idx, const char *columns,
+		  bool all, FILE *out)
+{
+	int key[EI_NUM_COLUMNS], num_keys = 0;
+	struct bucket *buckets;
+	uint32_t num_buckets = 0, *table, mask, row;
+	char *list, *name, *save;
+	int i;
+
+	list = strdup(columns ? columns : DEFAULT_QUERY);
+	for (name = strtok_r(list, ",", &save); name;
+	     name = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < EI_NUM_COLUMNS; i++)
+			if (!strcasecmp(name, column_names[i]))
+				break;
+
+		if (i == EI_NUM_COLUMNS) {
+			fprintf(stderr, "Unknown column \"%s\", expected one of:",
+				name);
+			for (i = 0; i < EI_NUM_COLUMNS; i++)
+				fprintf(stderr, " %s", column_names[i]);
+			fprintf(stderr, "\n");
+			free(list);
+			return -1;
+		}
+
+		if (num_keys < EI_NUM_COLUMNS)
+			key[num_keys++] = i;
+	}
+	free(list);
+
+	for (mask = 1023; mask < 2 * idx->num_rows; mask = 2 * mask + 1)
+		;
+	table = calloc(mask + 1, sizeof(uint32_t));
+	buckets = malloc((idx->num_rows + 1) * sizeof(*buckets));
+	if (table == NULL || buckets == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+
+	for (row = 0; row < idx->num_rows; row++) {
+		uint32_t hash = 2166136261u, slot;
+
+		if (!all && !idx->columns[EI_HUNG][row])
+			continue;
+
+		for (i = 0; i < num_keys; i++)
+			hash = (hash ^ idx->columns[key[i]][row]) * 16777619u;
+
+		for (slot = hash & mask; table[slot]; slot = (slot + 1) & mask) {
+			struct bucket *b = &buckets[table[slot] - 1];
+
+			for (i = 0; i < num_keys; i++)
+				if (idx->columns[key[i]][b->row] !=
+				    idx->columns[key[i]][row])
+					break;
+
+			if (i == num_keys) {
+				b->count++;
+				break;
+			}
+		}
+
+		if (table[slot] == 0) {
+			buckets[num_buckets].row = row;
+			buckets[num_buckets].count = 1;
+			table[slot] = ++num_buckets;
+		}
+	}
+	free(table);
+
+	qsort(buckets, num_buckets, sizeof(*buckets), cmp_bucket);
+
+	fprintf(out, "count");
+	for (i = 0; i < num_keys; i++)
+		fprintf(out, "\t%s", column_names[key[i]]);
+	fprintf(out, "\texample\n");
+
+	for (row = 0; row < num_buckets; row++) {
+		const struct bucket *b = &buckets[row];
+
+		fprintf(out, "%u", b->count);
+		for (i = 0; i < num_keys; i++) {
+			fputc('\t', out);
+			print_value(idx, out, key[i],
+				    idx->columns[key[i]][b->row]);
+		}
+		fputc('\t', out);
+		print_value(idx, out, EI_DUMP, idx->columns[EI_DUMP][b->row]);
+		fputc('\n', out);
+	}
+
+	free(buckets);
+	return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef INTEL_ERROR_INDEX_H
+#define INTEL_ERROR_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+ * An index over many error states, one row per ring of each error state,
+ * stored a column at a time so that bucketing thousands of error states
+ * by a few registers only touches those registers.
+ *
+ * The index is loaded into memory as a whole, added to and written back
+ * out; rows of an error state that changed since it was indexed are
+ * replaced.
+ */
+
+enum error_index_column {
+	EI_DUMP,	/* which error state, see error_index_dump_path() */
+	EI_PCI_ID,
+	EI_RING,	/* see error_index_ring_name() */
+	EI_HUNG,	/* the ring hangcheck blamed, or that was executing */
+	EI_HEAD,
+	EI_ACTHD,
+	EI_IPEIR,
+	EI_IPEHR,
+	EI_INSTDONE,
+	EI_INSTDONE1,
+	EI_EIR,
+	EI_PGTBL_ER,
+	EI_ERROR,
+	EI_FAULT_REG,
+	EI_OPCODE,	/* command at ACTHD in the batch, without its length */
+	EI_NUM_COLUMNS
+};
+
+#define EI_RING_UNKNOWN 0xff
+#define EI_OPCODE_UNKNOWN 0xffffffff
+
+struct error_index;
+
+struct error_index *error_index_open(const char *filename);
+int error_index_write(struct error_index *idx, const char *filename);
+void error_index_close(struct error_index *idx);
+
+bool error_index_has_dump(struct error_index *idx, const char *path,
+			  time_t mtime, off_t size);
+uint32_t error_index_add_dump(struct error_index *idx, const char *path,
+			      time_t mtime, off_t size);
+void error_index_add_row(struct error_index *idx,
+			 const uint32_t row[EI_NUM_COLUMNS]);
+
+const char *error_index_dump_path(struct error_index *idx, uint32_t dump);
+uint32_t error_index_ring(const char *name);
+const char *error_index_ring_name(uint32_t ring);
+
+int error_index_query(struct error_index *idx, const char *columns,
+		      bool all, FILE *out);
+
+#endif /* INTEL_ERROR_INDEX_H */
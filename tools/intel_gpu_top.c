@@ -43,6 +43,7 @@
 #include <termios.h>
 #endif
 #include "intel_io.h"
+#include "igt_sampler.h"
 #include "instdone.h"
 #include "intel_reg.h"
 #include "intel_chipset.h"
@@ -316,6 +317,7 @@ struct ring {
 	int head, tail, size;
 	uint64_t full;
 	int idle;
+	unsigned int sample; /* index of the head in the sample values */
 };
 
 static uint32_t ring_read(struct ring *ring, uint32_t reg)
@@ -333,15 +335,26 @@ static void ring_reset(struct ring *ring)
 	ring->idle = ring->full = 0;
 }
 
-static void ring_sample(struct ring *ring)
+static void ring_add_regs(struct ring *ring, uint32_t *regs,
+			  unsigned int *num_regs)
+{
+	if (!ring->size)
+		return;
+
+	ring->sample = *num_regs;
+	regs[(*num_regs)++] = ring->mmio + RING_HEAD;
+	regs[(*num_regs)++] = ring->mmio + RING_TAIL;
+}
+
+static void ring_sample(struct ring *ring, const igt_sample_t *sample)
 {
 	int full;
 
 	if (!ring->size)
 		return;
 
-	ring->head = ring_read(ring, RING_HEAD) & HEAD_ADDR;
-	ring->tail = ring_read(ring, RING_TAIL) & TAIL_ADDR;
+	ring->head = sample->values[ring->sample] & HEAD_ADDR;
+	ring->tail = sample->values[ring->sample + 1] & TAIL_ADDR;
 
 	if (ring->tail == ring->head)
 		ring->idle++;
@@ -433,6 +446,10 @@ int main(int argc, char **argv)
 	int child_stat;
 	char *cmd=NULL;
 	int interactive=1;
+	igt_sampler_config_t sampler_config = { .cpu = -1 };
+	uint32_t sampler_regs[IGT_SAMPLER_MAX_REGS];
+	static igt_sample_t samples[256];
+	igt_sampler_t *sampler;
 
 	/* Parse options? */
 	while ((ch = getopt(argc, argv, "s:o:e:h")) != -1) {
@@ -521,6 +538,22 @@ int main(int argc, char **argv)
 		ring_init(&blt_ring);
 	}
 
+	/* Sample INSTDONE and the rings from a thread of their own */
+	if (IS_965(devid)) {
+		sampler_regs[0] = INSTDONE_I965;
+		sampler_regs[1] = INSTDONE_1;
+		sampler_config.num_regs = 2;
+	} else {
+		sampler_regs[0] = INSTDONE;
+		sampler_config.num_regs = 1;
+	}
+	ring_add_regs(&render_ring, sampler_regs, &sampler_config.num_regs);
+	ring_add_regs(&bsd_ring, sampler_regs, &sampler_config.num_regs);
+	ring_add_regs(&bsd6_ring, sampler_regs, &sampler_config.num_regs);
+	ring_add_regs(&blt_ring, sampler_regs, &sampler_config.num_regs);
+	sampler_config.regs = sampler_regs;
+	sampler_config.period_ns = 1000000000 / samples_per_sec;
+
 	/* Initialize GPU stats */
 	if (HAS_STATS_REGS(devid)) {
 		for (i = 0; i < STATS_COUNT; i++) {
@@ -537,11 +570,16 @@ int main(int argc, char **argv)
 		}
 	}
 
+	sampler = igt_sampler_start(&sampler_config);
+	if (!sampler) {
+		perror("sampler");
+		exit(1);
+	}
+
 	for (;;) {
-		int j;
-		unsigned long long t1, ti, tf, t2;
-		unsigned long long def_sleep = 1000000 / samples_per_sec;
-		unsigned long long last_samples_per_sec = samples_per_sec;
+		int j, n;
+		unsigned long long t1, t2;
+		unsigned long long last_samples_per_sec = 0;
 		unsigned short int max_lines;
 		struct winsize ws;
 		char clear_screen[] = {0x1b, '[', 'H',
@@ -557,33 +595,29 @@ int main(int argc, char **argv)
 		ring_reset(&bsd6_ring);
 		ring_reset(&blt_ring);
 
-		for (i = 0; i < samples_per_sec; i++) {
-			long long interval;
-			ti = gettime();
-			if (IS_965(devid)) {
-				instdone = INREG(INSTDONE_I965);
-				instdone1 = INREG(INSTDONE_1);
-			} else
-				instdone = INREG(INSTDONE);
-
-			for (j = 0; j < num_instdone_bits; j++)
-				update_idle_bit(&top_bits[j]);
-
-			ring_sample(&render_ring);
-			ring_sample(&bsd_ring);
-			ring_sample(&bsd6_ring);
-			ring_sample(&blt_ring);
-
-			tf = gettime();
-			if (tf - t1 >= 1000000) {
-				/* We are out of sync, bail out */
-				last_samples_per_sec = i+1;
-				break;
+		/* Collect a second's worth of samples */
+		do {
+			usleep(10000);
+
+			while ((n = igt_sampler_drain(sampler, samples, 256))) {
+				for (i = 0; i < n; i++) {
+					instdone = samples[i].values[0];
+					if (IS_965(devid))
+						instdone1 = samples[i].values[1];
+
+					for (j = 0; j < num_instdone_bits; j++)
+						update_idle_bit(&top_bits[j]);
+
+					ring_sample(&render_ring, &samples[i]);
+					ring_sample(&bsd_ring, &samples[i]);
+					ring_sample(&bsd6_ring, &samples[i]);
+					ring_sample(&blt_ring, &samples[i]);
+				}
+				last_samples_per_sec += n;
 			}
-			interval = def_sleep - (tf - ti);
-			if (interval > 0)
-				usleep(interval);
-		}
+		} while (gettime() - t1 < 1000000);
+		if (!last_samples_per_sec)
+			last_samples_per_sec = 1;
 
 		if (HAS_STATS_REGS(devid)) {
 			for (i = 0; i < STATS_COUNT; i++) {
@@ -711,6 +745,7 @@ int main(int argc, char **argv)
 		}
 	}
 
+	igt_sampler_stop(sampler);
 	fclose(output);
 
 	intel_register_access_fini();
@@ -22,12 +22,14 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -61,6 +63,9 @@ struct config {
 	/* read: number of registers to read */
 	uint32_t count;
 
+	/* read: write the values as raw 32-bit words */
+	bool raw;
+
 	/* write: do a posting read */
 	bool post;
 
@@ -74,6 +79,7 @@ struct config {
 	char *specfile;
 	struct reg *regs;
 	ssize_t regcount;
+	struct reg_index *index;
 
 	int verbosity;
 };
@@ -82,28 +88,22 @@ struct config {
 static int set_reg_by_addr(struct config *config, struct reg *reg,
 			   uint32_t addr)
 {
-	int i;
+	const struct reg *r;
 
 	reg->addr = addr;
 	if (reg->name)
 		free(reg->name);
 	reg->name = NULL;
 
-	for (i = 0; i < config->regcount; i++) {
-		struct reg *r = &config->regs[i];
-
-		if (reg->port_desc.port != r->port_desc.port)
-			continue;
-
-		/* ->mmio_offset should be 0 for non-MMIO ports. */
-		if (addr + reg->mmio_offset == r->addr + r->mmio_offset) {
-			/* Always output the "normalized" offset+addr. */
-			reg->mmio_offset = r->mmio_offset;
-			reg->addr = r->addr;
+	/* ->mmio_offset should be 0 for non-MMIO ports. */
+	r = intel_reg_spec_find_addr(config->index, reg->port_desc.port,
+				     addr + reg->mmio_offset);
+	if (r) {
+		/* Always output the "normalized" offset+addr. */
+		reg->mmio_offset = r->mmio_offset;
+		reg->addr = r->addr;
 
-			reg->name = r->name ? strdup(r->name) : NULL;
-			break;
-		}
+		reg->name = r->name ? strdup(r->name) : NULL;
 	}
 
 	return 0;
@@ -113,32 +113,22 @@ static int set_reg_by_addr(struct config *config, struct reg *reg,
 static int set_reg_by_name(struct config *config, struct reg *reg,
 			   const char *name)
 {
-	int i;
+	const struct reg *r;
 
 	reg->name = strdup(name);
 	reg->addr = 0;
 
-	for (i = 0; i < config->regcount; i++) {
-		struct reg *r = &config->regs[i];
-
-		if (reg->port_desc.port != r->port_desc.port)
-			continue;
-
-		if (!r->name)
-			continue;
+	r = intel_reg_spec_find_name(config->index, reg->port_desc.port, name);
+	if (!r)
+		return -1;
 
-		if (strcasecmp(name, r->name) == 0) {
-			reg->addr = r->addr;
+	reg->addr = r->addr;
 
-			/* Also get MMIO offset if not already specified. */
-			if (!reg->mmio_offset && r->mmio_offset)
-				reg->mmio_offset = r->mmio_offset;
+	/* Also get MMIO offset if not already specified. */
+	if (!reg->mmio_offset && r->mmio_offset)
+		reg->mmio_offset = r->mmio_offset;
 
-			return 0;
-		}
-	}
-
-	return -1;
+	return 0;
 }
 
 static void to_binary(char *buf, size_t buflen, uint32_t val)
@@ -350,11 +340,26 @@ static int write_register(struct config *config, struct reg *reg, uint32_t val)
 	return ret;
 }
 
-/* s has [(PORTNAME|PORTNUM|MMIO-OFFSET):](REGNAME|REGADDR) */
-static int parse_reg(struct config *config, struct reg *reg, const char *s)
+/* s has (REGNAME|REGADDR), port desc must have been set */
+static int parse_reg_addr(struct config *config, struct reg *reg,
+			  const char *s)
 {
 	unsigned long addr;
 	char *endp;
+
+	addr = strtoul(s, &endp, 16);
+	if (endp > s && *endp == 0) {
+		/* It's a number. */
+		return set_reg_by_addr(config, reg, addr);
+	} else {
+		/* Not a number, it's a name. */
+		return set_reg_by_name(config, reg, s);
+	}
+}
+
+/* s has [(PORTNAME|PORTNUM|MMIO-OFFSET):](REGNAME|REGADDR) */
+static int parse_reg(struct config *config, struct reg *reg, const char *s)
+{
 	const char *p;
 	int ret;
 
@@ -384,22 +389,162 @@ static int parse_reg(struct config *config, struct reg *reg, const char *s)
 		return ret;
 	}
 
-	addr = strtoul(p, &endp, 16);
-	if (endp > p && *endp == 0) {
-		/* It's a number. */
-		ret = set_reg_by_addr(config, reg, addr);
+	return parse_reg_addr(config, reg, p);
+}
+
+/*
+ * s has REGISTER, REGISTER..REGISTER or REGISTER+COUNT, the end of a range
+ * being on the same port as its start. Returns the number of registers, and
+ * whether they were given as a range rather than with --count.
+ */
+static int parse_reg_range(struct config *config, struct reg *reg,
+			   uint32_t *count, bool *range, const char *s)
+{
+	const char *p;
+	char *start;
+	int ret;
+
+	*count = config->count;
+	*range = false;
+
+	p = strstr(s, "..");
+	if (!p)
+		p = strrchr(s, '+');
+	if (!p)
+		return parse_reg(config, reg, s);
+
+	start = strndup(s, p - s);
+	if (!start)
+		return -1;
+	ret = parse_reg(config, reg, start);
+	free(start);
+	if (ret)
+		return ret;
+
+	*range = true;
+	if (*p == '+') {
+		char *endp;
+
+		*count = strtoul(p + 1, &endp, 0);
+		if (endp == p + 1 || *endp) {
+			fprintf(stderr, "invalid count in '%s'\n", s);
+			return -1;
+		}
 	} else {
-		/* Not a number, it's a name. */
-		ret = set_reg_by_name(config, reg, p);
+		struct reg end = {
+			.port_desc = reg->port_desc,
+			.mmio_offset = reg->mmio_offset,
+		};
+		uint32_t first, last;
+
+		p += 2;
+		if (strchr(p, ':'))
+			ret = parse_reg(config, &end, p);
+		else
+			ret = parse_reg_addr(config, &end, p);
+		free(end.name);
+		if (ret)
+			return ret;
+
+		first = reg->addr + reg->mmio_offset;
+		last = end.addr + end.mmio_offset;
+		if (end.port_desc.port != reg->port_desc.port || last < first) {
+			fprintf(stderr, "invalid range '%s'\n", s);
+			return -1;
+		}
+
+		*count = (last - first) / reg->port_desc.stride + 1;
 	}
 
-	return ret;
+	return 0;
+}
+
+/*
+ * Refuse MMIO ranges that cross areas the register map says aren't there to
+ * be read. The map doesn't cover everything past its top, e.g. the display
+ * on vlv/chv, so that part is left alone. It doesn't know about every
+ * register below either (GEN6_UCGCTL1 sits in what it calls reserved on
+ * gen6), so only explicit ranges are checked, never single registers.
+ */
+static bool mmio_range_readable(struct config *config, uint32_t offset,
+				uint32_t count)
+{
+	struct intel_register_map map;
+	uint64_t end = (uint64_t)offset + 4 * (uint64_t)count;
+
+	if (config->mmiofile || intel_gen(config->devid) < 4)
+		return true;
+
+	map = intel_get_register_map(config->devid);
+	if (offset >= map.top)
+		return true;
+	if (end > map.top)
+		end = map.top;
+
+	return intel_register_span_allowed(map, offset, end - offset,
+					   INTEL_RANGE_READ);
+}
+
+/* Read all the registers first, so they are read as close together as can be. */
+static int read_range(struct config *config, struct reg *reg, uint32_t count,
+		      bool check)
+{
+	uint32_t *vals;
+	uint32_t i;
+
+	if (!count)
+		return 0;
+
+	vals = malloc(count * sizeof(*vals));
+	if (!vals) {
+		fprintf(stderr, "read: %s\n", strerror(ENOMEM));
+		return -1;
+	}
+
+	if (reg->port_desc.port == PORT_MMIO) {
+		uint32_t offset = reg->mmio_offset + reg->addr;
+
+		if (check && !mmio_range_readable(config, offset, count)) {
+			fprintf(stderr, "read: 0x%08x+%u crosses registers "
+				"that can't be read\n", offset, count);
+			free(vals);
+			return -1;
+		}
+
+		for (i = 0; i < count; i++)
+			vals[i] = INREG(offset + 4 * i);
+	} else {
+		struct reg r = *reg;
+
+		for (i = 0; i < count; i++) {
+			if (read_register(config, &r, &vals[i])) {
+				free(vals);
+				return -1;
+			}
+			r.addr += r.port_desc.stride;
+		}
+	}
+
+	if (config->raw) {
+		if (fwrite(vals, sizeof(*vals), count, stdout) != count)
+			fprintf(stderr, "read: %s\n", strerror(errno));
+	} else {
+		for (i = 0; i < count; i++) {
+			dump_decode(config, reg, vals[i]);
+			/* Update addr and name. */
+			set_reg_by_addr(config, reg,
+					reg->addr + reg->port_desc.stride);
+		}
+	}
+
+	free(vals);
+
+	return 0;
 }
 
-/* XXX: add support for register ranges, maybe REGISTER..REGISTER */
 static int intel_reg_read(struct config *config, int argc, char *argv[])
 {
-	int i, j;
+	int i;
 
 	if (argc == 1) {
 		fprintf(stderr, "read: no registers specified\n");
@@ -413,16 +558,14 @@ static int intel_reg_read(struct config *config, int argc, char *argv[])
 
 	for (i = 1; i < argc; i++) {
 		struct reg reg;
+		uint32_t count;
+		bool range;
 
-		if (parse_reg(config, &reg, argv[i]))
+		if (parse_reg_range(config, &reg, &count, &range, argv[i]))
 			continue;
 
-		for (j = 0; j < config->count; j++) {
-			dump_register(config, &reg);
-			/* Update addr and name. */
-			set_reg_by_addr(config, &reg,
-					reg.addr + reg.port_desc.stride);
-		}
+		read_range(config, &reg, count, range);
+		free(reg.name);
 	}
 
 	intel_register_access_fini();
@@ -516,7 +659,6 @@ static int intel_reg_snapshot(struct config *config, int argc, char *argv[])
 	return EXIT_SUCCESS;
 }
 
-/* XXX: add support for reading and re-decoding a previously done dump */
 static int intel_reg_decode(struct config *config, int argc, char *argv[])
 {
 	int i;
@@ -552,6 +694,219 @@ static int intel_reg_decode(struct config *config, int argc, char *argv[])
 	return EXIT_SUCCESS;
 }
 
+struct snapshot {
+	const char *filename;
+	const void *mmio;
+	size_t size;
+};
+
+/*
+ * Map an MMIO bar snapshot, as written by intel_reg snapshot. Unlike
+ * intel_mmio_use_dump_file(), which exits on errors, this returns them.
+ */
+static int open_snapshot(struct snapshot *snapshot, const char *filename)
+{
+	struct stat st;
+	void *mmio;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "open '%s': %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st)) {
+		fprintf(stderr, "stat '%s': %s\n", filename, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if (st.st_size == 0) {
+		fprintf(stderr, "'%s' is empty\n", filename);
+		close(fd);
+		return -1;
+	}
+
+	mmio = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mmio == MAP_FAILED) {
+		fprintf(stderr, "mmap '%s': %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	snapshot->filename = filename;
+	snapshot->mmio = mmio;
+	snapshot->size = st.st_size;
+
+	return 0;
+}
+
+static void close_snapshot(struct snapshot *snapshot)
+{
+	munmap((void *)snapshot->mmio, snapshot->size);
+}
+
+/* Only MMIO registers are in a snapshot; false if reg isn't. */
+static bool read_snapshot(const struct snapshot *snapshot,
+			  const struct reg *reg, uint32_t *valp)
+{
+	uint64_t offset = (uint64_t)reg->mmio_offset + reg->addr;
+
+	if (reg->port_desc.port != PORT_MMIO ||
+	    offset + sizeof(uint32_t) > snapshot->size)
+		return false;
+
+	*valp = *(const uint32_t *)((const char *)snapshot->mmio + offset);
+
+	return true;
+}
+
+static int intel_reg_decode_snapshot(struct config *config,
+				     int argc, char *argv[])
+{
+	int i, j;
+
+	if (argc == 1) {
+		fprintf(stderr, "decode-snapshot: no snapshots specified\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 1; i < argc; i++) {
+		struct snapshot snapshot;
+
+		if (open_snapshot(&snapshot, argv[i]))
+			return EXIT_FAILURE;
+
+		if (argc > 2)
+			printf("%s%s:\n", i > 1 ? "\n" : "", argv[i]);
+
+		for (j = 0; j < config->regcount; j++) {
+			struct reg *reg = &config->regs[j];
+			uint32_t val;
+
+			if (read_snapshot(&snapshot, reg, &val))
+				dump_decode(config, reg, val);
+		}
+
+		close_snapshot(&snapshot);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/* List the runs of set bits in mask, highest first, e.g. "31, 7:4". */
+static void format_bits(char *buf, size_t buflen, uint32_t mask)
+{
+	int hi, lo, len = 0;
+
+	*buf = '\0';
+
+	for (hi = 31; hi >= 0 && (size_t)len < buflen; hi = lo - 1) {
+		if (!(mask & (1u << hi))) {
+			lo = hi;
+			continue;
+		}
+
+		for (lo = hi; lo > 0 && mask & (1u << (lo - 1)); lo--)
+			;
+
+		if (hi == lo)
+			len += snprintf(buf + len, buflen - len, "%s%d",
+					len ? ", " : "", hi);
+		else
+			len += snprintf(buf + len, buflen - len, "%s%d:%d",
+					len ? ", " : "", hi, lo);
+	}
+}
+
+/* With --all the decode is one line per platform. */
+static void print_decode(const char *prefix, char *decode)
+{
+	char *line, *save;
+
+	for (line = strtok_r(decode, "\n", &save); line;
+	     line = strtok_r(NULL, "\n", &save))
+		printf("\t%s %s\n", prefix, line);
+}
+
+static void diff_register(struct config *config, struct reg *reg,
+			  uint32_t old, uint32_t new)
+{
+	uint32_t devid = config->all_platforms ? 0 : config->devid;
+	char old_decode[1024], new_decode[1024];
+	char bits[256];
+
+	format_bits(bits, sizeof(bits), old ^ new);
+
+	if (reg->mmio_offset)
+		printf("%24s (0x%08x:0x%08x): 0x%08x -> 0x%08x (bits %s)\n",
+		       reg->name ?: "", reg->mmio_offset, reg->addr,
+		       old, new, bits);
+	else
+		printf("%35s (0x%08x): 0x%08x -> 0x%08x (bits %s)\n",
+		       reg->name ?: "", reg->addr, old, new, bits);
+
+	intel_reg_spec_decode(old_decode, sizeof(old_decode), reg, old, devid);
+	intel_reg_spec_decode(new_decode, sizeof(new_decode), reg, new, devid);
+	if (strcmp(old_decode, new_decode)) {
+		print_decode("-", old_decode);
+		print_decode("+", new_decode);
+	}
+
+	if (config->binary) {
+		char bin[1024];
+
+		to_binary(bin, sizeof(bin), old);
+		printf("%s", bin);
+		to_binary(bin, sizeof(bin), new);
+		printf("%s", bin);
+	}
+}
+
+static int intel_reg_diff(struct config *config, int argc, char *argv[])
+{
+	struct snapshot old, new;
+	int i, changed = 0;
+
+	if (argc != 3) {
+		fprintf(stderr, "diff: two snapshots required\n");
+		return 2;
+	}
+
+	if (open_snapshot(&old, argv[1]))
+		return 2;
+
+	if (open_snapshot(&new, argv[2])) {
+		close_snapshot(&old);
+		return 2;
+	}
+
+	for (i = 0; i < config->regcount; i++) {
+		struct reg *reg = &config->regs[i];
+		uint32_t old_val, new_val;
+
+		if (!read_snapshot(&old, reg, &old_val) ||
+		    !read_snapshot(&new, reg, &new_val))
+			continue;
+
+		if (old_val == new_val)
+			continue;
+
+		diff_register(config, reg, old_val, new_val);
+		changed++;
+	}
+
+	close_snapshot(&old);
+	close_snapshot(&new);
+
+	if (config->verbosity > 0)
+		fprintf(stderr, "%d registers differ\n", changed);
+
+	/* Like diff(1), 1 when there are differences and 2 on errors. */
+	return changed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 static int intel_reg_list(struct config *config, int argc, char *argv[])
 {
 	int i;
@@ -570,13 +925,17 @@ struct command {
 	const char *description;
 	const char *synopsis;
 	int (*function)(struct config *config, int argc, char *argv[]);
+	/* works on snapshots, and doesn't need the device with --devid */
+	bool offline;
+	/* exit status on errors, when not EXIT_FAILURE */
+	int failure;
 };
 
 static const struct command commands[] = {
 	{
 		.name = "read",
 		.function = intel_reg_read,
-		.synopsis = "[--count=N] REGISTER [...]",
+		.synopsis = "[--count=N] [--raw] REGISTER[(..REGISTER|+N)] [...]",
 		.description = "read and decode specified register(s)",
 	},
 	{
@@ -601,6 +960,22 @@ static const struct command commands[] = {
 		.function = intel_reg_snapshot,
 		.description = "create a snapshot of the MMIO bar to stdout",
 	},
+	{
+		.name = "decode-snapshot",
+		.function = intel_reg_decode_snapshot,
+		.synopsis = "FILE [...]",
+		.description = "decode all known registers in MMIO snapshot(s)",
+		.offline = true,
+	},
+	{
+		.name = "diff",
+		.function = intel_reg_diff,
+		.synopsis = "OLD NEW",
+		.description = "diff known registers of two MMIO snapshots",
+		.offline = true,
+		/* like diff(1), 1 means there are differences */
+		.failure = 2,
+	},
 	{
 		.name = "list",
 		.function = intel_reg_list,
@@ -629,6 +1004,8 @@ static int intel_reg_help(struct config *config, int argc, char *argv[])
 	printf("\n");
 	printf("REGISTER is defined as:\n");
         printf("  [(PORTNAME|PORTNUM|MMIO-OFFSET):](REGNAME|REGADDR)\n");
+	printf("REGISTER..REGISTER is the range between them, inclusive, and\n");
+	printf("REGISTER+N is N registers from REGISTER\n");
 
 	printf("\n");
 	printf("PORTNAME is one of:\n");
@@ -639,15 +1016,18 @@ static int intel_reg_help(struct config *config, int argc, char *argv[])
 	printf("OPTIONS common to most COMMANDS:\n");
 	printf(" --spec=PATH    Read register spec from directory or file\n");
 	printf(" --mmio=FILE    Use an MMIO snapshot\n");
-	printf(" --devid=DEVID  Specify PCI device ID for --mmio=FILE\n");
+	printf(" --devid=DEVID  Specify PCI device ID for --mmio=FILE or snapshots\n");
 	printf(" --all          Decode registers for all known platforms\n");
 	printf(" --binary       Binary dump registers\n");
+	printf(" --raw          Output raw 32-bit values read, without decoding\n");
 	printf(" --verbose      Increase verbosity\n");
 	printf(" --quiet        Reduce verbosity\n");
 
 	printf("\n");
 	printf("Environment variables:\n");
 	printf(" INTEL_REG_SPEC Read register spec from directory or file\n");
+	printf(" INTEL_REG_SPEC_CACHE Directory for compiled register specs,\n");
+	printf("                empty to disable\n");
 
 	return EXIT_SUCCESS;
 }
@@ -748,7 +1128,7 @@ static int read_reg_spec(struct config *config)
 		path = buf;
 	}
 
-	config->regcount = intel_reg_spec_file(&config->regs, path);
+	config->regcount = intel_reg_spec_file_cached(&config->regs, path);
 	if (config->regcount <= 0) {
 		fprintf(stderr, "Warning: reading '%s' failed. "
 			"Using builtin register spec.\n", path);
@@ -770,6 +1150,7 @@ enum opt {
 	OPT_MMIO,
 	OPT_DEVID,
 	OPT_COUNT,
+	OPT_RAW,
 	OPT_POST,
 	OPT_ALL,
 	OPT_BINARY,
@@ -781,14 +1162,14 @@ enum opt {
 
 int main(int argc, char *argv[])
 {
-	int ret, i, index;
+	int ret, i, index, failure;
 	char *endp;
 	enum opt opt;
 	const struct command *command = NULL;
 	struct config config = {
 		.count = 1,
 	};
-	bool help = false;
+	bool help = false, bad_usage = false;
 
 	static struct option options[] = {
 		/* global options */
@@ -801,6 +1182,7 @@ int main(int argc, char *argv[])
 		{ "devid",	required_argument,	NULL,	OPT_DEVID },
 		/* options specific to read */
 		{ "count",	required_argument,	NULL,	OPT_COUNT },
+		{ "raw",	no_argument,		NULL,	OPT_RAW },
 		/* options specific to write */
 		{ "post",	no_argument,		NULL,	OPT_POST },
 		/* options specific to read, dump and decode */
@@ -818,23 +1200,26 @@ int main(int argc, char *argv[])
 			if (!config.mmiofile) {
 				fprintf(stderr, "strdup: %s\n",
 					strerror(errno));
-				return EXIT_FAILURE;
+				bad_usage = true;
 			}
 			break;
 		case OPT_DEVID:
 			config.devid = strtoul(optarg, &endp, 16);
 			if (*endp) {
 				fprintf(stderr, "invalid devid '%s'\n", optarg);
-				return EXIT_FAILURE;
+				bad_usage = true;
 			}
 			break;
 		case OPT_COUNT:
 			config.count = strtol(optarg, &endp, 10);
 			if (*endp) {
 				fprintf(stderr, "invalid count '%s'\n", optarg);
-				return EXIT_FAILURE;
+				bad_usage = true;
 			}
 			break;
+		case OPT_RAW:
+			config.raw = true;
+			break;
 		case OPT_POST:
 			config.post = true;
 			break;
@@ -843,7 +1228,7 @@ int main(int argc, char *argv[])
 			if (!config.specfile) {
 				fprintf(stderr, "strdup: %s\n",
 					strerror(errno));
-				return EXIT_FAILURE;
+				bad_usage = true;
 			}
 			break;
 		case OPT_ALL:
@@ -864,13 +1249,26 @@ int main(int argc, char *argv[])
 		case OPT_END:
 			break;
 		case OPT_UNKNOWN:
-			return EXIT_FAILURE;
+			bad_usage = true;
+			break;
 		}
 	}
 
 	argc -= optind;
 	argv += optind;
 
+	for (i = 0; argc > 0 && i < ARRAY_SIZE(commands); i++) {
+		if (strcmp(argv[0], commands[i].name) == 0) {
+			command = &commands[i];
+			break;
+		}
+	}
+
+	/* Option errors are reported once the command is known */
+	failure = command && command->failure ? command->failure : EXIT_FAILURE;
+	if (bad_usage)
+		return failure;
+
 	if (help || (argc > 0 && strcmp(argv[0], "help") == 0))
 		return intel_reg_help(&config, argc, argv);
 
@@ -879,39 +1277,39 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (!command) {
+		fprintf(stderr, "'%s' is not an intel-reg command\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
 	if (config.mmiofile) {
 		if (!config.devid) {
 			fprintf(stderr, "--mmio requires --devid\n");
-			return EXIT_FAILURE;
+			return failure;
 		}
-	} else {
-		/* XXX: devid without --mmio could be useful for decode. */
+	} else if (!command->offline || !config.devid) {
+		/* --devid without --mmio only makes sense offline. */
 		if (config.devid) {
 			fprintf(stderr, "--devid without --mmio\n");
-			return EXIT_FAILURE;
+			return failure;
 		}
 		config.pci_dev = intel_get_pci_device();
 		config.devid = config.pci_dev->device_id;
 	}
 
 	if (read_reg_spec(&config) < 0) {
-		return EXIT_FAILURE;
-	}
-
-	for (i = 0; i < ARRAY_SIZE(commands); i++) {
-		if (strcmp(argv[0], commands[i].name) == 0) {
-			command = &commands[i];
-			break;
-		}
+		return failure;
 	}
 
-	if (!command) {
-		fprintf(stderr, "'%s' is not an intel-reg command\n", argv[0]);
-		return EXIT_FAILURE;
+	config.index = intel_reg_spec_index(config.regs, config.regcount);
+	if (!config.index) {
+		fprintf(stderr, "Error: %s\n", strerror(ENOMEM));
+		return failure;
 	}
 
 	ret = command->function(&config, argc, argv);
 
+	intel_reg_spec_index_free(config.index);
 	free(config.mmiofile);
 
 	return ret;
@@ -2600,6 +2600,65 @@ static struct {
 };
 #undef DECLARE_REGS
 
+/*
+ * Hash of the registers in known_registers[] by address, each chain in the
+ * order of known_registers[] so decodes come out as with a linear search.
+ */
+static struct {
+	struct decode_entry {
+		const struct reg_debug *reg;
+		int known;
+		int next;
+	} *entries;
+	int *heads;
+	uint32_t mask;
+} decode_index;
+
+static uint32_t decode_hash(uint32_t addr)
+{
+	return (addr ^ addr >> 12) * 0x9e3779b9 >> 8 & decode_index.mask;
+}
+
+static int build_decode_index(void)
+{
+	int i, j, n = 0, size = 16;
+
+	for (i = 0; i < ARRAY_SIZE(known_registers); i++)
+		n += known_registers[i].count;
+
+	while (size < 2 * n)
+		size *= 2;
+
+	decode_index.entries = malloc(n * sizeof(*decode_index.entries));
+	decode_index.heads = malloc(size * sizeof(*decode_index.heads));
+	if (!decode_index.entries || !decode_index.heads) {
+		free(decode_index.entries);
+		free(decode_index.heads);
+		decode_index.entries = NULL;
+		decode_index.heads = NULL;
+		return -1;
+	}
+
+	decode_index.mask = size - 1;
+	memset(decode_index.heads, 0xff, size * sizeof(*decode_index.heads));
+
+	/* Push in reverse so that each chain ends up in table order. */
+	for (i = ARRAY_SIZE(known_registers) - 1; i >= 0; i--) {
+		for (j = known_registers[i].count - 1; j >= 0; j--) {
+			const struct reg_debug *r = &known_registers[i].regs[j];
+			struct decode_entry *e = &decode_index.entries[--n];
+			uint32_t h = decode_hash(r->reg);
+
+			e->reg = r;
+			e->known = i;
+			e->next = decode_index.heads[h];
+			decode_index.heads[h] = n;
+		}
+	}
+
+	return 0;
+}
+
 /*
  * Decode register value into buffer for devid.
  *
@@ -2610,15 +2669,24 @@ int intel_reg_spec_decode(char *buf, size_t bufsize, const struct reg *reg,
 			  uint32_t val, uint32_t devid)
 {
 	char tmp[1024];
-	int i, j;
+	int i, e;
 
 	if (!bufsize)
 		return -1;
 
 	*buf = 0;
 
-	for (i = 0; i < ARRAY_SIZE(known_registers); i++) {
-		const struct reg_debug *regs = known_registers[i].regs;
+	if (!decode_index.heads && build_decode_index())
+		return -1;
+
+	for (e = decode_index.heads[decode_hash(reg->addr)]; e >= 0;
+	     e = decode_index.entries[e].next) {
+		const struct reg_debug *r = decode_index.entries[e].reg;
+
+		i = decode_index.entries[e].known;
+
+		if (reg->addr != r->reg)
+			continue;
 
 		if (devid) {
 			if (known_registers[i].match &&
@@ -2626,29 +2694,23 @@ int intel_reg_spec_decode(char *buf, size_t bufsize, const struct reg *reg,
 				continue;
 		}
 
-		for (j = 0; j < known_registers[i].count; j++) {
-			const struct reg_debug *r = &regs[j];
-			if (reg->addr != r->reg)
-				continue;
-
-			if (r->debug_output)
-				r->debug_output(tmp, sizeof(tmp), r->reg,
-						val, devid);
-			else if (devid)
-				return 0;
-			else
-				continue;
-
-			if (devid) {
-				strncpy(buf, tmp, bufsize);
-				return 0;
-			}
+		if (r->debug_output)
+			r->debug_output(tmp, sizeof(tmp), r->reg,
+					val, devid);
+		else if (devid)
+			return 0;
+		else
+			continue;
 
-			strncat(buf, known_registers[i].description, bufsize);
-			strncat(buf, "\t", bufsize);
-			strncat(buf, tmp, bufsize);
-			strncat(buf, "\n", bufsize);
+		if (devid) {
+			strncpy(buf, tmp, bufsize);
+			return 0;
 		}
+
+		strncat(buf, known_registers[i].description, bufsize);
+		strncat(buf, "\t", bufsize);
+		strncat(buf, tmp, bufsize);
+		strncat(buf, "\n", bufsize);
 	}
 
 	return 0;
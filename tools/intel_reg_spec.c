@@ -21,14 +21,21 @@
  * SOFTWARE.
  */
 
+#define _GNU_SOURCE
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <regex.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 
 #include "intel_reg_spec.h"
 
@@ -235,9 +242,9 @@ static int parse_line(struct reg *reg, const char *line)
 			reg->name = p;
 		} else if (i == 2) {
 			reg->addr = strtoul(p, &e, 16);
-			free(p);
 			if (*e)
 				ret = -1;
+			free(p);
 		} else if (i == 3) {
 			ret = parse_port_desc(reg, p);
 			free(p);
@@ -250,8 +257,53 @@ static int parse_line(struct reg *reg, const char *line)
 	return ret;
 }
 
+/* The files a spec was read from, to tell whether a cache is stale */
+struct spec_source {
+	char *path;
+	struct stat st;
+};
+
+struct spec_sources {
+	struct spec_source *files;
+	size_t count, size;
+};
+
+static int add_source(struct spec_sources *sources, const char *filename,
+		      FILE *file)
+{
+	struct spec_source *src;
+
+	if (sources->count == sources->size) {
+		sources->size = sources->size ? 2 * sources->size : 16;
+		sources->files = recalloc(sources->files, sources->size,
+					  sizeof(*sources->files));
+		if (!sources->files)
+			return -1;
+	}
+
+	src = &sources->files[sources->count];
+	src->path = realpath(filename, NULL);
+	if (!src->path || fstat(fileno(file), &src->st)) {
+		free(src->path);
+		return -1;
+	}
+	sources->count++;
+
+	return 0;
+}
+
+static void free_sources(struct spec_sources *sources)
+{
+	size_t i;
+
+	for (i = 0; i < sources->count; i++)
+		free(sources->files[i].path);
+	free(sources->files);
+}
+
 static ssize_t parse_file(struct reg **regs, size_t *nregs,
-			  ssize_t index, const char *filename)
+			  ssize_t index, const char *filename,
+			  struct spec_sources *sources)
 {
 	FILE *file;
 	char *line = NULL, *include;
@@ -266,6 +318,11 @@ static ssize_t parse_file(struct reg **regs, size_t *nregs,
 		return -1;
 	}
 
+	if (sources && add_source(sources, filename, file)) {
+		fprintf(stderr, "Error: %s: %s\n", filename, strerror(errno));
+		goto out;
+	}
+
 	while (getline(&line, &linesize, file) != -1) {
 		struct reg reg;
 
@@ -276,7 +333,8 @@ static ssize_t parse_file(struct reg **regs, size_t *nregs,
 
 		include = include_file(line, filename);
 		if (include) {
-			index = parse_file(regs, nregs, index, include);
+			index = parse_file(regs, nregs, index, include,
+					   sources);
 			free(include);
 			if (index < 0) {
 				fprintf(stderr, "Error: %s:%d: %s",
@@ -328,7 +386,389 @@ ssize_t intel_reg_spec_file(struct reg **regs, const char *file)
 	size_t nregs = 0;
 	*regs = NULL;
 
-	return parse_file(regs, &nregs, 0, file);
+	return parse_file(regs, &nregs, 0, file, NULL);
+}
+
+/*
+ * Compiled spec cache: the registers of a spec file and everything it
+ * includes, in spec order, with their names in a string table, and the
+ * size and modification time of each file read so that a stale cache is
+ * noticed and rebuilt.
+ */
+#define SPEC_CACHE_MAGIC "IGTRSPEC"
+#define SPEC_CACHE_VERSION 1
+#define SPEC_CACHE_NO_NAME 0xffffffff
+
+struct spec_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_files;
+	uint32_t num_regs;
+	uint32_t strings_size;
+};
+
+struct spec_cache_file {
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t size;
+	uint64_t ino;
+	uint32_t path;
+	uint32_t pad;
+};
+
+struct spec_cache_reg {
+	uint32_t name;
+	uint32_t addr;
+	uint32_t mmio_offset;
+	uint32_t port_desc; /* index into port_descs[] */
+};
+
+static bool source_changed(const struct spec_cache_file *f, const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st))
+		return true;
+
+	return f->mtime_sec != st.st_mtim.tv_sec ||
+		f->mtime_nsec != st.st_mtim.tv_nsec ||
+		f->size != (uint64_t)st.st_size ||
+		f->ino != (uint64_t)st.st_ino;
+}
+
+/* Cache file for a spec file, NULL if caching is disabled. */
+static char *spec_cache_path(const char *specpath)
+{
+	const char *dir = getenv("INTEL_REG_SPEC_CACHE");
+	char base[PATH_MAX], *path;
+	uint64_t hash = 14695981039346656037ull;
+	const char *p;
+
+	if (dir && !*dir)
+		return NULL;
+
+	if (!dir) {
+		const char *xdg = getenv("XDG_CACHE_HOME");
+		const char *home = getenv("HOME");
+
+		if (xdg && *xdg)
+			snprintf(base, sizeof(base), "%s/intel-gpu-tools", xdg);
+		else if (home && *home)
+			snprintf(base, sizeof(base), "%s/.cache/intel-gpu-tools",
+				 home);
+		else
+			return NULL;
+		dir = base;
+	}
+
+	for (p = specpath; *p; p++) {
+		hash ^= (unsigned char)*p;
+		hash *= 1099511628211ull;
+	}
+
+	if (asprintf(&path, "%s/reg-spec-%016llx", dir,
+		     (unsigned long long)hash) < 0)
+		return NULL;
+
+	return path;
+}
+
+/*
+ * The cache is only mapped while it is read: the registers are copied out
+ * of it and their names strdup()ed, so that they are allocated just like
+ * parse_file()'s and freed the same way with intel_reg_spec_free(). What
+ * the cache saves is the parsing, not the copies.
+ */
+static ssize_t read_spec_cache(struct reg **regs, const char *cachepath,
+			       const char *specpath)
+{
+	const struct spec_cache_header *hdr;
+	const struct spec_cache_file *files;
+	const struct spec_cache_reg *cregs;
+	const char *strings;
+	struct stat st;
+	ssize_t ret = -1;
+	size_t size;
+	void *map;
+	uint32_t i;
+	int fd;
+
+	fd = open(cachepath, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return -1;
+	}
+
+	size = st.st_size;
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	hdr = map;
+	files = (const void *)(hdr + 1);
+	cregs = (const void *)(files + hdr->num_files);
+	strings = (const void *)(cregs + hdr->num_regs);
+
+	if (memcmp(hdr->magic, SPEC_CACHE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != SPEC_CACHE_VERSION || hdr->num_files == 0 ||
+	    sizeof(*hdr) + (uint64_t)hdr->num_files * sizeof(*files) +
+	    (uint64_t)hdr->num_regs * sizeof(*cregs) +
+	    hdr->strings_size != size ||
+	    hdr->strings_size == 0 || strings[hdr->strings_size - 1])
+		goto out;
+
+	/* The first file is the spec itself, guarding against collisions. */
+	for (i = 0; i < hdr->num_files; i++) {
+		if (files[i].path >= hdr->strings_size)
+			goto out;
+		if (i == 0 && strcmp(strings + files[i].path, specpath))
+			goto out;
+		if (source_changed(&files[i], strings + files[i].path))
+			goto out;
+	}
+
+	*regs = calloc(hdr->num_regs ?: 1, sizeof(**regs));
+	if (!*regs)
+		goto out;
+
+	for (i = 0; i < hdr->num_regs; i++) {
+		struct reg *reg = &(*regs)[i];
+
+		if (cregs[i].port_desc >= ARRAY_SIZE(port_descs) ||
+		    (cregs[i].name != SPEC_CACHE_NO_NAME &&
+		     cregs[i].name >= hdr->strings_size))
+			goto free_regs;
+
+		reg->port_desc = port_descs[cregs[i].port_desc];
+		reg->addr = cregs[i].addr;
+		reg->mmio_offset = cregs[i].mmio_offset;
+		if (cregs[i].name != SPEC_CACHE_NO_NAME) {
+			reg->name = strdup(strings + cregs[i].name);
+			if (!reg->name)
+				goto free_regs;
+		}
+	}
+
+	ret = hdr->num_regs;
+	goto out;
+
+free_regs:
+	/* The caller falls back to parsing the spec */
+	intel_reg_spec_free(*regs, i);
+	*regs = NULL;
+out:
+	munmap(map, size);
+
+	return ret;
+}
+
+static uint32_t add_string(char **strings, size_t *size, size_t *used,
+			   const char *str)
+{
+	size_t len = strlen(str) + 1;
+	uint32_t offset = *used;
+
+	while (*used + len > *size) {
+		size_t new_size = *size ? 2 * *size : 4096;
+		char *new_strings = realloc(*strings, new_size);
+
+		if (!new_strings)
+			return SPEC_CACHE_NO_NAME;
+
+		*strings = new_strings;
+		*size = new_size;
+	}
+
+	memcpy(*strings + *used, str, len);
+	*used += len;
+
+	return offset;
+}
+
+static int port_desc_index(const struct port_desc *desc)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(port_descs); i++)
+		if (port_descs[i].port == desc->port &&
+		    !strcmp(port_descs[i].name, desc->name))
+			return i;
+
+	return -1;
+}
+
+/*
+ * Under sudo, $HOME and $XDG_CACHE_HOME are usually still the user's, whose
+ * cache shouldn't get files they can't replace. Only use a cache directory
+ * which is ours, or create one where that leaves nothing in another user's
+ * directory: in one of ours, or in a sticky one like /tmp.
+ */
+static bool cache_dir_is_ours(const char *cachepath)
+{
+	char *dir, *p;
+	struct stat st;
+	bool ours = false;
+
+	dir = strdup(cachepath);
+	if (!dir)
+		return false;
+
+	/* The nearest existing directory on the way to the cache file */
+	while ((p = strrchr(dir, '/')) && p != dir) {
+		*p = '\0';
+		if (stat(dir, &st) == 0) {
+			ours = st.st_uid == geteuid() || st.st_mode & S_ISVTX;
+			break;
+		}
+	}
+
+	free(dir);
+
+	return ours;
+}
+
+/* Write to a temporary file and rename, so readers never see it half done. */
+static void write_spec_cache(const struct reg *regs, size_t count,
+			     const struct spec_sources *sources,
+			     const char *cachepath)
+{
+	struct spec_cache_header hdr = { SPEC_CACHE_MAGIC, SPEC_CACHE_VERSION };
+	struct spec_cache_file *files = NULL;
+	struct spec_cache_reg *cregs = NULL;
+	char *strings = NULL, *tmp = NULL, *dir, *p;
+	size_t strings_size = 0, used = 0, i;
+	FILE *out = NULL;
+	bool ok = false;
+	int fd;
+
+	files = calloc(sources->count, sizeof(*files));
+	cregs = calloc(count ?: 1, sizeof(*cregs));
+	if (!files || !cregs)
+		goto out;
+
+	for (i = 0; i < sources->count; i++) {
+		const struct spec_source *src = &sources->files[i];
+
+		files[i].mtime_sec = src->st.st_mtim.tv_sec;
+		files[i].mtime_nsec = src->st.st_mtim.tv_nsec;
+		files[i].size = src->st.st_size;
+		files[i].ino = src->st.st_ino;
+		files[i].path = add_string(&strings, &strings_size, &used,
+					   src->path);
+		if (files[i].path == SPEC_CACHE_NO_NAME)
+			goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		int port = port_desc_index(&regs[i].port_desc);
+
+		if (port < 0)
+			goto out;
+
+		cregs[i].port_desc = port;
+		cregs[i].addr = regs[i].addr;
+		cregs[i].mmio_offset = regs[i].mmio_offset;
+		cregs[i].name = SPEC_CACHE_NO_NAME;
+		if (regs[i].name) {
+			cregs[i].name = add_string(&strings, &strings_size,
+						   &used, regs[i].name);
+			if (cregs[i].name == SPEC_CACHE_NO_NAME)
+				goto out;
+		}
+	}
+
+	hdr.num_files = sources->count;
+	hdr.num_regs = count;
+	hdr.strings_size = used;
+
+	if (!cache_dir_is_ours(cachepath))
+		goto out;
+
+	/* mkdir -p the cache directory */
+	dir = strdup(cachepath);
+	if (!dir)
+		goto out;
+	for (p = strchr(dir + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		mkdir(dir, 0755);
+		*p = '/';
+	}
+	free(dir);
+
+	if (asprintf(&tmp, "%s.XXXXXX", cachepath) < 0) {
+		tmp = NULL;
+		goto out;
+	}
+
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto out;
+
+	out = fdopen(fd, "w");
+	if (!out) {
+		close(fd);
+		unlink(tmp);
+		goto out;
+	}
+
+	fwrite(&hdr, sizeof(hdr), 1, out);
+	fwrite(files, sizeof(*files), sources->count, out);
+	fwrite(cregs, sizeof(*cregs), count, out);
+	fwrite(strings, 1, used, out);
+
+	ok = !ferror(out);
+	if (fclose(out))
+		ok = false;
+	if (!ok || rename(tmp, cachepath))
+		unlink(tmp);
+
+out:
+	free(tmp);
+	free(strings);
+	free(cregs);
+	free(files);
+}
+
+/*
+ * Get register definitions from file, from the compiled cache of it if
+ * that is up to date, and updating the cache otherwise. The cache lives in
+ * $INTEL_REG_SPEC_CACHE, or else $XDG_CACHE_HOME/intel-gpu-tools or
+ * ~/.cache/intel-gpu-tools; an empty INTEL_REG_SPEC_CACHE disables it. It
+ * is only written when the cache directory belongs to the effective user.
+ */
+ssize_t intel_reg_spec_file_cached(struct reg **regs, const char *file)
+{
+	struct spec_sources sources = {};
+	char *specpath, *cachepath;
+	size_t nregs = 0;
+	ssize_t ret;
+
+	specpath = realpath(file, NULL);
+	cachepath = specpath ? spec_cache_path(specpath) : NULL;
+	if (!cachepath) {
+		free(specpath);
+		return intel_reg_spec_file(regs, file);
+	}
+
+	ret = read_spec_cache(regs, cachepath, specpath);
+	if (ret >= 0)
+		goto out;
+
+	*regs = NULL;
+	ret = parse_file(regs, &nregs, 0, file, &sources);
+	if (ret >= 0)
+		write_spec_cache(*regs, ret, &sources, cachepath);
+
+	free_sources(&sources);
+out:
+	free(cachepath);
+	free(specpath);
+
+	return ret;
 }
 
 /*
@@ -351,3 +791,155 @@ void intel_reg_spec_print_ports(void)
 	for (i = 0; i < ARRAY_SIZE(port_descs); i++)
 		printf("%s%s", i == 0 ? "" : ", ", port_descs[i].name);
 }
+
+struct reg_index {
+	const struct reg *regs;
+	uint32_t mask;
+	uint32_t *by_addr;
+	uint32_t *by_name;
+};
+
+#define INDEX_EMPTY 0xffffffff
+
+static uint32_t hash_addr(enum port_addr port, uint32_t addr)
+{
+	uint32_t hash = (uint32_t)port * 0x9e3779b9 ^ addr;
+
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+
+	return hash;
+}
+
+/* FNV-1a over the lower cased name and the port */
+static uint32_t hash_name(enum port_addr port, const char *name)
+{
+	uint32_t hash = 2166136261u ^ (uint32_t)port;
+
+	for (; *name; name++) {
+		hash ^= tolower((unsigned char)*name);
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+/* Registers on the same port are the same if offset + address match. */
+static uint32_t reg_addr(const struct reg *reg)
+{
+	return reg->addr + reg->mmio_offset;
+}
+
+/*
+ * Build hash tables over regs for intel_reg_spec_find_addr() and
+ * intel_reg_spec_find_name(). regs must outlive the index. Where several
+ * registers share an address or name, the first one in regs is found, as
+ * with a linear search.
+ */
+struct reg_index *intel_reg_spec_index(const struct reg *regs, size_t n)
+{
+	struct reg_index *index;
+	size_t size = 16, i;
+
+	while (size < 2 * n)
+		size *= 2;
+
+	index = calloc(1, sizeof(*index));
+	if (!index)
+		return NULL;
+
+	index->regs = regs;
+	index->mask = size - 1;
+	index->by_addr = malloc(size * sizeof(*index->by_addr));
+	index->by_name = malloc(size * sizeof(*index->by_name));
+	if (!index->by_addr || !index->by_name) {
+		intel_reg_spec_index_free(index);
+		return NULL;
+	}
+	memset(index->by_addr, 0xff, size * sizeof(*index->by_addr));
+	memset(index->by_name, 0xff, size * sizeof(*index->by_name));
+
+	for (i = 0; i < n; i++) {
+		const struct reg *r = &regs[i];
+		enum port_addr port = r->port_desc.port;
+		uint32_t h, e;
+
+		for (h = hash_addr(port, reg_addr(r)) & index->mask;
+		     (e = index->by_addr[h]) != INDEX_EMPTY;
+		     h = (h + 1) & index->mask) {
+			if (regs[e].port_desc.port == port &&
+			    reg_addr(&regs[e]) == reg_addr(r))
+				break;
+		}
+		if (e == INDEX_EMPTY)
+			index->by_addr[h] = i;
+
+		if (!r->name)
+			continue;
+
+		for (h = hash_name(port, r->name) & index->mask;
+		     (e = index->by_name[h]) != INDEX_EMPTY;
+		     h = (h + 1) & index->mask) {
+			if (regs[e].port_desc.port == port &&
+			    strcasecmp(regs[e].name, r->name) == 0)
+				break;
+		}
+		if (e == INDEX_EMPTY)
+			index->by_name[h] = i;
+	}
+
+	return index;
+}
+
+void intel_reg_spec_index_free(struct reg_index *index)
+{
+	if (!index)
+		return;
+
+	free(index->by_addr);
+	free(index->by_name);
+	free(index);
+}
+
+/*
+ * Find the register on port at addr, which includes the MMIO offset.
+ */
+const struct reg *intel_reg_spec_find_addr(const struct reg_index *index,
+					   enum port_addr port, uint32_t addr)
+{
+	uint32_t h, e;
+
+	for (h = hash_addr(port, addr) & index->mask;
+	     (e = index->by_addr[h]) != INDEX_EMPTY;
+	     h = (h + 1) & index->mask) {
+		const struct reg *r = &index->regs[e];
+
+		if (r->port_desc.port == port && reg_addr(r) == addr)
+			return r;
+	}
+
+	return NULL;
+}
+
+/*
+ * Find the register on port called name, ignoring case.
+ */
+const struct reg *intel_reg_spec_find_name(const struct reg_index *index,
+					   enum port_addr port,
+					   const char *name)
+{
+	uint32_t h, e;
+
+	for (h = hash_name(port, name) & index->mask;
+	     (e = index->by_name[h]) != INDEX_EMPTY;
+	     h = (h + 1) & index->mask) {
+		const struct reg *r = &index->regs[e];
+
+		if (r->port_desc.port == port &&
+		    strcasecmp(r->name, name) == 0)
+			return r;
+	}
+
+	return NULL;
+}
@@ -67,12 +67,24 @@ static inline void *recalloc(void *ptr, size_t nmemb, size_t size)
 	return realloc(ptr, nmemb * size);
 }
 
+/* Hash tables over a register spec, for looking up by address and name */
+struct reg_index;
+
 int parse_port_desc(struct reg *reg, const char *s);
 ssize_t intel_reg_spec_builtin(struct reg **regs, uint32_t devid);
 ssize_t intel_reg_spec_file(struct reg **regs, const char *filename);
+ssize_t intel_reg_spec_file_cached(struct reg **regs, const char *filename);
 void intel_reg_spec_free(struct reg *regs, size_t n);
 int intel_reg_spec_decode(char *buf, size_t bufsize, const struct reg *reg,
 			  uint32_t val, uint32_t devid);
 void intel_reg_spec_print_ports(void);
 
+struct reg_index *intel_reg_spec_index(const struct reg *regs, size_t n);
+void intel_reg_spec_index_free(struct reg_index *index);
+const struct reg *intel_reg_spec_find_addr(const struct reg_index *index,
+					   enum port_addr port, uint32_t addr);
+const struct reg *intel_reg_spec_find_name(const struct reg_index *index,
+					   enum port_addr port,
+					   const char *name);
+
 #endif /* __INTEL_REG_SPEC_H__ */